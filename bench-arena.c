@@ -0,0 +1,123 @@
+/*
+ * Arena benchmark.
+ *
+ * Starts the same program over and over, as a host that resets its
+ * interpreters does: a short script, one with a few hundred lines of
+ * jumps and strings, and one whose strings outgrow the heap so that it
+ * grows and is collected as it runs. Reports the time per ubasic_init()
+ * and per run to the end.
+ *
+ * Usage: bench-arena [runs]
+ */
+
+#include "ubasic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUNDS 5 /* best of */
+
+/*---------------------------------------------------------------------------*/
+static char *short_program(void)
+{
+  char *program = malloc(256);
+
+  if (program != NULL) {
+    strcpy(program, "10 a = 3\n20 b$ = \"x\" + str$(a)\n30 if a < 5 then goto 50\n"
+                    "40 a = 0\n50 end\n");
+  }
+  return program;
+}
+/*---------------------------------------------------------------------------*/
+static char *lines_program(void)
+{
+  char *program, *p;
+  int i;
+
+  program = malloc(64 * 320);
+  if (program == NULL) {
+    return NULL;
+  }
+  p = program;
+  for (i = 0; i < 300; i++) {
+    switch (i % 4) {
+    case 0:
+      p += sprintf(p, "%d a = a + %d\n", 10 + i * 10, i % 7);
+      break;
+    case 1:
+      p += sprintf(p, "%d if a > %d then goto %d\n", 10 + i * 10, i, 30 + i * 10);
+      break;
+    case 2:
+      p += sprintf(p, "%d b$ = \"line %d\"\n", 10 + i * 10, i);
+      break;
+    default:
+      p += sprintf(p, "%d gosub %d\n", 10 + i * 10, 3020);
+      break;
+    }
+  }
+  p += sprintf(p, "3010 end\n3020 c = c + 1\n3030 return\n");
+  return program;
+}
+/*---------------------------------------------------------------------------*/
+static char *grow_program(void)
+{
+  char *program = malloc(256);
+
+  if (program != NULL) {
+    strcpy(program, "10 for i = 1 to 200\n20 a$ = left$(a$ + \"abcdefgh\", 100)\n"
+                    "30 b$ = a$ + str$(i)\n40 next i\n50 end\n");
+  }
+  return program;
+}
+/*---------------------------------------------------------------------------*/
+static void bench(const char *name, char *program, int runs)
+{
+  unsigned long long start, load, exec, best_load = 0, best_exec = 0;
+  int r, i;
+
+  if (program == NULL) {
+    printf("%s out of memory\n", name);
+    return;
+  }
+  for (r = 0; r < ROUNDS; r++) {
+    load = exec = 0;
+    for (i = 0; i < runs; i++) {
+      start = ubasic_clock();
+      ubasic_init(program);
+      load += ubasic_clock() - start;
+      start = ubasic_clock();
+      do {
+        ubasic_run();
+      } while(!ubasic_finished());
+      exec += ubasic_clock() - start;
+    }
+    if (r == 0 || load < best_load) {
+      best_load = load;
+    }
+    if (r == 0 || exec < best_exec) {
+      best_exec = exec;
+    }
+  }
+  printf("%s %9ld %10.2f %10.2f\n", name, (long)strlen(program),
+         best_load / 1e3 / runs, best_exec / 1e3 / runs);
+  if (ubasic_error(NULL) != UBASIC_ERROR_NONE) {
+    printf("%s stopped with error %d\n", name, ubasic_error(NULL));
+  }
+  free(program);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  int runs = 200;
+
+  if (argc > 1) {
+    runs = atoi(argv[1]);
+  }
+  printf("program    bytes   init (us)   run (us)\n");
+  bench("short  ", short_program(), runs);
+  bench("lines  ", lines_program(), runs);
+  ubasic_heap_config(512, 16384, UBASIC_GC_ADAPTIVE, 0);
+  bench("grow   ", grow_program(), runs);
+  return 0;
+}
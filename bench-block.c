@@ -0,0 +1,109 @@
+/*
+ * Block PEEK/POKE benchmark.
+ *
+ * Dumps a 16 register device into variables a to p and writes it back,
+ * once with a PEEK/POKE per register and once with the block forms,
+ * against an in-memory device. Reports host callback calls and time
+ * per register.
+ *
+ * Usage: bench-block [runs]
+ */
+
+#include "ubasic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define REGISTERS 16
+#define ITERATIONS 10000 /* 100 x 100 nested FOR loop */
+
+static VARIABLE_TYPE device[256];
+static long calls;
+
+static const char single[] =
+  "10 for x = 1 to 100\n"
+  "20 for y = 1 to 100\n"
+  "30 peek 0, a\n31 peek 1, b\n32 peek 2, c\n33 peek 3, d\n"
+  "34 peek 4, e\n35 peek 5, f\n36 peek 6, g\n37 peek 7, h\n"
+  "38 peek 8, i\n39 peek 9, j\n40 peek 10, k\n41 peek 11, l\n"
+  "42 peek 12, m\n43 peek 13, n\n44 peek 14, o\n45 peek 15, p\n"
+  "50 poke 16, a\n51 poke 17, b\n52 poke 18, c\n53 poke 19, d\n"
+  "54 poke 20, e\n55 poke 21, f\n56 poke 22, g\n57 poke 23, h\n"
+  "58 poke 24, i\n59 poke 25, j\n60 poke 26, k\n61 poke 27, l\n"
+  "62 poke 28, m\n63 poke 29, n\n64 poke 30, o\n65 poke 31, p\n"
+  "70 next y\n"
+  "80 next x\n"
+  "90 end\n";
+
+static const char block[] =
+  "10 for x = 1 to 100\n"
+  "20 for y = 1 to 100\n"
+  "30 peek 0, a to p\n"
+  "50 poke 16, a to p\n"
+  "70 next y\n"
+  "80 next x\n"
+  "90 end\n";
+
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE peek(VARIABLE_TYPE addr)
+{
+  calls++;
+  return device[(unsigned char)addr];
+}
+/*---------------------------------------------------------------------------*/
+static void poke(VARIABLE_TYPE addr, VARIABLE_TYPE value)
+{
+  calls++;
+  device[(unsigned char)addr] = value;
+}
+/*---------------------------------------------------------------------------*/
+static void peek_block(VARIABLE_TYPE addr, VARIABLE_TYPE *dst, int n)
+{
+  calls++;
+  memcpy(dst, device + (unsigned char)addr, n * sizeof(VARIABLE_TYPE));
+}
+/*---------------------------------------------------------------------------*/
+static void poke_block(VARIABLE_TYPE addr, VARIABLE_TYPE const *src, int n)
+{
+  calls++;
+  memcpy(device + (unsigned char)addr, src, n * sizeof(VARIABLE_TYPE));
+}
+/*---------------------------------------------------------------------------*/
+static void run(const char *name, const char *program, int runs)
+{
+  clock_t start;
+  double t;
+  int i;
+
+  calls = 0;
+  start = clock();
+  for (i = 0; i < runs; i++) {
+    ubasic_init_peek_poke(program, peek, poke);
+    do {
+      ubasic_run();
+    } while(!ubasic_finished());
+  }
+  t = (double)(clock() - start) / CLOCKS_PER_SEC;
+  printf("%s %8.2f calls/dump %8.1f ns/register\n", name,
+         (double)calls / ((double)runs * ITERATIONS),
+         t * 1e9 / ((double)runs * ITERATIONS * 2 * REGISTERS));
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  int runs = 10;
+  int i;
+
+  if (argc > 1) {
+    runs = atoi(argv[1]);
+  }
+  for (i = 0; i < 256; i++) {
+    device[i] = (VARIABLE_TYPE)i;
+  }
+  run("single", single, runs);
+  ubasic_set_block_peek_poke(peek_block, poke_block);
+  run("block ", block, runs);
+  return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * Host function call benchmark.
+ *
+ * Adds two numbers in a BASIC loop with CALL add(i, j), with the same
+ * addition tunnelled through PEEK/POKE (two POKEs for the arguments and
+ * a PEEK for the result) and with plain i + j, and reports the cost per
+ * operation with the cost of the same loop doing a plain assignment
+ * subtracted.
+ *
+ * Usage: bench-call [runs]
+ */
+
+#include "ubasic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define ITERATIONS 10000 /* 100 x 100 nested FOR loop */
+
+static VARIABLE_TYPE registers[3];
+static long calls;
+
+struct bench {
+  const char *name;
+  const char *body;
+};
+
+static const struct bench benches[] = {
+  {"call add    ", "k = call add(i, j)"},
+  {"peek/poke   ", "poke 0, i : poke 1, j : peek 2, k"},
+  {"expression  ", "k = i + j"},
+  {NULL, NULL}
+};
+
+/*---------------------------------------------------------------------------*/
+static union ubasic_value add(union ubasic_value const *args)
+{
+  union ubasic_value r;
+
+  calls++;
+  r.num = args[0].num + args[1].num;
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE peek(VARIABLE_TYPE addr)
+{
+  calls++;
+  return registers[0] + registers[1];
+}
+/*---------------------------------------------------------------------------*/
+static void poke(VARIABLE_TYPE addr, VARIABLE_TYPE value)
+{
+  calls++;
+  registers[addr & 1] = value;
+}
+/*---------------------------------------------------------------------------*/
+static double run(const char *body, int runs)
+{
+  static char program[512];
+  clock_t start;
+  int i;
+
+  sprintf(program,
+          "10 for i = 1 to 100\n"
+          "20 for j = 1 to 100\n"
+          "30 %s\n"
+          "40 next j\n"
+          "50 next i\n"
+          "60 end\n",
+          body);
+
+  start = clock();
+  for (i = 0; i < runs; i++) {
+    ubasic_init_peek_poke(program, peek, poke);
+    do {
+      ubasic_run();
+    } while(!ubasic_finished());
+  }
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  const struct bench *b;
+  double base, t;
+  int runs = 50;
+
+  if (argc > 1) {
+    runs = atoi(argv[1]);
+  }
+  ubasic_register_function("add", add, 2, "nnn");
+  for (b = benches; b->name != NULL; b++) {
+    base = run("k = 0", runs);
+    calls = 0;
+    t = run(b->body, runs);
+    printf("%s %8.1f ns/op %6.2f host calls/op\n", b->name,
+           (t - base) * 1e9 / ((double)runs * ITERATIONS),
+           (double)calls / ((double)runs * ITERATIONS));
+  }
+  return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Superinstruction benchmark.
+ *
+ * Runs a counting loop made of IF v relop k THEN GOTO n and LET v = v + k,
+ * nested FOR loops with a trivial body, a loop PRINTing its variable and
+ * a mixed loop where only some statements have a fused shape, each with
+ * the superinstructions off and on. Reports the time per statement (the
+ * statements run without them), the speedup and, for each shape, the
+ * share of those statements that ran fused.
+ *
+ * The programs print to stdout, which is sent to the null device, so the
+ * results go to stderr.
+ *
+ * Usage: bench-fused [runs]
+ */
+
+#include "ubasic.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+#define ROUNDS 5 /* best of, off and on interleaved */
+
+struct bench {
+  const char *name;
+  const char *program;
+};
+
+static const struct bench benches[] = {
+  {"if goto ", "10 i = 0\n"
+               "20 i = i + 1\n"
+               "30 if i < 20000 then goto 20\n"
+               "40 end\n"},
+  {"for     ", "10 for i = 1 to 100\n"
+               "20 for j = 1 to 100\n"
+               "30 k = k + 3\n"
+               "40 next j\n"
+               "50 next i\n"
+               "60 end\n"},
+  {"print   ", "10 for i = 1 to 5000\n"
+               "20 print i\n"
+               "30 next i\n"
+               "40 end\n"},
+  {"mixed   ", "10 for x = 1 to 100\n"
+               "20 for y = 1 to 100\n"
+               "30 s = s + x * 3 + y\n"
+               "40 if s > 50 then c = c + 1\n"
+               "50 t = t + 1\n"
+               "60 if t >= 10 then goto 80\n"
+               "70 d = d + y\n"
+               "80 next y\n"
+               "90 next x\n"
+               "100 end\n"},
+  {NULL, NULL}
+};
+
+/*---------------------------------------------------------------------------*/
+static unsigned long long run(const char *program, int fused, int runs,
+                              struct ubasic_fused_stats *stats)
+{
+  unsigned long long start;
+  int i;
+
+  ubasic_set_fused(fused);
+  start = ubasic_clock();
+  for (i = 0; i < runs; i++) {
+    ubasic_init(program);
+    do {
+      ubasic_run();
+    } while(!ubasic_finished());
+  }
+  start = ubasic_clock() - start;
+  ubasic_fused_stats(stats);
+  return start;
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  static const char *kinds[UBASIC_FUSED_KINDS] = {"if goto", "add", "for", "next", "print"};
+  const struct bench *b;
+  struct ubasic_fused_stats off, on;
+  unsigned long long t, best_off, best_on;
+  double per;
+  int runs = 20;
+  int r, k;
+
+  if (argc > 1) {
+    runs = atoi(argv[1]);
+  }
+  if (freopen(NULL_DEVICE, "w", stdout) == NULL) {
+    fprintf(stderr, "Cannot open %s - terminating\n", NULL_DEVICE);
+    return (-1);
+  }
+
+  fprintf(stderr, "workload   off ns/st   on ns/st  speedup  fused statements\n");
+  for (b = benches; b->name != NULL; b++) {
+    best_off = best_on = 0;
+    for (r = 0; r < ROUNDS; r++) {
+      t = run(b->program, 0, runs, &off);
+      if (r == 0 || t < best_off) {
+        best_off = t;
+      }
+      t = run(b->program, 1, runs, &on);
+      if (r == 0 || t < best_on) {
+        best_on = t;
+      }
+    }
+    per = (double)runs * off.statements; /* statements as run unfused */
+    fprintf(stderr, "%s %10.1f %10.1f %7.2fx ", b->name,
+            best_off / per, best_on / per, (double)best_off / best_on);
+    for (k = 0; k < UBASIC_FUSED_KINDS; k++) {
+      if (on.sites[k] > 0) {
+        fprintf(stderr, " %s %.0f%%", kinds[k], on.hits[k] * 100.0 / off.statements);
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+  return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * INPUT throughput benchmark.
+ *
+ * Generates a log-like input file and runs a BASIC script that reads it
+ * line by line with LINE INPUT, reporting the throughput in MB/s next to
+ * a plain fread() of the same file for comparison.
+ *
+ * Usage: bench-input [megabytes] [file]
+ */
+
+#include "ubasic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const char program[] =
+  "10 if eof then end\n"
+  "20 line input a$\n"
+  "30 goto 10\n";
+
+/*---------------------------------------------------------------------------*/
+static long generate(const char *fname, long bytes)
+{
+  FILE *f;
+  long written = 0;
+  long n = 0;
+
+  if ((f = fopen(fname, "wb")) == NULL) {
+    return -1;
+  }
+  while (written < bytes) {
+    written += fprintf(f, "2008-11-%02ld 12:%02ld:%02ld host%03ld GET /index/%ld.html 200 %ld\n",
+                       n % 28 + 1, n % 60, (n * 7) % 60, n % 997, n, (n * 31) % 65536);
+    n++;
+  }
+  fclose(f);
+  return written;
+}
+/*---------------------------------------------------------------------------*/
+static double seconds(clock_t start)
+{
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  static char buffer[65536];
+  const char *fname = "bench-input.txt";
+  long bytes = 64;
+  double mb, t;
+  clock_t start;
+  FILE *f;
+
+  if (argc > 1) {
+    bytes = atol(argv[1]);
+  }
+  if (argc > 2) {
+    fname = argv[2];
+  }
+  if ((bytes = generate(fname, bytes * 1024 * 1024)) < 0) {
+    printf("Cannot create \"%s\" - terminating\n", fname);
+    return (-1);
+  }
+  mb = bytes / (1024.0 * 1024.0);
+
+  f = fopen(fname, "rb");
+  start = clock();
+  while (fread(buffer, 1, sizeof(buffer), f) > 0)
+    ;
+  t = seconds(start);
+  fclose(f);
+  printf("fread:      %8.1f MB in %6.3f s, %8.1f MB/s\n", mb, t, mb / t);
+
+  f = fopen(fname, "rb");
+  ubasic_set_input(f);
+  ubasic_init(program);
+  start = clock();
+  do {
+    ubasic_run();
+  } while(!ubasic_finished());
+  t = seconds(start);
+  fclose(f);
+  printf("line input: %8.1f MB in %6.3f s, %8.1f MB/s\n", mb, t, mb / t);
+
+  remove(fname);
+  return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Load-time optimizer benchmark.
+ *
+ * Generates programs with the shapes the optimizer works on and runs
+ * each with it off and on: a loop whose GOTO lands on a chain of GOTOs, a
+ * loop at the end of a long program, whose jumps walk the line index
+ * from its first line, and a loop followed by subroutines nothing calls.
+ * Reports the load and run time both ways, the speedup of the run and
+ * the lines the optimizer left out and the jumps it threaded.
+ *
+ * Usage: bench-optimize [lines]
+ */
+
+#include "ubasic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUNDS 5 /* best of, off and on interleaved */
+
+/*---------------------------------------------------------------------------*/
+static char *chain_program(int lines)
+{
+  char *program, *p;
+  int i;
+
+  program = malloc(64 * (lines + 8));
+  if (program == NULL) {
+    return NULL;
+  }
+  p = program;
+  p += sprintf(p, "10 i = 0\n20 i = i + 1\n30 if i < 20000 then goto 1000\n40 end\n");
+  for (i = 0; i < 4; i++) { /* a chain of four GOTOs back to the loop */
+    p += sprintf(p, "%d goto %d\n", 1000 + i, i < 3 ? 1001 + i : 20);
+  }
+  return program;
+}
+/*---------------------------------------------------------------------------*/
+static char *late_program(int lines)
+{
+  char *program, *p;
+  int i;
+
+  program = malloc(64 * (lines + 8));
+  if (program == NULL) {
+    return NULL;
+  }
+  p = program;
+  for (i = 0; i < lines; i++) { /* run once, so every line is in the index */
+    p += sprintf(p, "%d a = a + %d\n", 10 + i, i % 7);
+  }
+  p += sprintf(p, "%d i = 0\n", 10 + lines);
+  p += sprintf(p, "%d i = i + 1 : k = k + i\n", 11 + lines);
+  p += sprintf(p, "%d if i < 20000 then goto %d\n", 12 + lines, 11 + lines);
+  p += sprintf(p, "%d end\n", 13 + lines);
+  return program;
+}
+/*---------------------------------------------------------------------------*/
+static char *dead_program(int lines)
+{
+  char *program, *p;
+  int i;
+
+  program = malloc(64 * (lines + 8));
+  if (program == NULL) {
+    return NULL;
+  }
+  p = program;
+  p += sprintf(p, "10 for i = 1 to 2000\n20 k = k + i * 3\n30 next i\n40 end\n");
+  for (i = 0; i < lines; i++) { /* subroutines nothing calls */
+    p += sprintf(p, "%d b$ = \"unused %d\" + b$ : c = c * %d\n", 100 + i, i, i % 5);
+    if (i % 10 == 9) {
+      p += sprintf(p, "%d return\n", 100 + i);
+    }
+  }
+  return program;
+}
+/*---------------------------------------------------------------------------*/
+static void run(const char *program, int optimize, unsigned long long *load,
+                unsigned long long *exec)
+{
+  unsigned long long start;
+
+  ubasic_set_optimize(optimize);
+  start = ubasic_clock();
+  ubasic_init(program);
+  *load = ubasic_clock() - start;
+  start = ubasic_clock();
+  do {
+    ubasic_run();
+  } while(!ubasic_finished());
+  *exec = ubasic_clock() - start;
+}
+/*---------------------------------------------------------------------------*/
+static void bench(const char *name, char *program)
+{
+  struct ubasic_finding *findings;
+  unsigned long long load_off = 0, load_on = 0, off = 0, on = 0, l, t;
+  int dropped = 0, threaded = 0;
+  int r, i, n;
+
+  if (program == NULL) {
+    printf("%s out of memory\n", name);
+    return;
+  }
+  for (r = 0; r < ROUNDS; r++) {
+    run(program, 0, &l, &t);
+    if (r == 0 || l < load_off) {
+      load_off = l;
+    }
+    if (r == 0 || t < off) {
+      off = t;
+    }
+    run(program, 1, &l, &t);
+    if (r == 0 || l < load_on) {
+      load_on = l;
+    }
+    if (r == 0 || t < on) {
+      on = t;
+    }
+  }
+  n = ubasic_findings(NULL, 0);
+  if ((findings = malloc((n + 1) * sizeof(struct ubasic_finding))) != NULL) {
+    ubasic_findings(findings, n);
+    for (i = 0; i < n; i++) {
+      dropped += findings[i].kind == UBASIC_FINDING_UNREACHABLE;
+      threaded += findings[i].kind == UBASIC_FINDING_THREADED;
+    }
+    free(findings);
+  }
+  printf("%s %9ld %9.1f %9.1f %9.1f %9.1f %7.2fx %7d %7d\n", name, (long)strlen(program),
+         load_off / 1e3, load_on / 1e3, off / 1e3, on / 1e3, (double)off / on, dropped, threaded);
+  free(program);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  int lines = 1000;
+
+  if (argc > 1) {
+    lines = atoi(argv[1]);
+  }
+  printf("program      bytes   load off   load on    run off    run on  speedup  dropped threaded\n");
+  printf("                         (us)      (us)       (us)      (us)\n");
+  bench("chain  ", chain_program(lines));
+  bench("late   ", late_program(lines));
+  bench("dead   ", dead_program(lines));
+  return 0;
+}
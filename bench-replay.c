@@ -0,0 +1,120 @@
+/*
+ * Record and replay benchmark.
+ *
+ * Runs a loop that PEEKs a changing device and adds in a variable the
+ * host sets every so often, once without a log, once recording to a
+ * temporary file and once replaying that recording with no device at
+ * all. Reports the time per statement, the recording overhead, the log
+ * size per input and whether the replay reproduced the recorded run.
+ *
+ * Usage: bench-replay [runs]
+ */
+
+#include "ubasic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define PEEKS 10000 /* one per iteration of the 100 x 100 loop */
+
+static const char program[] =
+  "10 for x = 1 to 100\n"
+  "20 for y = 1 to 100\n"
+  "30 peek y, a\n"
+  "40 s = s + a * 3 + z\n"
+  "50 if a > 50 then c = c + 1\n"
+  "60 next y\n"
+  "70 next x\n"
+  "80 end\n";
+
+static unsigned long seed;
+static long statements;
+static long host_sets;
+
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE peek(VARIABLE_TYPE addr)
+{
+  seed = seed * 1103515245 + 12345;
+  return (VARIABLE_TYPE)((seed >> 16) % 100 + addr % 3);
+}
+/*---------------------------------------------------------------------------*/
+static void poke(VARIABLE_TYPE addr, VARIABLE_TYPE value)
+{
+}
+/*---------------------------------------------------------------------------*/
+static double run(FILE *log, int replaying, int runs)
+{
+  clock_t start;
+  long n;
+  int i;
+
+  statements = host_sets = 0;
+  start = clock();
+  for (i = 0; i < runs; i++) {
+    ubasic_init_peek_poke(program, replaying ? NULL : peek, poke);
+    if (log != NULL) {
+      rewind(log);
+      if (replaying) {
+        ubasic_replay(log);
+      } else {
+        ubasic_record(log);
+      }
+    }
+    n = 0;
+    do {
+      if (++n % 1000 == 0) {
+        ubasic_set_variable(25, (VARIABLE_TYPE)(seed % 7)); /* z */
+        host_sets++;
+      }
+      ubasic_run();
+    } while(!ubasic_finished());
+    statements += n;
+    if (log != NULL) {
+      if (replaying) {
+        ubasic_replay(NULL);
+      } else {
+        ubasic_record(NULL);
+      }
+    }
+  }
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  VARIABLE_TYPE s, c;
+  double base, record, replay;
+  long bytes, sets;
+  int runs = 50;
+  FILE *log;
+
+  if (argc > 1) {
+    runs = atoi(argv[1]);
+  }
+  if ((log = tmpfile()) == NULL) {
+    printf("Cannot create a temporary file - terminating\n");
+    return (-1);
+  }
+
+  base = run(NULL, 0, runs);
+  record = run(log, 0, runs);
+  s = ubasic_get_variable(18);
+  c = ubasic_get_variable(2);
+  sets = host_sets / runs;
+  fseek(log, 0, SEEK_END);
+  bytes = ftell(log);
+  replay = run(log, 1, runs);
+
+  printf("no log    %8.1f ns/statement\n", base * 1e9 / ((double)statements));
+  printf("record    %8.1f ns/statement %+6.1f%%\n",
+         record * 1e9 / ((double)statements), (record - base) * 100 / base);
+  printf("replay    %8.1f ns/statement %+6.1f%%\n",
+         replay * 1e9 / ((double)statements), (replay - base) * 100 / base);
+  printf("log       %8ld bytes, %.2f bytes/input\n", bytes,
+         (double)(bytes - 8) / (PEEKS + sets));
+  printf("replay %s\n", ubasic_get_variable(18) == s && ubasic_get_variable(2) == c ?
+         "matches the recording" : "DIFFERS from the recording");
+  fclose(log);
+  return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Call stack sampler benchmark.
+ *
+ * Runs a program that spends its time in GOSUB subroutines called from
+ * several places, on the tree walker and on the VM, with the sampler off
+ * and at 1 kHz in turn. Reports the best time of each, what sampling cost
+ * (the median of the rounds, each on against the off just before it, so a
+ * busy machine does not drown it) and how many samples a second it took,
+ * and exits with 1 if it cost more than LIMIT percent.
+ *
+ * Usage: bench-sampler [runs]
+ */
+
+#include "ubasic.h"
+#include "sampler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUNDS 21    /* off and on interleaved */
+#define HZ 1000
+#define LIMIT 2.0    /* percent */
+#define FOLDED "bench-sampler.folded"
+
+static const char program[] =
+  "10 for i = 1 to 20000\n"
+  "20 gosub 1000\n"
+  "30 if i % 3 = 0 then gosub 2000\n"
+  "40 next i\n"
+  "50 end\n"
+  "1000 k = k + i * 2 : if k > 100000 then k = k - 100000\n"
+  "1010 gosub 2000\n"
+  "1020 return\n"
+  "2000 a$ = left$(\"abcdefgh\", i % 8) + str$(i)\n"
+  "2010 return\n";
+
+/*---------------------------------------------------------------------------*/
+static unsigned long long run(int runs)
+{
+  unsigned long long start = ubasic_clock();
+  int i;
+
+  for (i = 0; i < runs; i++) {
+    ubasic_init(program);
+    do {
+      ubasic_run();
+    } while(!ubasic_finished());
+  }
+  return ubasic_clock() - start;
+}
+/*---------------------------------------------------------------------------*/
+static long count_samples(const char *fname)
+{
+  FILE *f = fopen(fname, "r");
+  char line[256], *p;
+  long n = 0;
+
+  if (f == NULL) {
+    return 0;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if ((p = strrchr(line, ' ')) != NULL) {
+      n += atol(p + 1);
+    }
+  }
+  fclose(f);
+  return n;
+}
+/*---------------------------------------------------------------------------*/
+static int compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  static const char *engine_names[2] = {"tree", "vm  "};
+  unsigned long long off, on, best_off, best_on;
+  double cost[ROUNDS];
+  long samples = 0;
+  int runs[2] = {1, 15};
+  int engine, r, failed = 0;
+
+  if (argc > 1) {
+    runs[0] = atoi(argv[1]);
+    runs[1] = runs[0] * 15; // the VM is that much faster here
+  }
+  printf("engine   off (ms)    on (ms)  cost (%%)  samples/s\n");
+  for (engine = UBASIC_ENGINE_TREE; engine <= UBASIC_ENGINE_VM; engine++) {
+    ubasic_set_engine(engine);
+    best_off = best_on = 0;
+    for (r = 0; r < ROUNDS; r++) {
+      off = run(runs[engine]);
+      if (r == 0 || off < best_off) {
+        best_off = off;
+      }
+      if (sampler_open(HZ, 1024) != 0) {
+        printf("no sampler on this system\n");
+        return 0;
+      }
+      on = run(runs[engine]);
+      sampler_write(FOLDED);
+      sampler_close();
+      if (r == 0 || on < best_on) {
+        best_on = on;
+        samples = count_samples(FOLDED);
+      }
+      cost[r] = 100.0 * ((double)on - off) / off;
+    }
+    qsort(cost, ROUNDS, sizeof(double), compare_double);
+    printf("%s %10.1f %10.1f %9.2f %10.0f\n", engine_names[engine], best_off / 1e6,
+           best_on / 1e6, cost[ROUNDS / 2], samples / (best_on / 1e9));
+    if (cost[ROUNDS / 2] > LIMIT) {
+      printf("FAIL: sampling at %d Hz cost more than %.0f%%\n", HZ, LIMIT);
+      failed++;
+    }
+  }
+  remove(FOLDED);
+  ubasic_set_engine(UBASIC_ENGINE_TREE);
+  return failed ? 1 : 0;
+}
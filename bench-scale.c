@@ -0,0 +1,225 @@
+/*
+ * Large-program scalability benchmark.
+ *
+ * Generates programs of 1,000 lines and ten times as many each step up
+ * to the size given, with the optimizer on and off. One has a random
+ * graph of GOTOs and GOSUBs: short hops forward, GOSUBs to subroutines
+ * anywhere at the end of the program and a few jumps back to anywhere
+ * before. The other goes back and forth between its first and last
+ * lines. Reports the load time, the memory the interpreter holds, the
+ * time of the first jump after loading, a jump between the ends once
+ * running and a statement of the random program.
+ *
+ * Each step should cost no more than LIMIT times the one before, after
+ * allowing for the expected growth: linear in the lines for the load,
+ * the memory and (with the optimizer off, as the line is searched for)
+ * the first jump, none for the rest. Otherwise it says what departed and
+ * exits with 1.
+ *
+ * Usage: bench-scale [max lines]
+ */
+
+#include "ubasic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUNDS 5          /* best of, for programs of up to 100,000 lines */
+#define LIMIT 3.0         /* how much worse than expected a step may get */
+#define TIME_FLOOR 2000.0 /* ns, below which timings are noise */
+#define ITERATIONS 5000   /* round trips between the ends */
+
+enum {
+  LOAD,   /* ns */
+  MEMORY, /* bytes */
+  FIRST,  /* ns */
+  JUMP,   /* ns */
+  RUN,    /* ns per statement */
+  METRICS
+};
+static const char *metric_names[METRICS] = {
+  "load", "memory", "first jump", "jump", "statement"
+};
+
+static unsigned long seed;
+
+/*---------------------------------------------------------------------------*/
+static int random_below(int n)
+{
+  seed = seed * 1103515245 + 12345;
+  return (int)((seed >> 8) % (unsigned long)n);
+}
+/*---------------------------------------------------------------------------*/
+static char *graph_program(int lines)
+{
+  // line 10 is a GOSUB to the last subroutine, the first jump timed
+  char *program, *p;
+  int subs = lines / 50 + 1;
+  int main_lines = lines - subs - 1;
+  int i, r;
+
+  program = malloc(64 * (size_t)lines + 64);
+  if (program == NULL) {
+    return NULL;
+  }
+  seed = lines;
+  p = program;
+  p += sprintf(p, "10 gosub %d\n", 10 * (main_lines + subs + 1));
+  for (i = 2; i <= main_lines; i++) {
+    r = random_below(100);
+    if (r < 55 || i == main_lines) {
+      p += sprintf(p, "%d a = a + 1\n", 10 * i);
+    } else if (r < 75) {
+      p += sprintf(p, "%d goto %d\n", 10 * i,
+                   10 * (i + 1 + random_below(i + 16 < main_lines ? 16 : main_lines - i)));
+    } else if (r < 92) {
+      p += sprintf(p, "%d gosub %d\n", 10 * i, 10 * (main_lines + 2 + random_below(subs)));
+    } else {
+      p += sprintf(p, "%d c = c + 1 : if c < 5 then goto %d\n", 10 * i, 10 * (1 + random_below(i)));
+    }
+  }
+  p += sprintf(p, "%d end\n", 10 * (main_lines + 1));
+  for (i = 0; i < subs; i++) {
+    p += sprintf(p, "%d s = s + 1 : return\n", 10 * (main_lines + 2 + i));
+  }
+  return program;
+}
+/*---------------------------------------------------------------------------*/
+static char *ends_program(int lines)
+{
+  char *program, *p;
+  int i;
+
+  program = malloc(32 * (size_t)lines + 128);
+  if (program == NULL) {
+    return NULL;
+  }
+  p = program;
+  p += sprintf(p, "10 i = 0\n20 goto %d\n", 10 * (lines - 2));
+  for (i = 3; i < lines - 2; i++) {
+    p += sprintf(p, "%d a = a + 1\n", 10 * i);
+  }
+  p += sprintf(p, "%d i = i + 1\n", 10 * (lines - 2));
+  p += sprintf(p, "%d if i < %d then goto 20\n", 10 * (lines - 1), ITERATIONS);
+  p += sprintf(p, "%d end\n", 10 * lines);
+  return program;
+}
+/*---------------------------------------------------------------------------*/
+static int run_to_end(void)
+{
+  do {
+    ubasic_run();
+  } while(!ubasic_finished());
+  return ubasic_error(NULL);
+}
+/*---------------------------------------------------------------------------*/
+static int measure(int lines, int optimize, double *m)
+{
+  // fills in m, returns the error a program stopped with
+  struct ubasic_fused_stats stats;
+  unsigned long long start, t;
+  char *graph, *ends;
+  int rounds = lines > 100000 ? 1 : ROUNDS;
+  int r, error = UBASIC_ERROR_NONE;
+
+  graph = graph_program(lines);
+  ends = ends_program(lines);
+  if (graph == NULL || ends == NULL) {
+    free(graph);
+    free(ends);
+    return UBASIC_ERROR_MEMORY;
+  }
+  ubasic_set_optimize(optimize);
+  for (r = 0; r < rounds; r++) {
+    start = ubasic_clock();
+    ubasic_init(graph);
+    t = ubasic_clock() - start;
+    if (r == 0 || t < m[LOAD]) {
+      m[LOAD] = t;
+    }
+    start = ubasic_clock();
+    ubasic_run();
+    t = ubasic_clock() - start;
+    if (r == 0 || t < m[FIRST]) {
+      m[FIRST] = t;
+    }
+    start = ubasic_clock();
+    error |= run_to_end();
+    t = ubasic_clock() - start;
+    ubasic_fused_stats(&stats);
+    if (r == 0 || t / (double)stats.statements < m[RUN]) {
+      m[RUN] = t / (double)stats.statements;
+    }
+  }
+  m[MEMORY] = ubasic_memory();
+  for (r = 0; r < rounds; r++) {
+    ubasic_init(ends);
+    ubasic_run();
+    ubasic_run(); // the first jump to the end, searched for with the optimizer off
+    ubasic_run();
+    start = ubasic_clock();
+    error |= run_to_end();
+    t = ubasic_clock() - start;
+    if (r == 0 || t / (2.0 * (ITERATIONS - 1)) < m[JUMP]) {
+      m[JUMP] = t / (2.0 * (ITERATIONS - 1)); // a jump each way, with the statements between
+    }
+  }
+  ubasic_set_optimize(1);
+  free(graph);
+  free(ends);
+  return error;
+}
+/*---------------------------------------------------------------------------*/
+static int check(int optimize, int lines, const double *before, const double *now)
+{
+  // returns how many metrics grew faster than expected from lines / 10
+  double expected, a, b;
+  int i, failed = 0;
+
+  for (i = 0; i < METRICS; i++) {
+    expected = i == LOAD || i == MEMORY || (i == FIRST && !optimize) ? 10.0 : 1.0;
+    a = before[i];
+    b = now[i];
+    if (i == LOAD || i == FIRST) { // a single event, timed once
+      a = a > TIME_FLOOR ? a : TIME_FLOOR;
+      b = b > TIME_FLOOR ? b : TIME_FLOOR;
+    }
+    if (b / a > LIMIT * expected) {
+      printf("FAIL: %s with the optimizer %s grew %.1f times from %d to %d lines, expected %.0f\n",
+             metric_names[i], optimize ? "on" : "off", b / a, lines / 10, lines, expected);
+      failed++;
+    }
+  }
+  return failed;
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  double m[2][METRICS], before[2][METRICS];
+  int max_lines = 1000000;
+  int lines, optimize, error, failed = 0;
+
+  if (argc > 1) {
+    max_lines = atoi(argv[1]);
+  }
+  printf("    lines optimizer  load (ms)  bytes/line  first jump (us)  jump (ns)  ns/statement\n");
+  for (lines = 1000; lines <= max_lines; lines *= 10) {
+    for (optimize = 1; optimize >= 0; optimize--) {
+      memset(m[optimize], 0, sizeof(m[optimize]));
+      error = measure(lines, optimize, m[optimize]);
+      printf("%9d %9s %10.2f %11.1f %16.2f %10.1f %13.1f\n", lines, optimize ? "on" : "off",
+             m[optimize][LOAD] / 1e6, m[optimize][MEMORY] / lines, m[optimize][FIRST] / 1e3,
+             m[optimize][JUMP], m[optimize][RUN]);
+      if (error != UBASIC_ERROR_NONE) {
+        printf("FAIL: the programs of %d lines stopped with an error\n", lines);
+        failed++;
+      }
+      if (lines > 1000) {
+        failed += check(optimize, lines, before[optimize], m[optimize]);
+      }
+      memcpy(before[optimize], m[optimize], sizeof(m[optimize]));
+    }
+  }
+  return failed ? 1 : 0;
+}
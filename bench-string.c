@@ -0,0 +1,90 @@
+/*
+ * String kernel microbenchmark.
+ *
+ * Runs INSTR and string comparisons over short and long (255 character)
+ * haystacks inside a BASIC loop and reports the cost per operation, with
+ * the cost of the same loop doing a plain assignment subtracted.
+ *
+ * Usage: bench-string [runs]
+ */
+
+#include "ubasic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define ITERATIONS 10000 /* 100 x 100 nested FOR loop */
+
+static const char setup_short[] =
+  "10 h$ = \"the quick brown fox jumps\"\n";
+
+static const char setup_long[] =
+  "10 h$ = \"abcdefghijklmnopqrstuvwxyz0123456789\"\n"
+  "11 h$ = h$ + h$\n"
+  "12 h$ = h$ + h$\n"
+  "13 h$ = h$ + h$\n";
+
+struct bench {
+  const char *name;
+  const char *setup;
+  const char *needle;
+  const char *body;
+};
+
+static const struct bench benches[] = {
+  {"instr short hit ",  setup_short, "fox",   "k = instr(h$, n$)"},
+  {"instr short miss",  setup_short, "cat",   "k = instr(h$, n$)"},
+  {"instr long hit  ",  setup_long,  "89abc", "k = instr(100, h$, n$)"},
+  {"instr long miss ",  setup_long,  "9#",    "k = instr(h$, n$)"},
+  {"compare short   ",  setup_short, "the quick brown fox jumpz", "k = h$ < n$"},
+  {"compare long    ",  setup_long,  "",      "k = h$ <> n$"},
+  {NULL, NULL, NULL, NULL}
+};
+
+/*---------------------------------------------------------------------------*/
+static double run(const struct bench *b, const char *body, int runs)
+{
+  static char program[2048];
+  clock_t start;
+  int i;
+
+  sprintf(program,
+          "%s"
+          "20 n$ = \"%s\"\n"
+          "21 if n$ = \"\" then n$ = h$\n"
+          "30 for i = 1 to 100\n"
+          "40 for j = 1 to 100\n"
+          "50 %s\n"
+          "60 next j\n"
+          "70 next i\n"
+          "80 end\n",
+          b->setup, b->needle, body);
+
+  start = clock();
+  for (i = 0; i < runs; i++) {
+    ubasic_init(program);
+    do {
+      ubasic_run();
+    } while(!ubasic_finished());
+  }
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  const struct bench *b;
+  double base, t;
+  int runs = 50;
+
+  if (argc > 1) {
+    runs = atoi(argv[1]);
+  }
+  for (b = benches; b->name != NULL; b++) {
+    base = run(b, "k = 0", runs);
+    t = run(b, b->body, runs);
+    printf("%s %8.1f ns/op\n", b->name,
+           (t - base) * 1e9 / ((double)runs * ITERATIONS));
+  }
+  return 0;
+}
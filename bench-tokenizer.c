@@ -0,0 +1,228 @@
+/*
+ * Tokenizer throughput benchmark.
+ *
+ * Generates numeric-heavy, string-heavy, keyword-dense and REM-heavy
+ * programs from 1 KB up to a maximum size and reports, for each, the
+ * tokens and bytes per second of a tokenizer_init()/tokenizer_next()
+ * pass and the cycles per token. It then measures a GOTO that has to
+ * scan the whole program for its line (jump_linenum_slow()) and the
+ * cost of tokenizer_stringlookahead() at every token.
+ *
+ * Usage: bench-tokenizer [max_megabytes]
+ */
+
+#include "ubasic.h"
+#include "tokenizer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h> /* __rdtsc() */
+#define HAVE_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> /* __rdtsc() */
+#define HAVE_RDTSC 1
+#endif
+
+#define MIN_TIME 200000000ULL /* repeat small corpora for at least 0.2 s */
+
+struct corpus {
+  const char *name;
+  const char *lines[4]; /* %d is replaced by a varying number */
+};
+
+static const struct corpus corpora[] = {
+  {"numeric", {"let a = %d * 45 + (67 - b) / 9\n",
+               "c = (a + %d) %% 7 - d * 3\n",
+               "poke %d, a + b + c\n",
+               "e = f * g + %d / (h + 1)\n"}},
+  {"string ", {"a$ = \"the quick brown fox %d\" + b$\n",
+               "print left$(a$, %d); mid$(b$, 2, 3); \"done\"\n",
+               "c$ = str$(%d) + chr$(65) + right$(a$, 4)\n",
+               "if a$ = \"line %d\" then print a$\n"}},
+  {"keyword", {"if a < %d then gosub 100 else goto 200\n",
+               "for i = 1 to %d : next i\n",
+               "while b > %d : b = b - 1 : wend\n",
+               "peek %d, c : return\n"}},
+  {"rem    ", {"rem %d this line is a comment and is skipped as a whole\n",
+               "rem %d another comment with some punctuation, ; + - * /\n",
+               "a = %d\n",
+               "rem %d the interpreter never looks inside these lines\n"}},
+  {NULL, {NULL}}
+};
+
+/*---------------------------------------------------------------------------*/
+static unsigned long long cycles(void)
+{
+#ifdef HAVE_RDTSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+static char *generate(const struct corpus *c, long bytes, int numbered)
+{
+  char *program, *p;
+  long n = 0;
+
+  program = malloc(bytes + 256);
+  if (program == NULL) {
+    return NULL;
+  }
+  p = program;
+  while (p - program < bytes) {
+    if (numbered) {
+      p += sprintf(p, "%ld ", n % 9000 + 1000);
+    } else {
+      p += sprintf(p, "1 "); /* never the line a GOTO looks for */
+    }
+    p += sprintf(p, c->lines[n % 4], (int)(n % 100));
+    n++;
+  }
+  return program;
+}
+/*---------------------------------------------------------------------------*/
+static long tokenize(const char *program)
+{
+  long tokens = 0;
+
+  tokenizer_init(program);
+  while (!tokenizer_finished()) {
+    tokenizer_next();
+    tokens++;
+  }
+  return tokens;
+}
+/*---------------------------------------------------------------------------*/
+static long lookahead(const char *program, int look)
+{
+  long tokens = 0;
+
+  tokenizer_init(program);
+  while (!tokenizer_finished()) {
+    if (look) {
+      tokens += tokenizer_stringlookahead();
+    }
+    tokenizer_next();
+    tokens++;
+  }
+  return tokens;
+}
+/*---------------------------------------------------------------------------*/
+static void bench_tokenize(const struct corpus *c, long bytes)
+{
+  unsigned long long start, t = 0, cyc;
+  char *program;
+  long tokens = 0;
+  long runs = 0;
+
+  if ((program = generate(c, bytes, 1)) == NULL) {
+    printf("%s %10ld  out of memory\n", c->name, bytes);
+    return;
+  }
+  bytes = strlen(program);
+  cyc = cycles();
+  start = ubasic_clock();
+  do {
+    tokens = tokenize(program);
+    runs++;
+    t = ubasic_clock() - start;
+  } while (t < MIN_TIME);
+  cyc = cycles() - cyc;
+
+  printf("%s %10ld %10ld %10.2f %10.1f", c->name, bytes, tokens,
+         (double)tokens * runs * 1e3 / t, (double)bytes * runs * 1e9 / t / (1024 * 1024));
+  if (cyc != 0) {
+    printf(" %10.1f", (double)cyc / ((double)tokens * runs));
+  }
+  printf("\n");
+  free(program);
+}
+/*---------------------------------------------------------------------------*/
+static void bench_jump(long bytes)
+{
+  static const char head[] = "0 goto 2\n";
+  static const char tail[] = "2 end\n";
+  unsigned long long start, t;
+  char *filler, *program;
+  long len;
+
+  if ((filler = generate(&corpora[0], bytes, 0)) == NULL) {
+    return;
+  }
+  len = strlen(filler);
+  program = malloc(len + sizeof(head) + sizeof(tail));
+  if (program == NULL) {
+    free(filler);
+    return;
+  }
+  strcpy(program, head);
+  strcat(program, filler);
+  strcat(program, tail);
+  free(filler);
+
+  ubasic_set_optimize(0); /* or ubasic_init() resolves the GOTO */
+  ubasic_init(program);
+  ubasic_set_optimize(1);
+  start = ubasic_clock();
+  ubasic_run(); /* line 2 is not indexed yet, so GOTO scans every line */
+  t = ubasic_clock() - start;
+  printf("goto scan %10ld bytes %10.3f ms %10.1f MB/s\n", len,
+         t / 1e6, (double)len * 1e9 / t / (1024 * 1024));
+  free(program);
+}
+/*---------------------------------------------------------------------------*/
+static void bench_lookahead(const struct corpus *c, long bytes)
+{
+  unsigned long long start, base, t;
+  char *program;
+  long tokens = 0;
+
+  if ((program = generate(c, bytes, 1)) == NULL) {
+    return;
+  }
+  start = ubasic_clock();
+  tokens = lookahead(program, 0);
+  base = ubasic_clock() - start;
+  start = ubasic_clock();
+  lookahead(program, 1);
+  t = ubasic_clock() - start;
+  printf("lookahead %s %8.1f ns/call\n", c->name,
+         (double)(t > base ? t - base : 0) / tokens);
+  free(program);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  const struct corpus *c;
+  long max = 100;
+  long bytes;
+
+  if (argc > 1) {
+    max = atol(argv[1]);
+  }
+  max *= 1024 * 1024;
+
+  printf("corpus       bytes     tokens  Mtokens/s       MB/s");
+#ifdef HAVE_RDTSC
+  printf(" cycles/token");
+#endif
+  printf("\n");
+  for (c = corpora; c->name != NULL; c++) {
+    for (bytes = 1024; bytes <= max; bytes *= 10) {
+      bench_tokenize(c, bytes);
+    }
+  }
+  printf("\n");
+  for (bytes = 1024; bytes <= max; bytes *= 10) {
+    bench_jump(bytes);
+  }
+  printf("\n");
+  for (c = corpora; c->name != NULL; c++) {
+    bench_lookahead(c, max < 1024 * 1024 ? max : 1024 * 1024);
+  }
+  return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Register VM benchmark.
+ *
+ * Runs arithmetic-heavy loops, conditions with AND/OR, GOSUBs, a string
+ * loop and a program with fractions on the tree walker and on the VM,
+ * superinstructions on as by default. Reports the time per statement
+ * on each, the speedup and whether both left every variable the same.
+ *
+ * Usage: bench-vm [runs]
+ */
+
+#include "ubasic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUNDS 5 /* best of, tree and VM interleaved */
+
+struct bench {
+  const char *name;
+  const char *program;
+};
+
+static const struct bench benches[] = {
+  {"arith   ", "10 for i = 1 to 100\n"
+               "20 for j = 1 to 100\n"
+               "30 s = s + i * 3 - j / 2\n"
+               "40 t = (t + i * j) % 1000\n"
+               "50 next j\n"
+               "60 next i\n"
+               "70 end\n"},
+  {"while   ", "10 i = 0\n"
+               "20 while i < 10000\n"
+               "30 if i % 3 = 0 and i % 5 <> 0 or i > 9990 then c = c + 1\n"
+               "40 if not i < 5000 then d = d + i / 100\n"
+               "50 i = i + 1\n"
+               "60 wend\n"
+               "70 end\n"},
+  {"gosub   ", "10 for i = 1 to 5000\n"
+               "20 gosub 100\n"
+               "30 next i\n"
+               "40 end\n"
+               "100 k = k + i * 2 : if k > 100000 then k = k - 100000\n"
+               "110 return\n"},
+  {"string  ", "10 for i = 1 to 2000\n"
+               "20 a$ = left$(\"abcdefgh\", i % 8) + str$(i)\n"
+               "30 n = n + instr(a$, \"c\") + len(a$)\n"
+               "40 next i\n"
+               "50 end\n"},
+  {"fraction", "10 x = 0.5\n"
+               "20 for i = 1 to 5000\n"
+               "30 y = y + x * 1.25 - i / 4\n"
+               "40 next i\n"
+               "50 end\n"},
+  {NULL, NULL}
+};
+
+/*---------------------------------------------------------------------------*/
+static unsigned long long run(const char *program, int engine, int runs,
+                              VARIABLE_TYPE *vars, long *statements, int *error)
+{
+  struct ubasic_fused_stats stats;
+  unsigned long long start;
+  int i;
+
+  *error = UBASIC_ERROR_NONE;
+  ubasic_set_engine(engine);
+  start = ubasic_clock();
+  for (i = 0; i < runs; i++) {
+    ubasic_init(program);
+    do {
+      if (ubasic_run() != UBASIC_ERROR_NONE) {
+        *error = ubasic_error(NULL);
+      }
+    } while(!ubasic_finished());
+  }
+  start = ubasic_clock() - start;
+  for (i = 0; i < 26; i++) {
+    vars[i] = ubasic_get_variable(i);
+  }
+  ubasic_fused_stats(&stats);
+  *statements = stats.statements;
+  return start;
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  const struct bench *b;
+  VARIABLE_TYPE tree_vars[26], vm_vars[26];
+  unsigned long long t, best_tree, best_vm;
+  long tree_statements, vm_statements;
+  double per;
+  int runs = 20;
+  int r, same, tree_error, vm_error;
+
+  if (argc > 1) {
+    runs = atoi(argv[1]);
+  }
+  printf("workload  tree ns/st   vm ns/st  speedup  same result\n");
+  for (b = benches; b->name != NULL; b++) {
+    best_tree = best_vm = 0;
+    for (r = 0; r < ROUNDS; r++) {
+      t = run(b->program, UBASIC_ENGINE_TREE, runs, tree_vars, &tree_statements,
+              &tree_error);
+      if (r == 0 || t < best_tree) {
+        best_tree = t;
+      }
+      t = run(b->program, UBASIC_ENGINE_VM, runs, vm_vars, &vm_statements, &vm_error);
+      if (r == 0 || t < best_vm) {
+        best_vm = t;
+      }
+    }
+    same = memcmp(tree_vars, vm_vars, sizeof(tree_vars)) == 0 &&
+           tree_statements == vm_statements && tree_error == vm_error;
+    per = (double)runs * tree_statements;
+    printf("%s %10.1f %10.1f %7.2fx  %s\n", b->name, best_tree / per,
+           best_vm / per, (double)best_tree / best_vm, same ? "yes" : "NO");
+    if (tree_error != UBASIC_ERROR_NONE) {
+      printf("%s stopped with error %d\n", b->name, tree_error);
+    }
+  }
+  ubasic_set_engine(UBASIC_ENGINE_TREE);
+  return 0;
+}
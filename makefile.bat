@@ -1 +1,19 @@
-cl /Feubasic run-ubasic.c ubasic.c tokenizer.c
\ No newline at end of file
+cl /Feubasic run-ubasic.c ubasic.c tokenizer.c trace.c sampler.c
+cl /Febench-input bench-input.c ubasic.c tokenizer.c
+cl /Febench-string bench-string.c ubasic.c tokenizer.c
+cl /Fetrace2json trace2json.c tokenizer.c
+cl /Febench-block bench-block.c ubasic.c tokenizer.c
+cl /Febench-tokenizer bench-tokenizer.c ubasic.c tokenizer.c
+cl /Febench-call bench-call.c ubasic.c tokenizer.c
+cl /Febench-replay bench-replay.c ubasic.c tokenizer.c
+cl /Febench-condition bench-condition.c ubasic.c tokenizer.c
+cl /Febench-fused bench-fused.c ubasic.c tokenizer.c
+cl /Febench-optimize bench-optimize.c ubasic.c tokenizer.c
+cl /Febench-vm bench-vm.c ubasic.c tokenizer.c
+cl /Febench-arena bench-arena.c ubasic.c tokenizer.c
+cl /Febench-scale bench-scale.c ubasic.c tokenizer.c
+cl /Febench-sampler bench-sampler.c ubasic.c tokenizer.c sampler.c
+cl /Fetest-sched test-sched.c sched.c ubasic.c tokenizer.c
+cl /Fetest-reload test-reload.c ubasic.c tokenizer.c
+cl /Fetest-call test-call.c ubasic.c tokenizer.c
+cl /Fetest-replay test-replay.c ubasic.c tokenizer.c
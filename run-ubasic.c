@@ -35,9 +35,70 @@
  */
 
 #include "ubasic.h"
+#include "trace.h"
+#include "sampler.h"
+#include "tokenizer.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
+#define TRACE_EVENTS 1000000
+#define SAMPLE_HZ 1000      /* sampler addition */
+#define SAMPLE_STACKS 16384 /* different call stacks kept */
+
+// profile addition
+/*---------------------------------------------------------------------------*/
+static int write_profile(const char *fname, int open)
+{
+  // one line for each kind of statement and string function that ran, with
+  // what it took each time; returns -1 if the file cannot be written
+  static const char *counter_names[UBASIC_COUNTERS] = {
+    "cycles", "instructions", "branch misses", "L1D misses", "LLC misses"
+  };
+  struct ubasic_profile *list;
+  FILE *f;
+  char *name;
+  int c, i, n;
+
+  n = ubasic_profile(NULL, 0);
+  if ((f = fopen(fname, "w")) == NULL ||
+      (list = malloc((n + 1) * sizeof(struct ubasic_profile))) == NULL) {
+     if (f != NULL)
+        fclose(f);
+     return -1;
+  }
+  ubasic_profile(list, n);
+  for (c = 0; c < UBASIC_COUNTERS; c++) {
+     if (!(open & 1 << c))
+        fprintf(f, "# %s not available\n", counter_names[c]);
+  }
+  fprintf(f, "%-14s %10s %10s %10s %12s %6s %10s %10s %10s\n", "kind", "count", "ns",
+          "cycles", "instructions", "IPC", "br-miss", "L1D-miss", "LLC-miss");
+  for (i = 0; i < n; i++) {
+     name = tokenizer_token_name(list[i].token);
+     fprintf(f, "%-14s %10ld %10.1f", name + strlen("TOKENIZER_"), list[i].count,
+             (double)list[i].time / list[i].count);
+     for (c = 0; c < UBASIC_COUNTERS; c++) {
+        if (list[i].counters[c] < 0)
+           fprintf(f, " %*s", c == UBASIC_COUNTER_INSTRUCTIONS ? 12 : 10, "-");
+        else
+           fprintf(f, " %*.1f", c == UBASIC_COUNTER_INSTRUCTIONS ? 12 : 10,
+                   (double)list[i].counters[c] / list[i].count);
+        if (c != UBASIC_COUNTER_INSTRUCTIONS)
+           continue;
+        if (list[i].counters[UBASIC_COUNTER_CYCLES] > 0 && list[i].counters[c] >= 0)
+           fprintf(f, " %6.2f", (double)list[i].counters[c] /
+                   list[i].counters[UBASIC_COUNTER_CYCLES]);
+        else
+           fprintf(f, " %6s", "-");
+     }
+     fprintf(f, "\n");
+  }
+  free(list);
+  return fclose(f) == 0 ? 0 : -1;
+}
+// end of profile addition
 /*---------------------------------------------------------------------------*/
 // main routine modified to allow execution of BASIC script files 
 
@@ -47,8 +108,48 @@ main(int argc, char **argv, char **envp)
   char *q;
   char **p;
   char *prog;
-  char buffer[15000];
+  char *buffer = NULL; // scale addition - as big as the file
+  char *grown;
+  int size = 0, bytes = 0;
   int infile;
+  FILE *input;
+  char *tracefile = NULL;
+  char *recordfile = NULL;
+  char *replayfile = NULL;
+  char *profilefile = NULL;
+  char *samplefile = NULL;
+  int counters = 0;
+  FILE *log = NULL;
+  struct ubasic_error error;
+  struct ubasic_finding *findings;
+  int optimize = 1;
+  int i, n;
+
+  // trace, parallel, replay, optimizer, vm, profile and sampler additions
+  while (argc > 2 && argv[1][0] == '-') {
+     if (strcmp(argv[1], "-t") == 0) {
+        tracefile = argv[2];
+     } else if (strcmp(argv[1], "-j") == 0) {
+        ubasic_set_workers(atoi(argv[2]));
+     } else if (strcmp(argv[1], "-r") == 0) {
+        recordfile = argv[2];
+     } else if (strcmp(argv[1], "-p") == 0) {
+        replayfile = argv[2];
+     } else if (strcmp(argv[1], "-O") == 0) {
+        optimize = atoi(argv[2]);
+     } else if (strcmp(argv[1], "-e") == 0) {
+        ubasic_set_engine(strcmp(argv[2], "vm") == 0 ? UBASIC_ENGINE_VM : UBASIC_ENGINE_TREE);
+     } else if (strcmp(argv[1], "-c") == 0) {
+        profilefile = argv[2];
+     } else if (strcmp(argv[1], "-s") == 0) {
+        samplefile = argv[2];
+     } else {
+        break;
+     }
+     argc -= 2;
+     argv += 2;
+  }
+  // end of trace, parallel, replay, optimizer, vm, profile and sampler additions
 
   if (argc > 1) {
      p = argv + 1;
@@ -60,8 +161,22 @@ main(int argc, char **argv, char **envp)
         return (-1);
      }
 
-	 int bytes = read(infile,buffer,15000);
-     if (bytes < 0) {
+     // scale addition - read the whole file, however big
+     do {
+        if (bytes == size) {
+           size = size ? 2 * size : 16384;
+           if ((grown = realloc(buffer, size + 1)) == NULL) {
+              printf("File \"%s\" too big to load - terminating\n",q);
+              return (-1);
+           }
+           buffer = grown;
+        }
+        n = read(infile, buffer + bytes, size - bytes);
+        if (n > 0)
+           bytes += n;
+     } while (n > 0);
+     // end of scale addition
+     if (n < 0) {
         printf("Error reading file \"%s\"  - terminating\n",q);
         printf("Error was \"%d\" \n",errno);
         return (-1);
@@ -69,14 +184,133 @@ main(int argc, char **argv, char **envp)
 	 buffer[bytes] = '\0';
      prog = buffer;
   } else {
-    printf("Usage: ubasic fname\n  where fname is a file containing basic statements\n");
+    printf("Usage: ubasic [-t trace] [-j workers] [-r log | -p log] [-O level] [-e engine] [-c report] [-s folded] fname [input]\n  where fname is a file containing basic statements\n");
+    printf("  and input is an optional file read by INPUT (default stdin)\n");
+    printf("  -t writes the last %d trace events to the file trace\n", TRACE_EVENTS);
+    printf("  -j runs PARFOR on up to workers threads\n");
+    printf("  -r records the script's input to the file log, -p replays it\n");
+    printf("  -O 0 runs the program as written, 2 also lists what the optimizer did\n");
+    printf("  -e vm runs the program on the register VM, tree (the default) walks it\n");
+    printf("  -c writes the time and hardware counters of each kind of statement\n");
+    printf("     and string function to the file report\n");
+    printf("  -s samples the BASIC call stack %d times a second and writes the\n", SAMPLE_HZ);
+    printf("     stacks to the file folded, for flame graph tools; on Linux that is\n");
+    printf("     wall-clock time, so waits such as INPUT and SLEEP are sampled too\n");
     return (0);
   }
 
+  // input addition
+  if (argc > 2) {
+     if ((input = fopen(argv[2], "rb")) == NULL) {
+        printf("Input file \"%s\" not found - terminating\n", argv[2]);
+        return (-1);
+     }
+     ubasic_set_input(input);
+  }
+  // end of input addition
+
+  if (tracefile != NULL && trace_open(TRACE_EVENTS) != 0) {
+     printf("Cannot allocate trace buffer - terminating\n");
+     return (-1);
+  }
+
+  ubasic_set_optimize(optimize != 0);
   ubasic_init(prog);
+
+  // optimizer addition - a jump to a line that does not exist stops the
+  // program before it starts
+  n = ubasic_findings(NULL, 0);
+  if (n > 0 && (findings = malloc(n * sizeof(struct ubasic_finding))) != NULL) {
+     ubasic_findings(findings, n);
+     for (i = 0; i < n; i++) {
+        if (findings[i].kind == UBASIC_FINDING_TARGET) {
+           if (findings[i].target < 0) {
+              printf("Line %d: no such label\n", findings[i].line);
+           } else {
+              printf("Line %d: no line %d\n", findings[i].line, findings[i].target);
+           }
+           optimize = -1;
+        } else if (optimize > 1 && findings[i].kind == UBASIC_FINDING_UNREACHABLE) {
+           printf("Line %d: unreachable, left out\n", findings[i].line);
+        } else if (optimize > 1 && findings[i].kind == UBASIC_FINDING_THREADED) {
+           printf("Line %d: jump goes straight to line %d\n", findings[i].line, findings[i].target);
+        }
+     }
+     free(findings);
+     if (optimize < 0) {
+        printf("Bad jump target - terminating\n");
+        return (1);
+     }
+  }
+  // end of optimizer addition
+
+  // replay addition
+  if (recordfile != NULL &&
+      ((log = fopen(recordfile, "wb")) == NULL || ubasic_record(log) != 0)) {
+     printf("Cannot record to \"%s\" - terminating\n", recordfile);
+     return (-1);
+  }
+  if (replayfile != NULL &&
+      ((log = fopen(replayfile, "rb")) == NULL || ubasic_replay(log) != 0)) {
+     printf("\"%s\" is not a replay log - terminating\n", replayfile);
+     return (-1);
+  }
+  // end of replay addition
+
+  if (profilefile != NULL)
+     counters = ubasic_set_profile(1); // profile addition
+
+  // sampler addition
+  if (samplefile != NULL && sampler_open(SAMPLE_HZ, SAMPLE_STACKS) != 0) {
+     printf("Cannot sample call stacks - terminating\n");
+     return (-1);
+  }
+  // end of sampler addition
+
   do {
     ubasic_run();
   } while(!ubasic_finished());
 
+  // profile and sampler additions - for a program that stopped with an error too
+  if (profilefile != NULL && write_profile(profilefile, counters) != 0) {
+     printf("Cannot write profile \"%s\"\n", profilefile);
+  }
+  if (samplefile != NULL) {
+     if ((n = sampler_write(samplefile)) < 0) {
+        printf("Cannot write call stacks \"%s\"\n", samplefile);
+     } else if (n > 0) {
+        printf("%d samples lost\n", n);
+     }
+     sampler_close();
+  }
+  // end of profile and sampler additions
+
+  // replay addition
+  if (log != NULL) {
+     if (recordfile != NULL && ubasic_record(NULL) != 0) {
+        printf("Cannot write replay log \"%s\"\n", recordfile);
+     }
+     ubasic_replay(NULL);
+     fclose(log);
+  }
+  // end of replay addition
+
+  // error addition
+  if (ubasic_error(&error) != UBASIC_ERROR_NONE) {
+     printf("Error %d on line %d", error.kind, error.line);
+     if (error.expected != TOKENIZER_ERROR) {
+        printf(": expected %s, found %s", tokenizer_token_name(error.expected),
+               tokenizer_token_name(error.found));
+     }
+     printf("\n");
+     return (1);
+  }
+  // end of error addition
+
+  if (tracefile != NULL && trace_write(tracefile) != 0) {
+     printf("Cannot write trace file \"%s\"\n", tracefile);
+     return (-1);
+  }
+
   return 0;
 }
\ No newline at end of file
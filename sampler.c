@@ -0,0 +1,228 @@
+/*
+ * SIGPROF sampler of BASIC call stacks.
+ *
+ * The stacks are kept in an open addressing hash table. A signal landing
+ * on one thread while the handler runs on another is counted as lost
+ * rather than waited for, as a handler must never block.
+ *
+ * ITIMER_PROF only fires on the scheduler tick, 250 times a second on many
+ * Linux kernels, so there the samples come from a POSIX timer on the
+ * monotonic clock instead. That counts time the process waits too, such as
+ * for INPUT, which then shows on the line waiting.
+ */
+
+#include "sampler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <signal.h> /* sigaction() */
+#include <sys/time.h> /* setitimer() */
+#endif
+#ifdef __linux__
+#include <time.h> /* timer_create() */
+#define SAMPLER_TIMER 1
+#else
+#define SAMPLER_TIMER 0
+#endif
+
+static struct sampler_stack *table = NULL;
+static int table_size = 0;    // a power of two
+static int table_used = 0;
+static int table_limit = 0;   // used slots allowed, so probes stay short
+static volatile int table_busy = 0;
+static volatile int samples_lost = 0;
+#ifndef _WIN32
+static struct sigaction old_action;
+#endif
+#if SAMPLER_TIMER
+static timer_t timer;
+#endif
+
+#ifndef _WIN32
+/*---------------------------------------------------------------------------*/
+static void sampler_tick(int sig)
+{
+  struct sampler_stack *s;
+  int lines[SAMPLER_DEPTH];
+  unsigned int h = 0;
+  int depth, i;
+
+  (void)sig;
+  if(__sync_lock_test_and_set(&table_busy, 1)) {
+    __sync_fetch_and_add(&samples_lost, 1);
+    return;
+  }
+  depth = ubasic_call_stack(lines, SAMPLER_DEPTH);
+  for(i = 0; i < depth; i++) {
+    h = (h ^ (unsigned int)lines[i]) * 0x9E3779B1u;
+  }
+  for(i = h >> 8 & (table_size - 1); ; i = (i + 1) & (table_size - 1)) {
+    s = table + i;
+    if(s->count == 0) {
+      if(table_used == table_limit) {
+        __sync_fetch_and_add(&samples_lost, 1);
+        break;
+      }
+      table_used++;
+      s->depth = depth;
+      memcpy(s->lines, lines, depth * sizeof(int));
+    } else if(s->depth != depth || memcmp(s->lines, lines, depth * sizeof(int)) != 0) {
+      continue;
+    }
+    s->count++;
+    break;
+  }
+  __sync_lock_release(&table_busy);
+}
+/*---------------------------------------------------------------------------*/
+static int sampler_timer(int hz)
+{
+  // interrupt hz times a second, or no more for 0
+#if SAMPLER_TIMER
+  struct itimerspec interval;
+
+  memset(&interval, 0, sizeof(interval));
+  if(hz > 0) {
+    interval.it_interval.tv_nsec = 1000000000L / hz;
+    interval.it_value = interval.it_interval;
+  }
+  return timer_settime(timer, 0, &interval, NULL);
+#else
+  struct itimerval interval;
+
+  memset(&interval, 0, sizeof(interval));
+  if(hz > 0) {
+    interval.it_interval.tv_usec = 1000000 / hz;
+    interval.it_value = interval.it_interval;
+  }
+  return setitimer(ITIMER_PROF, &interval, NULL);
+#endif
+}
+#endif
+/*---------------------------------------------------------------------------*/
+int sampler_open(int hz, int capacity)
+{
+#ifdef _WIN32
+  (void)hz;
+  (void)capacity;
+  return -1;
+#else
+  struct sigaction action;
+#if SAMPLER_TIMER
+  struct sigevent event;
+#endif
+
+  sampler_close();
+  if(hz <= 0 || hz > 1000000 || capacity <= 0) {
+    return -1;
+  }
+  // a quarter of the slots are left empty
+  for(table_size = 1; table_size < capacity + capacity / 3 + 1; table_size *= 2)
+    ;
+  if((table = calloc(table_size, sizeof(struct sampler_stack))) == NULL) {
+    table_size = 0;
+    return -1;
+  }
+  table_limit = capacity;
+  samples_lost = 0;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = sampler_tick;
+  action.sa_flags = SA_RESTART; // INPUT and the profile counters read()
+  sigemptyset(&action.sa_mask);
+  if(sigaction(SIGPROF, &action, &old_action) != 0) {
+    free(table);
+    table = NULL;
+    return -1;
+  }
+#if SAMPLER_TIMER
+  memset(&event, 0, sizeof(event));
+  event.sigev_notify = SIGEV_SIGNAL;
+  event.sigev_signo = SIGPROF;
+  if(timer_create(CLOCK_MONOTONIC, &event, &timer) != 0) {
+    sigaction(SIGPROF, &old_action, NULL);
+    free(table);
+    table = NULL;
+    return -1;
+  }
+#endif
+  if(sampler_timer(hz) != 0) {
+    sampler_close();
+    return -1;
+  }
+  return 0;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+static int stack_compare(const void *a, const void *b)
+{
+  // outermost line first, a caller before what it calls
+  const struct sampler_stack *sa = *(const struct sampler_stack * const *)a;
+  const struct sampler_stack *sb = *(const struct sampler_stack * const *)b;
+  int i;
+
+  for(i = 0; i < sa->depth && i < sb->depth; i++) {
+    if(sa->lines[i] != sb->lines[i]) {
+      return sa->lines[i] < sb->lines[i] ? -1 : 1;
+    }
+  }
+  return sa->depth - sb->depth;
+}
+/*---------------------------------------------------------------------------*/
+int sampler_write(const char *fname)
+{
+  struct sampler_stack **sorted;
+  struct sampler_stack *s;
+  FILE *f;
+  int i, j, n = 0;
+
+  if(table == NULL) {
+    return -1;
+  }
+#ifndef _WIN32
+  sampler_timer(0); // no more samples, not even of the writing
+#endif
+  if((sorted = malloc((table_used + 1) * sizeof(*sorted))) == NULL) {
+    return -1;
+  }
+  for(i = 0; i < table_size; i++) {
+    if(table[i].count != 0) {
+      sorted[n++] = table + i;
+    }
+  }
+  qsort(sorted, n, sizeof(*sorted), stack_compare);
+  if((f = fopen(fname, "w")) == NULL) {
+    free(sorted);
+    return -1;
+  }
+  for(i = 0; i < n; i++) {
+    s = sorted[i];
+    if(s->depth == 0) {
+      fprintf(f, "host %d\n", s->count); // a thread with no program
+      continue;
+    }
+    fprintf(f, "main");
+    for(j = 0; j < s->depth - 1; j++) {
+      fprintf(f, ";GOSUB %d", s->lines[j]);
+    }
+    fprintf(f, ";line %d %d\n", s->lines[j], s->count);
+  }
+  free(sorted);
+  return fclose(f) == 0 ? samples_lost : -1;
+}
+/*---------------------------------------------------------------------------*/
+void sampler_close(void)
+{
+#ifndef _WIN32
+  if(table != NULL) {
+    sampler_timer(0);
+#if SAMPLER_TIMER
+    timer_delete(timer);
+#endif
+    sigaction(SIGPROF, &old_action, NULL);
+  }
+#endif
+  free(table);
+  table = NULL;
+  table_size = table_used = table_limit = 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * SIGPROF sampler of BASIC call stacks, for flame graphs.
+ *
+ * sampler_open() has the process interrupted hz times a second. On Linux
+ * that is wall-clock time, so time spent waiting, such as for INPUT, is
+ * sampled too; elsewhere it is the CPU time the process uses. Each interrupt adds one to the count of the call stack
+ * (see ubasic_call_stack()) of the interpreter on the thread it lands on,
+ * in a table of up to capacity different stacks made beforehand, so the
+ * handler neither allocates nor waits. sampler_write() stops sampling and
+ * writes every stack with its count in the folded format flame graph
+ * tools read, such as
+ *
+ *   main;GOSUB 1000;GOSUB 2000;line 2030 17
+ */
+
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+#include "ubasic.h"
+
+#define SAMPLER_DEPTH 16 /* lines in a stack, more than a GOSUB can nest */
+
+struct sampler_stack {
+  int count;  // samples, 0 for an empty slot
+  int depth;  // lines in use
+  int lines[SAMPLER_DEPTH];
+};
+
+int sampler_open(int hz, int capacity); // -1 if it cannot, as on Windows
+int sampler_write(const char *fname); // stops sampling, returns the samples lost or -1
+void sampler_close(void);
+
+#endif /* __SAMPLER_H__ */
@@ -0,0 +1,264 @@
+/*
+ * Cooperative scheduler running many uBASIC programs on one thread.
+ *
+ * Tasks are run round robin. The cost of a switch is saving and loading
+ * one interpreter context, a few hundred bytes.
+ */
+
+#include "sched.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+struct sched_task {
+  struct ubasic_context *ctx;
+  unsigned long long ready_time;  // when it last became ready (or will wake)
+  struct sched_task_stats stats;
+};
+
+static struct sched_task *tasks = NULL;
+static int task_count = 0;
+static int task_current = -1;
+static int live_count = 0;
+static int budget_statements = 100;
+static unsigned long long budget_time = 0;
+static struct ubasic_context *home = NULL; // the interpreter before the first task
+static int in_step = 0;
+
+/*---------------------------------------------------------------------------*/
+static void sched_sleep(unsigned long long ns)
+{
+#ifdef _WIN32
+  Sleep((DWORD)(ns / 1000000));
+#else
+  struct timespec ts;
+  ts.tv_sec = ns / 1000000000ULL;
+  ts.tv_nsec = ns % 1000000000ULL;
+  nanosleep(&ts, NULL);
+#endif
+}
+/*---------------------------------------------------------------------------*/
+int sched_add(const char *program)
+{
+  struct sched_task *t;
+  struct ubasic_context *ctx;
+
+  if(home == NULL) {
+    if((home = ubasic_context_new()) == NULL) {
+      return -1;
+    }
+    ubasic_context_save(home);
+  }
+  if((ctx = ubasic_context_new()) == NULL) {
+    return -1;
+  }
+  if((t = realloc(tasks, (task_count + 1) * sizeof(struct sched_task))) == NULL) {
+    ubasic_context_free(ctx);
+    return -1;
+  }
+  tasks = t;
+  t = tasks + task_count;
+  memset(t, 0, sizeof(struct sched_task));
+  t->ctx = ctx;
+  ubasic_context_load(ctx);
+  ubasic_init(program);
+  ubasic_context_save(ctx);
+  t->stats.state = ubasic_finished() ? SCHED_DONE : SCHED_READY;
+  if(t->stats.state != SCHED_DONE) {
+    live_count++;
+  }
+  t->ready_time = ubasic_clock();
+  return task_count++;
+}
+/*---------------------------------------------------------------------------*/
+void sched_budget(int statements, unsigned long long slice_ns)
+{
+  budget_statements = statements > 0 ? statements : 1;
+  budget_time = slice_ns;
+}
+/*---------------------------------------------------------------------------*/
+static struct sched_task *sched_next(unsigned long long now)
+{
+  struct sched_task *t;
+  int i, n;
+
+  for(i = 1; i <= task_count; i++) {
+    n = (task_current + i) % task_count;
+    t = tasks + n;
+    if(t->stats.state == SCHED_SLEEPING && t->ready_time <= now) {
+      t->stats.state = SCHED_READY;
+    }
+    if(t->stats.state == SCHED_READY) {
+      task_current = n;
+      return t;
+    }
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+int sched_step(void)
+{
+  struct sched_task *t;
+  unsigned long long start, now, latency;
+  int n = 0;
+  int ms = -1;
+
+  start = ubasic_clock();
+  if((t = sched_next(start)) == NULL) {
+    return live_count;
+  }
+  latency = start > t->ready_time ? start - t->ready_time : 0;
+  t->stats.total_latency += latency;
+  if(latency > t->stats.max_latency) {
+    t->stats.max_latency = latency;
+  }
+  t->stats.slices++;
+
+  ubasic_context_load(t->ctx);
+  in_step = 1;
+  do {
+    ubasic_run();
+    n++;
+    if(ubasic_finished()) {
+      t->stats.state = SCHED_DONE;
+      t->stats.error = ubasic_error(NULL);
+      live_count--;
+      break;
+    }
+    if(ubasic_pending()) {
+      t->stats.state = SCHED_WAITING;
+      break;
+    }
+    if((ms = ubasic_yielded()) >= 0) {
+      if(ms > 0) {
+        t->stats.state = SCHED_SLEEPING;
+      }
+      break;
+    }
+  } while(n < budget_statements &&
+          (budget_time == 0 || ubasic_clock() - start < budget_time));
+  in_step = 0;
+  ubasic_context_save(t->ctx);
+
+  now = ubasic_clock();
+  t->stats.statements += n;
+  t->stats.run_time += now - start;
+  t->ready_time = t->stats.state == SCHED_SLEEPING ? now + ms * 1000000ULL : now;
+  return live_count;
+}
+/*---------------------------------------------------------------------------*/
+unsigned long long sched_idle_time(void)
+{
+  unsigned long long now = ubasic_clock();
+  unsigned long long idle = SCHED_WAIT_FOREVER;
+  int i;
+
+  for(i = 0; i < task_count; i++) {
+    if(tasks[i].stats.state == SCHED_READY) {
+      return 0;
+    }
+    if(tasks[i].stats.state == SCHED_SLEEPING) {
+      if(tasks[i].ready_time <= now) {
+        return 0;
+      }
+      if(tasks[i].ready_time - now < idle) {
+        idle = tasks[i].ready_time - now;
+      }
+    }
+  }
+  return idle;
+}
+/*---------------------------------------------------------------------------*/
+void sched_run(void)
+{
+  unsigned long long idle;
+
+  while(live_count > 0) {
+    if((idle = sched_idle_time()) == SCHED_WAIT_FOREVER) {
+      return; // everything left is waiting for the host
+    }
+    if(idle > 0) {
+      sched_sleep(idle);
+    }
+    sched_step();
+  }
+}
+/*---------------------------------------------------------------------------*/
+int sched_current(void)
+{
+  return task_current;
+}
+/*---------------------------------------------------------------------------*/
+void sched_resume(int task, VARIABLE_TYPE value)
+{
+  struct sched_task *t;
+
+  if(task < 0 || task >= task_count) {
+    return;
+  }
+  t = tasks + task;
+  if(in_step && task == task_current) {
+    ubasic_resume(value); // completed from inside its own callback
+    return;
+  }
+  if(t->stats.state != SCHED_WAITING) {
+    return;
+  }
+  // from a callback of another task, whose interpreter is loaded mid-statement
+  if(in_step) {
+    ubasic_context_save(tasks[task_current].ctx);
+  }
+  ubasic_context_load(t->ctx);
+  ubasic_resume(value);
+  ubasic_context_save(t->ctx);
+  if(in_step) {
+    ubasic_context_load(tasks[task_current].ctx);
+  }
+  t->stats.state = SCHED_READY;
+  t->ready_time = ubasic_clock();
+}
+/*---------------------------------------------------------------------------*/
+void sched_stats(int task, struct sched_task_stats *stats)
+{
+  if(task >= 0 && task < task_count) {
+    *stats = tasks[task].stats;
+  }
+}
+/*---------------------------------------------------------------------------*/
+double sched_fairness(void)
+{
+  // Jain's index over the time each task has had: 1.0 when every task
+  // got the same, 1/n when one task got it all
+  double sum = 0, sumsq = 0, x;
+  int i;
+
+  for(i = 0; i < task_count; i++) {
+    x = (double)tasks[i].stats.run_time;
+    sum += x;
+    sumsq += x * x;
+  }
+  return sumsq > 0 ? sum * sum / (task_count * sumsq) : 1.0;
+}
+/*---------------------------------------------------------------------------*/
+void sched_free(void)
+{
+  int i;
+
+  for(i = 0; i < task_count; i++) {
+    ubasic_context_free(tasks[i].ctx);
+  }
+  if(home != NULL) {
+    ubasic_context_load(home);
+    free(home); // its buffers are in use again
+    home = NULL;
+  }
+  free(tasks);
+  tasks = NULL;
+  task_count = live_count = 0;
+  task_current = -1;
+}
@@ -0,0 +1,46 @@
+/*
+ * Cooperative scheduler running many uBASIC programs on one thread.
+ *
+ * Each program gets its own interpreter context. A task runs for a
+ * budget of statements (and optionally a time slice) and is then
+ * switched out at the statement boundary; SLEEP and YIELD give up the
+ * rest of the slice early. The interpreter that was running before the
+ * first sched_add() is set aside and comes back with sched_free().
+ */
+
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+#include "ubasic.h"
+
+enum {
+  SCHED_READY,
+  SCHED_SLEEPING,
+  SCHED_WAITING,  // on an async PEEK/POKE, until sched_resume()
+  SCHED_DONE
+};
+
+#define SCHED_WAIT_FOREVER (~0ULL)
+
+struct sched_task_stats {
+  int state;
+  int error;                         // UBASIC_ERROR_* once done
+  long statements;
+  long slices;
+  unsigned long long run_time;       // ns spent running
+  unsigned long long total_latency;  // ns spent ready but not running
+  unsigned long long max_latency;
+};
+
+int sched_add(const char *program);  // returns the task number, -1 on failure
+void sched_budget(int statements, unsigned long long slice_ns);
+int sched_step(void);                // returns the number of unfinished tasks
+unsigned long long sched_idle_time(void);
+void sched_run(void);                // returns early if all tasks are waiting
+int sched_current(void);             // the task running, e.g. in a callback
+void sched_resume(int task, VARIABLE_TYPE value);
+void sched_stats(int task, struct sched_task_stats *stats);
+double sched_fairness(void);
+void sched_free(void);
+
+#endif /* __SCHED_H__ */
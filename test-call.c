@@ -0,0 +1,179 @@
+/*
+ * Host function call test.
+ *
+ * Registers a few C functions and checks that ubasic_register_function()
+ * refuses bad signatures, that CALL passes numbers and strings and gets
+ * numbers and strings back, as a statement and inside expressions, that
+ * a fraction reaches the host as a whole number, that a CALL skipped by
+ * AND or OR is not made, and that an unknown function or a result of the
+ * wrong type stops the program with its error. Each case runs on both
+ * engines. Scripts report their results with POKE slot, value.
+ *
+ * Usage: test-call
+ */
+
+#include "ubasic.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static VARIABLE_TYPE results[8];
+static VARIABLE_TYPE beeped;
+static int calls;
+static int failures;
+
+/*---------------------------------------------------------------------------*/
+static void check(const char *what, int ok)
+{
+  printf("%-40s %s\n", what, ok ? "ok" : "FAIL");
+  if(!ok) {
+    failures++;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE peek(VARIABLE_TYPE addr)
+{
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void poke(VARIABLE_TYPE addr, VARIABLE_TYPE value)
+{
+  results[(unsigned char)addr & 7] = value;
+}
+/*---------------------------------------------------------------------------*/
+static union ubasic_value add(union ubasic_value const *args)
+{
+  union ubasic_value r;
+
+  calls++;
+  r.num = args[0].num + args[1].num;
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+static union ubasic_value upper(union ubasic_value const *args)
+{
+  static char buffer[64];
+  union ubasic_value r;
+  int i;
+
+  calls++;
+  for(i = 0; args[0].str[i] != 0 && i < (int)sizeof(buffer) - 1; i++) {
+    buffer[i] = toupper((unsigned char)args[0].str[i]);
+  }
+  buffer[i] = 0;
+  r.str = buffer;
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+static union ubasic_value repeat(union ubasic_value const *args)
+{
+  union ubasic_value r;
+
+  // a number and a string in, the number of characters it would make out
+  calls++;
+  r.num = args[0].num * (VARIABLE_TYPE)strlen(args[1].str);
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+static union ubasic_value beep(union ubasic_value const *args)
+{
+  union ubasic_value r;
+
+  calls++;
+  beeped = args[0].num;
+  r.num = 0;
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+/* Runs a program to the end and returns the error it stopped with. */
+static int run(const char *program)
+{
+  memset(results, 0, sizeof(results));
+  calls = 0;
+  ubasic_init_peek_poke(program, peek, poke);
+  while(!ubasic_finished()) {
+    ubasic_run();
+  }
+  return ubasic_error(NULL);
+}
+/*---------------------------------------------------------------------------*/
+static void test_register(void)
+{
+  check("bad signatures are refused",
+        ubasic_register_function("add", add, 2, "nn") == -1 &&
+        ubasic_register_function("up", upper, 1, "ss") == -1 &&
+        ubasic_register_function("add$", add, 2, "nnn") == -1 &&
+        ubasic_register_function("add", add, 2, "nxn") == -1 &&
+        ubasic_register_function("", add, 2, "nnn") == -1);
+  check("good signatures are taken",
+        ubasic_register_function("add", add, 2, "nnn") == 0 &&
+        ubasic_register_function("upper$", upper, 1, "ss") == 0 &&
+        ubasic_register_function("repeat", repeat, 2, "nns") == 0 &&
+        ubasic_register_function("beep", beep, 1, "nn") == 0);
+}
+/*---------------------------------------------------------------------------*/
+static void test_calls(void)
+{
+  char *s;
+  int error;
+
+  error = run("10 i = 4\n"
+              "20 x = call add(i, 2) * 3\n"
+              "30 poke 1, x\n"
+              "40 poke 2, call add(call add(1, 2), i) + 1\n");
+  check("numbers in and out", error == UBASIC_ERROR_NONE &&
+        results[1] == 18 && results[2] == 8 && calls == 3);
+
+  error = run("10 a$ = \"abc\"\n"
+              "20 a$ = call upper$(a$ + \"d\") + \"!\"\n"
+              "30 poke 3, call repeat(3, a$)\n");
+  s = ubasic_get_stringvariable(0);
+  check("strings in and out", error == UBASIC_ERROR_NONE &&
+        s != NULL && strcmp(s, "ABCD!") == 0 && results[3] == 15);
+
+  beeped = 0;
+  error = run("10 call beep(440)\n");
+  check("CALL as a statement", error == UBASIC_ERROR_NONE && beeped == 440);
+
+  error = run("10 x = 7.5\n"
+              "20 y = call add(x, 1)\n"
+              "30 poke 4, y * 2\n");
+  check("fractions reach the host whole", error == UBASIC_ERROR_NONE && results[4] == 16);
+
+  error = run("10 x = 0\n"
+              "20 if x = 1 and call add(x, 1) = 1 then poke 5, 1\n"
+              "30 if x = 0 or call add(x, 1) = 1 then poke 6, 1\n");
+  check("short-circuited CALL is not made", error == UBASIC_ERROR_NONE &&
+        results[5] == 0 && results[6] == 1 && calls == 0);
+}
+/*---------------------------------------------------------------------------*/
+static void test_errors(void)
+{
+  int error;
+
+  error = run("10 call nothing(1)\n"
+              "20 poke 1, 1\n");
+  check("unknown function is error 2", error == UBASIC_ERROR_STATEMENT && results[1] == 0);
+
+  error = run("10 x = call upper$(\"a\")\n"
+              "20 poke 1, 1\n");
+  check("string result as a number is refused", error == UBASIC_ERROR_SYNTAX &&
+        results[1] == 0);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(void)
+{
+  static const int engines[] = {UBASIC_ENGINE_TREE, UBASIC_ENGINE_VM};
+  int i;
+
+  test_register();
+  for(i = 0; i < 2; i++) {
+    printf("%s engine\n", i == 0 ? "tree" : "vm");
+    ubasic_set_engine(engines[i]);
+    test_calls();
+    test_errors();
+  }
+  return failures > 0;
+}
@@ -0,0 +1,31 @@
+5 rem comparisons and short-circuit AND, OR and NOT
+10 a = 3 : b = 5
+20 if a <= 3 then print "le ok"
+30 if b >= 6 then print "ge bad" else print "ge ok"
+40 if a <> b then print "ne ok"
+50 if a < b and b < 10 then print "and ok"
+60 if a > b and b < 10 then print "and bad" else print "and false ok"
+70 if a > b or b = 5 then print "or ok"
+80 if not a = 3 then print "not bad" else print "not ok"
+90 if (a = 1 or a = 3) and (b = 5) then print "paren ok"
+100 if not (a = 3 and b = 5) then print "np bad" else print "np ok"
+110 if a = 1 or a = 2 or a = 3 and b = 4 or b = 5 then print "chain ok"
+120 if a = 1 and (b = 5 or 1 / 0) then print "sc bad" else print "sc ok"
+130 if a = 3 or 1 / 0 then print "sc2 ok"
+140 c$ = "abc"
+150 if c$ <> "abd" and c$ <= "abc" and c$ >= "abb" then print "str ok"
+160 i = 0
+170 while i < 5 and not i = 3
+180 i = i + 1
+190 wend
+200 print i
+210 if (a + 1) * 2 = 8 and a <> 0 then print "arith paren ok"
+220 if a = 3 then if b = 4 or b = 5 then print "nested ok"
+230 if 0 and 1 / 0 or 1 then print "mix ok"
+232 if ((a = 3)) then print "double paren ok"
+234 if not ((a = 2)) then print "not double paren ok"
+236 i = 0
+238 while ((i < 3)) : i = i + 1 : wend
+240 if (((a = 3) and (b = 5))) then print "triple paren ok" else print "triple paren bad"
+242 print i
+250 end
@@ -0,0 +1,33 @@
+5 rem WHILE/WEND, block IF/ELSE/ENDIF and statements separated by colons
+10 i = 0 : s = 0
+20 while i < 5
+30 i = i + 1 : s = s + i
+40 wend
+50 print "sum", s
+60 a = 2
+70 if a = 1 then
+80 print "one bad"
+90 else
+100 print "not one ok"
+110 if a = 2 then
+120 print "nested two ok"
+130 endif
+140 endif
+150 if a = 2 then
+160 j = 0
+170 while j < 3
+180 j = j + 1
+190 if j = 2 then print "two in loop ok" else print "loop", j
+200 wend
+210 endif
+220 k = 0
+230 while k < 3 : k = k + 1 : wend
+240 print "k", k
+250 while 0
+260 print "never bad"
+270 wend
+280 if a = 3 then
+290 print "three bad"
+300 endif
+310 print "end of flow test"
+320 end
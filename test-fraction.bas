@@ -0,0 +1,13 @@
+1 print "start of fraction test"
+10 r = 2.5
+20 a = 3.14159 * r * r
+30 print "area of a circle of radius 2.5 is ", a
+60 c = 21.5
+70 f = c * 9 / 5 + 32
+80 print c, "C is ", f, "F"
+90 print "half of 7 is ", 7 / 2
+100 print val("0.125") * 8
+102 y = 40000
+104 print y * 3, 300 * 200, (0 - y) * 40000
+106 print 1234567.5 * 2
+110 print "end of fraction test"
@@ -0,0 +1,6 @@
+1 print "start of input test"
+10 if eof then goto 100
+20 line input a$
+30 print "line:", a$
+40 goto 10
+100 print "end of input test"
@@ -0,0 +1,20 @@
+rem unnumbered program using labels and structured statements
+n = 0 : t = 0
+while n < 10
+  n = n + 1
+  gosub @add
+wend
+if t = 55 then
+  print "sum of 1 to 10 is ", t
+else
+  print "wrong sum ", t
+endif
+goto @done
+print "never printed"
+
+@add
+t = t + n
+return
+
+@done
+print "done"
@@ -0,0 +1,10 @@
+10 print "start of parfor test"
+20 s = 0 : m = 1000 : x = 0
+30 parfor i = 1 to 1000 reduce sum s, min m, max x
+40 t = i * i % 997
+50 s = s + t
+60 if t < m then m = t
+70 if t > x then x = t
+80 next i
+90 print "sum ", s, " min ", m, " max ", x
+100 print "end of parfor test"
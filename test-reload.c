@@ -0,0 +1,182 @@
+/*
+ * Reload test.
+ *
+ * Stops programs part way, inside a FOR loop, inside a GOSUB, on a line
+ * that the new version deletes and after a string assignment, reloads a
+ * changed version and checks that the run carries on where it should,
+ * with its variables and strings, and that variables are rescaled when
+ * the new version changes between whole numbers and fractions. Each
+ * case runs on both engines. Scripts report their results with
+ * POKE slot, value.
+ *
+ * Usage: test-reload
+ */
+
+#include "ubasic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static VARIABLE_TYPE results[8];
+static int failures;
+
+/*---------------------------------------------------------------------------*/
+static void check(const char *what, int ok)
+{
+  printf("%-40s %s\n", what, ok ? "ok" : "FAIL");
+  if(!ok) {
+    failures++;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE peek(VARIABLE_TYPE addr)
+{
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void poke(VARIABLE_TYPE addr, VARIABLE_TYPE value)
+{
+  results[(unsigned char)addr & 7] = value;
+}
+/*---------------------------------------------------------------------------*/
+/* Runs the first version for steps statements, reloads the second and
+   runs it to the end. */
+static void run_reload(const char *before, const char *after, int steps)
+{
+  char *old, *new;
+  int error;
+
+  // copies, so a position left pointing into the old text would show up
+  old = malloc(strlen(before) + 1);
+  new = malloc(strlen(after) + 1);
+  strcpy(old, before);
+  strcpy(new, after);
+  memset(results, 0, sizeof(results));
+  ubasic_init_peek_poke(old, peek, poke);
+  while(steps-- > 0 && !ubasic_finished()) {
+    ubasic_run();
+  }
+  error = ubasic_reload(new);
+  if(error != UBASIC_ERROR_NONE) {
+    check("reload takes the new version", 0);
+  }
+  memset(old, 0, strlen(before));
+  free(old);
+  while(!ubasic_finished()) {
+    ubasic_run();
+  }
+  free(new);
+}
+/*---------------------------------------------------------------------------*/
+static void test_for(void)
+{
+  // ten steps: lines 10 and 20, then four times 30 and 40, leaving s = 10
+  // and i = 5 at the start of line 30
+  run_reload("10 s = 0\n"
+             "20 for i = 1 to 10\n"
+             "30 s = s + i\n"
+             "40 next i\n"
+             "50 poke 1, s\n",
+             "10 s = 0\n"
+             "20 for i = 1 to 10\n"
+             "30 s = s + i * 100\n"
+             "40 next i\n"
+             "50 poke 1, s\n",
+             10);
+  check("FOR loop goes on in the new body", results[1] == 10 + 4500);
+  check("FOR variable ends past the limit", ubasic_get_variable('i' - 'a') == 11);
+}
+/*---------------------------------------------------------------------------*/
+static void test_gosub(void)
+{
+  // stopped at line 110, inside the subroutine
+  run_reload("10 gosub 100\n"
+             "20 poke 2, r\n"
+             "30 end\n"
+             "100 r = 1\n"
+             "110 r = r + 1\n"
+             "120 return\n",
+             "10 gosub 100\n"
+             "20 poke 2, r * 2\n"
+             "30 end\n"
+             "100 r = 1\n"
+             "110 r = r + 50\n"
+             "120 return\n",
+             2);
+  check("GOSUB returns into the new caller", results[2] == 102);
+}
+/*---------------------------------------------------------------------------*/
+static void test_deleted(void)
+{
+  // stopped at line 20, which the new version drops
+  run_reload("10 a = 1\n"
+             "20 a = a + 1\n"
+             "30 a = a + 10\n"
+             "40 poke 3, a\n",
+             "10 a = 1\n"
+             "30 a = a + 10\n"
+             "40 poke 3, a\n",
+             1);
+  check("deleted line goes on at the next", results[3] == 11);
+}
+/*---------------------------------------------------------------------------*/
+static void test_strings(void)
+{
+  char *s;
+
+  run_reload("10 a$ = \"hello\"\n"
+             "20 b$ = a$ + \" world\"\n"
+             "30 end\n",
+             "10 a$ = \"bye\"\n"
+             "20 b$ = a$ + \" world\"\n"
+             "30 poke 4, len(b$)\n",
+             1);
+  s = ubasic_get_stringvariable(0);
+  check("literal string outlives its program", s != NULL && strcmp(s, "hello") == 0);
+  s = ubasic_get_stringvariable(1);
+  check("string built after reload", s != NULL && strcmp(s, "hello world") == 0 &&
+        results[4] == 11);
+}
+/*---------------------------------------------------------------------------*/
+static void test_rescale(void)
+{
+  // x is set before the reload; the host reads variables unscaled, and a
+  // fraction is cut to its whole number
+  run_reload("10 x = 7\n"
+             "20 y = 2\n"
+             "30 poke 5, x / y\n",
+             "10 x = 7\n"
+             "20 y = 2\n"
+             "30 poke 5, x / y * 2.0\n",
+             2);
+  check("whole numbers rescale to fractions",
+        results[5] == 7 && ubasic_fraction_bits() > 0 &&
+        ubasic_get_variable('x' - 'a') == (VARIABLE_TYPE)7 << ubasic_fraction_bits());
+  run_reload("10 x = 2.5\n"
+             "20 y = 4\n"
+             "30 poke 6, x * y * 1.0\n",
+             "10 x = 2\n"
+             "20 y = 4\n"
+             "30 poke 6, x * y\n",
+             2);
+  check("fractions rescale to whole numbers",
+        results[6] == 8 && ubasic_fraction_bits() == 0 && ubasic_get_variable('x' - 'a') == 2);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(void)
+{
+  static const int engines[] = {UBASIC_ENGINE_TREE, UBASIC_ENGINE_VM};
+  int i;
+
+  for(i = 0; i < 2; i++) {
+    printf("%s engine\n", i == 0 ? "tree" : "vm");
+    ubasic_set_engine(engines[i]);
+    test_for();
+    test_gosub();
+    test_deleted();
+    test_strings();
+    test_rescale();
+  }
+  return failures > 0;
+}
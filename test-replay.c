@@ -0,0 +1,175 @@
+/*
+ * Record and replay test.
+ *
+ * Records a run of a program that reads a device with PEEK, calls the
+ * host with CALL, reads INPUT, LINE INPUT and EOF and has variables set
+ * by the host part way, then replays the log with every one of those
+ * giving something else, and checks that the replay reaches the same
+ * results without asking the host, and that a script asking for more
+ * than the log holds stops with UBASIC_ERROR_REPLAY. Each case runs on
+ * both engines. Scripts report their results with POKE slot, value.
+ *
+ * Usage: test-replay
+ */
+
+#include "ubasic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static VARIABLE_TYPE results[8];
+static VARIABLE_TYPE device;
+static int host_calls;
+static int failures;
+
+static const char program[] =
+  "10 for i = 1 to 5\n"
+  "20 peek i, a\n"
+  "30 s = s + a * 10 + z\n"
+  "40 next i\n"
+  "50 k = call next(7)\n"
+  "60 d$ = call name$(k) + y$\n"
+  "70 input n, b$\n"
+  "80 line input c$\n"
+  "90 if eof then e = 1\n"
+  "100 poke 1, s\n"
+  "110 poke 2, k\n"
+  "120 poke 3, n\n"
+  "130 poke 4, e\n";
+
+/*---------------------------------------------------------------------------*/
+static void check(const char *what, int ok)
+{
+  printf("%-40s %s\n", what, ok ? "ok" : "FAIL");
+  if(!ok) {
+    failures++;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE peek(VARIABLE_TYPE addr)
+{
+  host_calls++;
+  return addr * 3 + device++;
+}
+/*---------------------------------------------------------------------------*/
+static void poke(VARIABLE_TYPE addr, VARIABLE_TYPE value)
+{
+  results[(unsigned char)addr & 7] = value;
+}
+/*---------------------------------------------------------------------------*/
+static union ubasic_value next(union ubasic_value const *args)
+{
+  union ubasic_value r;
+
+  host_calls++;
+  r.num = args[0].num + device++;
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+static union ubasic_value name(union ubasic_value const *args)
+{
+  static char buffer[32];
+  union ubasic_value r;
+
+  host_calls++;
+  sprintf(buffer, "dev%d", (int)(args[0].num + device++));
+  r.str = buffer;
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+/* Runs program to the end with input from text, recording to or
+   replaying from log, and sets z and y$ from the host before the
+   statement given by host_step. */
+static int run(const char *text, FILE *log, int replaying, int host_step,
+               VARIABLE_TYPE z, char *y)
+{
+  FILE *input;
+  int n = 0;
+
+  input = tmpfile();
+  fputs(text, input);
+  rewind(input);
+  ubasic_set_input(input);
+  memset(results, 0, sizeof(results));
+  host_calls = 0;
+  ubasic_init_peek_poke(program, peek, poke);
+  rewind(log);
+  if(replaying) {
+    ubasic_replay(log);
+  } else {
+    ubasic_record(log);
+  }
+  while(!ubasic_finished()) {
+    if(++n == host_step) {
+      ubasic_set_variable(25, z);
+      ubasic_set_stringvariable(24, y);
+    }
+    ubasic_run();
+  }
+  if(replaying) {
+    ubasic_replay(NULL);
+  } else {
+    ubasic_record(NULL);
+  }
+  fclose(input);
+  return ubasic_error(NULL);
+}
+/*---------------------------------------------------------------------------*/
+static void test_replay(void)
+{
+  VARIABLE_TYPE recorded[8];
+  char b[64], c[64], d[64];
+  int error, ch, i;
+  FILE *log, *cut;
+
+  log = tmpfile();
+  device = 0;
+  error = run("12,abc\nrest of the line\n", log, 0, 4, 5, "!");
+  memcpy(recorded, results, sizeof(results));
+  strcpy(b, ubasic_get_stringvariable(1));
+  strcpy(c, ubasic_get_stringvariable(2));
+  strcpy(d, ubasic_get_stringvariable(3));
+  check("recorded run reaches the host", error == UBASIC_ERROR_NONE &&
+        host_calls == 7 && recorded[2] == 12 && recorded[3] == 12 && recorded[4] == 1 &&
+        strcmp(b, "abc") == 0 && strcmp(c, "rest of the line") == 0 &&
+        strcmp(d, "dev18!") == 0);
+
+  // another device, other input and other host settings, none of which
+  // the replay may see
+  device = 1000;
+  error = run("99,xyz\n", log, 1, 2, 77, "?");
+  check("replay does not ask the host", error == UBASIC_ERROR_NONE && host_calls == 0);
+  check("replay gives the same numbers", memcmp(results, recorded, sizeof(results)) == 0);
+  check("replay gives the same strings",
+        strcmp(ubasic_get_stringvariable(1), b) == 0 &&
+        strcmp(ubasic_get_stringvariable(2), c) == 0 &&
+        strcmp(ubasic_get_stringvariable(3), d) == 0);
+
+  // a log holding no more than its header runs out at the first PEEK
+  cut = tmpfile();
+  rewind(log);
+  for(i = 0; i < 8 && (ch = getc(log)) != EOF; i++) {
+    putc(ch, cut);
+  }
+  error = run("", cut, 1, 0, 0, "");
+  check("short log stops with its error", error == UBASIC_ERROR_REPLAY && host_calls == 0);
+  fclose(cut);
+  fclose(log);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(void)
+{
+  static const int engines[] = {UBASIC_ENGINE_TREE, UBASIC_ENGINE_VM};
+  int i;
+
+  ubasic_register_function("next", next, 1, "nn");
+  ubasic_register_function("name$", name, 1, "sn");
+  for(i = 0; i < 2; i++) {
+    printf("%s engine\n", i == 0 ? "tree" : "vm");
+    ubasic_set_engine(engines[i]);
+    test_replay();
+  }
+  ubasic_set_input(stdin);
+  return failures > 0;
+}
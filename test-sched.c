@@ -0,0 +1,156 @@
+/*
+ * Scheduler and context test.
+ *
+ * Runs small programs as tasks and checks that each keeps its own
+ * variables, that SLEEP and YIELD end a slice and SLEEP keeps a task
+ * out of the rotation, that equal tasks get a fair share, and that an
+ * async PEEK can be completed from inside a callback, its own or
+ * another task's. Scripts report their results with POKE task, value.
+ *
+ * Usage: test-sched
+ */
+
+#include "sched.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static VARIABLE_TYPE results[8];
+static int resume_mode;
+static int failures;
+
+static const char sum[] =
+  "10 s = 0\n"
+  "20 for i = 1 to 2000\n"
+  "30 s = s + i * t\n"
+  "40 next i\n"
+  "50 poke t, s\n";
+
+/*---------------------------------------------------------------------------*/
+static void check(const char *what, int ok)
+{
+  printf("%-40s %s\n", what, ok ? "ok" : "FAIL");
+  if(!ok) {
+    failures++;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int peek_async(VARIABLE_TYPE addr, VARIABLE_TYPE *value)
+{
+  int task = sched_current();
+
+  if(resume_mode == 0) {
+    sched_resume(task, addr * 10); // completed before it returns
+    return UBASIC_PENDING;
+  }
+  if(task == 1) {
+    return UBASIC_PENDING; // left for task 0 to complete
+  }
+  sched_resume(1, 77);
+  *value = addr;
+  return UBASIC_DONE;
+}
+/*---------------------------------------------------------------------------*/
+static int poke_async(VARIABLE_TYPE addr, VARIABLE_TYPE value)
+{
+  results[(unsigned char)addr & 7] = value;
+  return UBASIC_DONE;
+}
+/*---------------------------------------------------------------------------*/
+static void test_contexts(void)
+{
+  struct ubasic_context *home, *a, *b;
+
+  home = ubasic_context_new();
+  ubasic_context_save(home);
+  a = ubasic_context_new();
+  b = ubasic_context_new();
+  ubasic_context_load(a);
+  ubasic_init("10 t = 1\n20 t = t + 1\n30 t = t + 1\n");
+  ubasic_run();
+  ubasic_context_save(a);
+  ubasic_context_load(b);
+  ubasic_init("10 t = 100\n20 t = t * 2\n");
+  ubasic_run();
+  ubasic_run();
+  ubasic_context_save(b);
+  ubasic_context_load(a);
+  ubasic_run();
+  check("context keeps its variables", ubasic_get_variable(19) == 2);
+  ubasic_context_load(b);
+  check("other context keeps its own", ubasic_get_variable(19) == 200);
+  ubasic_context_load(home);
+  free(home); // its buffers are in use again
+  ubasic_context_free(a);
+  ubasic_context_free(b);
+}
+/*---------------------------------------------------------------------------*/
+static void test_tasks(void)
+{
+  char programs[4][128]; // in use until the tasks are done
+  int i;
+
+  for(i = 1; i <= 3; i++) {
+    sprintf(programs[i], "5 t = %d\n%s", i, sum);
+    sched_add(programs[i]);
+  }
+  sched_budget(7, 0);
+  sched_run();
+  check("tasks finish with their own results",
+        results[1] == 2001000 && results[2] == 4002000 && results[3] == 6003000);
+  // run time is wall time, so leave room for the machine being busy; one
+  // task getting it all would score 1/3
+  check("equal tasks share fairly", sched_fairness() > 0.6);
+  sched_free();
+}
+/*---------------------------------------------------------------------------*/
+static void test_sleep_yield(void)
+{
+  struct sched_task_stats stats;
+  unsigned long long start;
+
+  sched_add("10 sleep 30\n20 poke 1, 1\n");
+  sched_add("10 for i = 1 to 5\n20 yield\n30 next i\n40 poke 2, 2\n");
+  sched_budget(100, 0);
+  start = ubasic_clock();
+  sched_step();
+  sched_stats(0, &stats);
+  check("SLEEP leaves the rotation", stats.state == SCHED_SLEEPING);
+  sched_run();
+  check("SLEEP lasts as long as asked", ubasic_clock() - start >= 30000000ULL);
+  sched_stats(1, &stats);
+  check("YIELD ends the slice", stats.state == SCHED_DONE && stats.slices >= 6);
+  sched_free();
+}
+/*---------------------------------------------------------------------------*/
+static void test_resume(void)
+{
+  struct sched_task_stats stats;
+
+  ubasic_set_async_peek_poke(peek_async, poke_async);
+  resume_mode = 0;
+  sched_add("10 peek 4, a\n20 poke 1, a\n");
+  sched_run();
+  sched_stats(0, &stats);
+  check("resume from its own callback", stats.state == SCHED_DONE && results[1] == 40);
+  sched_free();
+
+  resume_mode = 1;
+  sched_add("10 for i = 1 to 3\n20 next i\n30 peek 5, a\n40 poke 2, a\n");
+  sched_add("10 peek 6, a\n20 poke 3, a\n");
+  sched_budget(1, 0);
+  sched_run();
+  check("resume from another task's callback", results[2] == 5 && results[3] == 77);
+  sched_free();
+  ubasic_set_async_peek_poke(NULL, poke_async);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(void)
+{
+  ubasic_set_async_peek_poke(NULL, poke_async);
+  test_contexts();
+  test_tasks();
+  test_sleep_yield();
+  test_resume();
+  return failures > 0;
+}
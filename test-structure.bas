@@ -0,0 +1,26 @@
+5 rem blocks whose ELSE, ENDIF or WEND only a GOTO skips over
+10 a = 0
+20 if a then
+30 goto 70
+40 else
+50 print "else ok"
+60 endif
+70 i = 5
+80 while i < 3
+90 i = i + 1
+100 goto 120
+110 wend
+120 print "while ok"
+130 if a then
+140 print "if bad"
+150 goto 170
+160 endif
+170 print "endif ok"
+180 a = 1
+190 if a then
+200 goto 240
+210 else
+220 print "else bad"
+230 endif
+240 print "then ok"
+250 end
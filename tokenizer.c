@@ -48,18 +48,18 @@
 #include <ctype.h>
 #include <stdlib.h>
 
-static char const *ptr, *nextptr, *startptr;
+static THREAD_LOCAL char const *ptr, *nextptr, *startptr;
 
-static char const *prog;
+static THREAD_LOCAL char const *prog;
 
-#define MAX_NUMLEN 5
+#define MAX_NUMLEN 20 // digits and a decimal point
 
 struct keyword_token {
   char *keyword;
   int token;
 };
 
-static int current_token = TOKENIZER_ERROR;
+static THREAD_LOCAL int current_token = TOKENIZER_ERROR;
 
 static const struct keyword_token keywords[] = {
 
@@ -74,6 +74,31 @@ static const struct keyword_token keywords[] = {
   {"instr",                   TOKENIZER_INSTR},
   {"asc",                     TOKENIZER_ASC},
 // end of string additions
+
+// input additions
+  {"input",                   TOKENIZER_INPUT},
+  {"line",                    TOKENIZER_LINE},
+  {"eof",                     TOKENIZER_EOF},
+// end of input additions
+
+// scheduler additions
+  {"sleep",                   TOKENIZER_SLEEP},
+  {"yield",                   TOKENIZER_YIELD},
+// end of scheduler additions
+
+// structured additions
+  {"while",                   TOKENIZER_WHILE},
+  {"wend",                    TOKENIZER_WEND},
+  {"endif",                   TOKENIZER_ENDIF}, // before "end"
+// end of structured additions
+
+// parallel additions
+  {"parfor",                  TOKENIZER_PARFOR},
+  {"reduce",                  TOKENIZER_REDUCE},
+  {"sum",                     TOKENIZER_SUM},
+  {"min",                     TOKENIZER_MIN},
+  {"max",                     TOKENIZER_MAX},
+// end of parallel additions
  
   {"let", TOKENIZER_LET},
   {"print", TOKENIZER_PRINT},
@@ -91,6 +116,12 @@ static const struct keyword_token keywords[] = {
   {"peek", TOKENIZER_PEEK},
   {"poke", TOKENIZER_POKE},
   {"end", TOKENIZER_END},
+
+// condition additions - last, so statements do not pay for them
+  {"and",                     TOKENIZER_LAND},
+  {"or",                      TOKENIZER_LOR},
+  {"not",                     TOKENIZER_NOT},
+// end of condition additions
   {NULL, TOKENIZER_ERROR}
 };
 
@@ -111,6 +142,7 @@ static const struct keyword_token tokens[] = {
     {"TOKENIZER_LEN",TOKENIZER_LEN},
     {"TOKENIZER_INSTR",TOKENIZER_INSTR},
     {"TOKENIZER_ASC",TOKENIZER_ASC},
+    {"TOKENIZER_EOF",TOKENIZER_EOF},
 	{"TOKENIZER_LET",TOKENIZER_LET},
 	{"TOKENIZER_PRINT",TOKENIZER_PRINT},
 	{"TOKENIZER_IF",TOKENIZER_IF},
@@ -127,8 +159,26 @@ static const struct keyword_token tokens[] = {
 	{"TOKENIZER_PEEK",TOKENIZER_PEEK},
 	{"TOKENIZER_POKE",TOKENIZER_POKE},
 	{"TOKENIZER_END",TOKENIZER_END},
+	{"TOKENIZER_INPUT",TOKENIZER_INPUT},
+	{"TOKENIZER_LINE",TOKENIZER_LINE},
+	{"TOKENIZER_SLEEP",TOKENIZER_SLEEP},
+	{"TOKENIZER_YIELD",TOKENIZER_YIELD},
+	{"TOKENIZER_WHILE",TOKENIZER_WHILE},
+	{"TOKENIZER_WEND",TOKENIZER_WEND},
+	{"TOKENIZER_ENDIF",TOKENIZER_ENDIF},
+	{"TOKENIZER_LABEL",TOKENIZER_LABEL},
+	{"TOKENIZER_PARFOR",TOKENIZER_PARFOR},
+	{"TOKENIZER_REDUCE",TOKENIZER_REDUCE},
+	{"TOKENIZER_SUM",TOKENIZER_SUM},
+	{"TOKENIZER_MIN",TOKENIZER_MIN},
+	{"TOKENIZER_MAX",TOKENIZER_MAX},
+	{"TOKENIZER_NAME",TOKENIZER_NAME},
+	{"TOKENIZER_LAND",TOKENIZER_LAND},
+	{"TOKENIZER_LOR",TOKENIZER_LOR},
+	{"TOKENIZER_NOT",TOKENIZER_NOT},
 	{"TOKENIZER_COMMA",TOKENIZER_COMMA},
 	{"TOKENIZER_SEMICOLON",TOKENIZER_SEMICOLON},
+	{"TOKENIZER_COLON",TOKENIZER_COLON},
 	{"TOKENIZER_PLUS",TOKENIZER_PLUS},
 	{"TOKENIZER_MINUS",TOKENIZER_MINUS},
 	{"TOKENIZER_AND",TOKENIZER_AND},
@@ -142,8 +192,12 @@ static const struct keyword_token tokens[] = {
 	{"TOKENIZER_LT",TOKENIZER_LT},
 	{"TOKENIZER_GT",TOKENIZER_GT},
 	{"TOKENIZER_EQ",TOKENIZER_EQ},
+	{"TOKENIZER_LE",TOKENIZER_LE},
+	{"TOKENIZER_GE",TOKENIZER_GE},
+	{"TOKENIZER_NE",TOKENIZER_NE},
 	{"TOKENIZER_LF",TOKENIZER_LF},
-	{"TOKENIZER_CR",TOKENIZER_CR}
+	{"TOKENIZER_CR",TOKENIZER_CR},
+	{NULL, TOKENIZER_ERROR}
 };
 
 /*---------------------------------------------------------------------------*/
@@ -154,6 +208,8 @@ static int singlechar(void){
     return TOKENIZER_COMMA;
   } else if(*ptr == ';') {
     return TOKENIZER_SEMICOLON;
+  } else if(*ptr == ':') {
+    return TOKENIZER_COLON;
   } else if(*ptr == '+') {
     return TOKENIZER_PLUS;
   } else if(*ptr == '-') {
@@ -184,9 +240,10 @@ static int singlechar(void){
   return 0;
 }
 /*---------------------------------------------------------------------------*/
-static int get_next_token(void){
+static int get_next_token(int after_call){
   struct keyword_token const *kt;
   int i;
+  int dot = 0;
 
   DEBUG_PRINTF("get_next_token: %p.\n", ptr-startptr);
   
@@ -197,8 +254,16 @@ static int get_next_token(void){
     return TOKENIZER_ENDOFINPUT;
   }
 
+  // step over the offending character if this turns out to be an error
+  nextptr = ptr + 1;
+
   if(isdigit(*ptr)) {
     for(i = 0; i < MAX_NUMLEN; ++i) {
+      // fraction addition - one decimal point, followed by a digit
+      if(ptr[i] == '.' && !dot && isdigit(ptr[i + 1])) {
+        dot = 1;
+        continue;
+      }
       if(!isdigit(ptr[i])) {
         if(i > 0) {
           nextptr = ptr + i;
@@ -215,6 +280,14 @@ static int get_next_token(void){
     }
     DEBUG_PRINTF("get_next_token: error due to too long number.\n");
     return TOKENIZER_ERROR;
+  // condition addition - <=, >= and <> are one token
+  } else if(*ptr == '<' && (ptr[1] == '=' || ptr[1] == '>')) {
+    nextptr = ptr + 2;
+    return ptr[1] == '=' ? TOKENIZER_LE : TOKENIZER_NE;
+  } else if(*ptr == '>' && ptr[1] == '=') {
+    nextptr = ptr + 2;
+    return TOKENIZER_GE;
+  // end of condition addition
   } else if(singlechar()) {
     nextptr = ptr + 1;
     return singlechar();
@@ -222,9 +295,30 @@ static int get_next_token(void){
     nextptr = ptr;
     do {
       ++nextptr;
-    } while(*nextptr != '"');
-    ++nextptr;
+    } while(*nextptr != '"' && *nextptr != 0);
+    if(*nextptr == '"') {
+      ++nextptr;
+    }
     return TOKENIZER_STRING;
+  // label addition
+  } else if(*ptr == '@') {
+    nextptr = ptr + 1;
+    while(isalnum(*nextptr) || *nextptr == '_') {
+      ++nextptr;
+    }
+    return TOKENIZER_LABEL;
+  // end of label addition
+  // call addition - the word after CALL names a host function
+  } else if(after_call && *ptr >= 'a' && *ptr <= 'z') {
+    nextptr = ptr + 1;
+    while(isalnum(*nextptr) || *nextptr == '_') {
+      ++nextptr;
+    }
+    if(*nextptr == '$') {
+      ++nextptr;
+    }
+    return TOKENIZER_NAME;
+  // end of call addition
   } else {
     for(kt = keywords; kt->keyword != NULL; ++kt) {
       if(strncmp(ptr, kt->keyword, strlen(kt->keyword)) == 0) {
@@ -269,9 +363,16 @@ int tokenizer_stringlookahead() {
 	    si = 1;
 	 else if (token >= TOKENIZER_STRINGVARIABLE && token <= TOKENIZER_CHR$)
 	    si = 1;
+	 else if (token == TOKENIZER_CALL)
+	    si = si; // the name decides
+	 else if (token == TOKENIZER_NAME)
+	    si = (*(nextptr - 1) == '$'); // a host function returning a string
 	 else if (token > TOKENIZER_CHR$)
 	    si = 0; // numeric function
-     token = get_next_token();   
+     else if (token == TOKENIZER_ERROR)
+	    si = 0; // let the expression parser report it
+     ptr = nextptr;
+     token = get_next_token(token == TOKENIZER_CALL);   
   }
   ptr = saveptr;
   nextptr = savenextptr;
@@ -280,14 +381,35 @@ int tokenizer_stringlookahead() {
 /*---------------------------------------------------------------------------*/
 void tokenizer_goto(const char *program){
   ptr = program;
-  current_token = get_next_token();
+  current_token = get_next_token(0);
 }
 /*---------------------------------------------------------------------------*/
 void tokenizer_init(const char *program){
   ptr = program;
   prog = program;
   startptr = program;
-  current_token = get_next_token();
+  current_token = get_next_token(0);
+  // label addition - an unnumbered program can open with a comment
+  if(current_token == TOKENIZER_REM) {
+    nextptr = ptr;
+    tokenizer_next();
+  }
+}
+/*---------------------------------------------------------------------------*/
+void tokenizer_save(struct tokenizer_state *state){
+  state->ptr = ptr;
+  state->nextptr = nextptr;
+  state->startptr = startptr;
+  state->prog = prog;
+  state->current_token = current_token;
+}
+/*---------------------------------------------------------------------------*/
+void tokenizer_load(const struct tokenizer_state *state){
+  ptr = state->ptr;
+  nextptr = state->nextptr;
+  startptr = state->startptr;
+  prog = state->prog;
+  current_token = state->current_token;
 }
 /*---------------------------------------------------------------------------*/
 int tokenizer_token(void){
@@ -306,13 +428,11 @@ void tokenizer_next(void){
   while(*ptr == ' ') {
     ++ptr;
   }
-  current_token = get_next_token();
+  current_token = get_next_token(current_token == TOKENIZER_CALL);
 
   if(current_token == TOKENIZER_REM) {
-      while(!(*nextptr == '\n' || tokenizer_finished())) {
-        ++nextptr;
-      }
-      if(*nextptr == '\n') {
+      // the rest of the line is a comment, the LF still ends the statement
+      while(*nextptr != '\n' && *nextptr != 0) {
         ++nextptr;
       }
       tokenizer_next();
@@ -324,11 +444,11 @@ void tokenizer_next(void){
 /*---------------------------------------------------------------------------*/
 VARIABLE_TYPE tokenizer_num(void)
 {
-  return atoi(ptr);
+  return atoll(ptr);
 }
 /*---------------------------------------------------------------------------*/
 void tokenizer_string(char *dest, int len){
-  char *string_end;
+  char const *string_end;
   int string_len;
 
   if(tokenizer_token() != TOKENIZER_STRING) {
@@ -336,7 +456,7 @@ void tokenizer_string(char *dest, int len){
   }
   string_end = strchr(ptr + 1, '"');
   if(string_end == NULL) {
-    return;
+    string_end = ptr + 1 + strlen(ptr + 1); // unterminated, runs to the end
   }
   string_len = string_end - ptr - 1;
   if(len < string_len) {
@@ -346,6 +466,19 @@ void tokenizer_string(char *dest, int len){
   dest[string_len] = 0;
 }
 /*---------------------------------------------------------------------------*/
+int tokenizer_string_len(void){
+  char *string_end;
+
+  if(tokenizer_token() != TOKENIZER_STRING) {
+    return 0;
+  }
+  string_end = strchr(ptr + 1, '"');
+  if(string_end == NULL) {
+    return strlen(ptr + 1); // unterminated, runs to the end
+  }
+  return string_end - ptr - 1;
+}
+/*---------------------------------------------------------------------------*/
 void
 tokenizer_error_print(void)
 {
@@ -58,6 +58,9 @@ enum {
   TOKENIZER_INSTR,
   TOKENIZER_ASC,
 // end of string additions
+// input additions
+  TOKENIZER_EOF,
+// end of input additions
   TOKENIZER_LET,
   TOKENIZER_PRINT,
   TOKENIZER_IF,
@@ -74,8 +77,40 @@ enum {
   TOKENIZER_PEEK,
   TOKENIZER_POKE,
   TOKENIZER_END,
+// input additions
+  TOKENIZER_INPUT,
+  TOKENIZER_LINE,
+// end of input additions
+// scheduler additions
+  TOKENIZER_SLEEP,
+  TOKENIZER_YIELD,
+// end of scheduler additions
+// structured additions
+  TOKENIZER_WHILE,
+  TOKENIZER_WEND,
+  TOKENIZER_ENDIF,
+// end of structured additions
+// label additions
+  TOKENIZER_LABEL,
+// end of label additions
+// parallel additions
+  TOKENIZER_PARFOR,
+  TOKENIZER_REDUCE,
+  TOKENIZER_SUM,
+  TOKENIZER_MIN,
+  TOKENIZER_MAX,
+// end of parallel additions
+// call additions
+  TOKENIZER_NAME,
+// end of call additions
+// condition additions
+  TOKENIZER_LAND,
+  TOKENIZER_LOR,
+  TOKENIZER_NOT,
+// end of condition additions
   TOKENIZER_COMMA,
   TOKENIZER_SEMICOLON,
+  TOKENIZER_COLON, // structured addition
   TOKENIZER_PLUS,
   TOKENIZER_MINUS,
   TOKENIZER_AND,
@@ -89,6 +124,11 @@ enum {
   TOKENIZER_LT,
   TOKENIZER_GT,
   TOKENIZER_EQ,
+// condition additions
+  TOKENIZER_LE,
+  TOKENIZER_GE,
+  TOKENIZER_NE,
+// end of condition additions
   TOKENIZER_LF,
   TOKENIZER_CR
 };
@@ -100,6 +140,7 @@ int tokenizer_token(void);
 VARIABLE_TYPE tokenizer_num(void);
 int tokenizer_variable_num(void);
 void tokenizer_string(char *dest, int len);
+int tokenizer_string_len(void);
 
 int tokenizer_finished(void);
 void tokenizer_error_print(void);
@@ -113,4 +154,13 @@ char *tokenizer_token_name(int token);
 int tokenizer_stringlookahead(void);
 // end of string addition
 
+// context addition
+struct tokenizer_state {
+  char const *ptr, *nextptr, *startptr, *prog;
+  int current_token;
+};
+void tokenizer_save(struct tokenizer_state *state);
+void tokenizer_load(const struct tokenizer_state *state);
+// end of context addition
+
 #endif /* __TOKENIZER_H__ */
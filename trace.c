@@ -0,0 +1,72 @@
+/*
+ * Ring-buffer tracer for the uBASIC trace hooks.
+ *
+ * The trace file is the 8 byte TRACE_MAGIC, the record count as an int
+ * and then the records oldest first, all in host byte order.
+ */
+
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static struct trace_record *ring = NULL;
+static int ring_size = 0;
+static int ring_next = 0;
+static int ring_count = 0;
+
+/*---------------------------------------------------------------------------*/
+int trace_open(int capacity)
+{
+  trace_close();
+  if(capacity <= 0 ||
+     (ring = malloc(capacity * sizeof(struct trace_record))) == NULL) {
+    return -1;
+  }
+  ring_size = capacity;
+  ubasic_set_trace(trace_record);
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+void trace_record(int event, int arg1, int arg2)
+{
+  struct trace_record *r = ring + ring_next;
+
+  r->time = ubasic_clock();
+  r->event = event;
+  r->arg1 = arg1;
+  r->arg2 = arg2;
+  r->reserved = 0;
+  if(++ring_next == ring_size) {
+    ring_next = 0;
+  }
+  if(ring_count < ring_size) {
+    ring_count++;
+  }
+}
+/*---------------------------------------------------------------------------*/
+int trace_write(const char *fname)
+{
+  FILE *f;
+  int first = (ring_next - ring_count + ring_size) % (ring_size ? ring_size : 1);
+  int n;
+
+  if((f = fopen(fname, "wb")) == NULL) {
+    return -1;
+  }
+  fwrite(TRACE_MAGIC, 1, 8, f);
+  fwrite(&ring_count, sizeof(ring_count), 1, f);
+  // oldest records first - the ring may have wrapped
+  n = ring_size - first < ring_count ? ring_size - first : ring_count;
+  fwrite(ring + first, sizeof(struct trace_record), n, f);
+  fwrite(ring, sizeof(struct trace_record), ring_count - n, f);
+  fclose(f);
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+void trace_close(void)
+{
+  ubasic_set_trace(NULL);
+  free(ring);
+  ring = NULL;
+  ring_size = ring_next = ring_count = 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * Ring-buffer tracer for the uBASIC trace hooks.
+ *
+ * trace_open() installs trace_record() with ubasic_set_trace(); the most
+ * recent events are kept in memory and trace_write() saves them to a
+ * binary trace file which trace2json converts to Chrome trace JSON.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "ubasic.h"
+
+#define TRACE_MAGIC "UBTRACE1"
+
+struct trace_record {
+  unsigned long long time; // nanoseconds
+  int event;
+  int arg1;
+  int arg2;
+  int reserved;
+};
+
+int trace_open(int capacity);
+void trace_record(int event, int arg1, int arg2);
+int trace_write(const char *fname);
+void trace_close(void);
+
+#endif /* __TRACE_H__ */
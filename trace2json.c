@@ -0,0 +1,121 @@
+/*
+ * Convert a binary uBASIC trace file to Chrome trace JSON
+ * (load the result in chrome://tracing or Perfetto).
+ *
+ * Lines are shown as slices on thread 1, GOSUB calls on thread 2 and
+ * garbage collections on thread 3; statements, PEEKs and POKEs are
+ * instant events on thread 1.
+ *
+ * Usage: trace2json tracefile [jsonfile]
+ */
+
+#include "trace.h"
+#include "tokenizer.h"
+#include <stdio.h>
+#include <string.h>
+
+/*---------------------------------------------------------------------------*/
+static const char *statement_name(int token)
+{
+  const char *name = tokenizer_token_name(token);
+
+  if(name == NULL) {
+    return "?";
+  }
+  if(strncmp(name, "TOKENIZER_", 10) == 0) {
+    name += 10;
+  }
+  return name;
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+  struct trace_record r;
+  unsigned long long start = 0;
+  char magic[8];
+  int count, i;
+  int line_open = 0;
+  double ts = 0;
+  const char *sep = "";
+  FILE *in, *out = stdout;
+
+  if (argc < 2) {
+    printf("Usage: trace2json tracefile [jsonfile]\n");
+    return 0;
+  }
+  if ((in = fopen(argv[1], "rb")) == NULL) {
+    printf("Trace file \"%s\" not found - terminating\n", argv[1]);
+    return (-1);
+  }
+  if (fread(magic, 1, 8, in) != 8 || memcmp(magic, TRACE_MAGIC, 8) != 0 ||
+      fread(&count, sizeof(count), 1, in) != 1) {
+    printf("\"%s\" is not a trace file - terminating\n", argv[1]);
+    return (-1);
+  }
+  if (argc > 2 && (out = fopen(argv[2], "w")) == NULL) {
+    printf("Cannot create \"%s\" - terminating\n", argv[2]);
+    return (-1);
+  }
+
+  fprintf(out, "{\"traceEvents\":[");
+  for (i = 0; i < count && fread(&r, sizeof(r), 1, in) == 1; i++) {
+    if (i == 0) {
+      start = r.time;
+    }
+    ts = (r.time - start) / 1000.0;
+    switch (r.event) {
+    case UBASIC_TRACE_LINE:
+      if (line_open) {
+        fprintf(out, "%s\n{\"ph\":\"E\",\"pid\":1,\"tid\":1,\"ts\":%.3f}", sep, ts);
+        sep = ",";
+      }
+      fprintf(out, "%s\n{\"name\":\"line %d\",\"ph\":\"B\",\"pid\":1,\"tid\":1,\"ts\":%.3f}",
+              sep, r.arg1, ts);
+      line_open = 1;
+      break;
+    case UBASIC_TRACE_STATEMENT:
+      fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":1,\"ts\":%.3f}",
+              sep, statement_name(r.arg1), ts);
+      break;
+    case UBASIC_TRACE_GOSUB:
+      fprintf(out, "%s\n{\"name\":\"gosub %d\",\"ph\":\"B\",\"pid\":1,\"tid\":2,\"ts\":%.3f,"
+              "\"args\":{\"from\":%d}}", sep, r.arg1, ts, r.arg2);
+      break;
+    case UBASIC_TRACE_RETURN:
+      fprintf(out, "%s\n{\"ph\":\"E\",\"pid\":1,\"tid\":2,\"ts\":%.3f}", sep, ts);
+      break;
+    case UBASIC_TRACE_GC_START:
+      fprintf(out, "%s\n{\"name\":\"gc\",\"ph\":\"B\",\"pid\":1,\"tid\":3,\"ts\":%.3f,"
+              "\"args\":{\"in use\":%d}}", sep, ts, r.arg1);
+      break;
+    case UBASIC_TRACE_GC_END:
+      fprintf(out, "%s\n{\"ph\":\"E\",\"pid\":1,\"tid\":3,\"ts\":%.3f,"
+              "\"args\":{\"in use\":%d,\"reclaimed\":%d}}", sep, ts, r.arg1, r.arg2);
+      break;
+    case UBASIC_TRACE_PEEK_BLOCK:
+    case UBASIC_TRACE_POKE_BLOCK:
+      fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":1,\"ts\":%.3f,"
+              "\"args\":{\"address\":%d,\"count\":%d}}",
+              sep, r.event == UBASIC_TRACE_PEEK_BLOCK ? "peek block" : "poke block", ts, r.arg1, r.arg2);
+      break;
+    case UBASIC_TRACE_PEEK:
+    case UBASIC_TRACE_POKE:
+      fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":1,\"ts\":%.3f,"
+              "\"args\":{\"address\":%d,\"value\":%d}}",
+              sep, r.event == UBASIC_TRACE_PEEK ? "peek" : "poke", ts, r.arg1, r.arg2);
+      break;
+    }
+    sep = ",";
+  }
+  if (line_open) {
+    fprintf(out, "%s\n{\"ph\":\"E\",\"pid\":1,\"tid\":1,\"ts\":%.3f}", sep, ts);
+  }
+  fprintf(out, "\n]}\n");
+
+  fclose(in);
+  if (out != stdout) {
+    fclose(out);
+  }
+  return 0;
+}
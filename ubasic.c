@@ -48,90 +48,1068 @@
 #include "tokenizer.h"
 
 #include <stdio.h> /* printf() */
-#include <stdlib.h> /* exit() */
+#include <stdlib.h> /* malloc() */
+#include <setjmp.h> /* setjmp() */
 #include <string.h> /* strlen() etc */
+#include <ctype.h> /* isalnum() */
+#ifdef _WIN32
+#include <windows.h> /* QueryPerformanceCounter(), CreateThread() */
+#else
+#include <time.h> /* clock_gettime() */
+#if MAX_WORKERS > 1
+#include <pthread.h> /* pthread_create() */
+#endif
+#endif
+
+// string addition - SSE2 is part of the x86-64 baseline, so no runtime check
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h> /* _mm_cmpeq_epi8() etc */
+#define SSE2_SEARCH 1
+#else
+#define SSE2_SEARCH 0
+#endif
+// end of string addition
+
+// profile addition - hardware counters from perf_event_open() on Linux
+#ifdef __linux__
+#include <linux/perf_event.h> /* struct perf_event_attr */
+#include <sys/ioctl.h> /* ioctl() */
+#include <sys/syscall.h> /* SYS_perf_event_open */
+#include <unistd.h> /* syscall(), read(), close() */
+#define PERF_COUNTERS 1
+#else
+#define PERF_COUNTERS 0
+#endif
+// end of profile addition
+
+static THREAD_LOCAL char const *program_ptr;
 
-static char const *program_ptr;
-#define MAX_STRINGLEN 40
-static char string[MAX_STRINGLEN];
+// arena additions - what an interpreter allocates comes from one of two
+// arenas, so ubasic_init() gives it all back by rewinding them. Their
+// blocks are kept for the next program, so a host that starts programs
+// over and over stops calling malloc() once the blocks are big enough.
+#define ARENA_BLOCK 16384 // bytes in the first block, each one after is twice the last
+#define ARENA_ALIGN 16
+struct arena_block {
+  struct arena_block *next;
+  size_t size; // bytes after the header
+  size_t used;
+};
+struct arena {
+  struct arena_block *first;
+  struct arena_block *current; // the block being allocated from
+};
+struct arena_mark {
+  struct arena_block *block;
+  size_t used;
+};
+static THREAD_LOCAL struct arena load_arena; // tables built from the program text, rewound by ubasic_init() and ubasic_reload()
+static THREAD_LOCAL struct arena run_arena;  // the line index and the string heap, rewound by ubasic_init()
+// end of arena additions
 
 // string additions
 #define MAX_STRINGVARLEN 255
 #define MAX_BUFFERLEN    4000
 #define GBGCHECK         3500
-static char stringbuffer[MAX_BUFFERLEN];
-static int  freebufptr = 0;
+#define GBGHEADROOM      (MAX_BUFFERLEN - GBGCHECK)
+static THREAD_LOCAL char *stringbuffer = NULL;
+static THREAD_LOCAL int  freebufptr = 0;
+static THREAD_LOCAL int  heap_size = 0;
+static THREAD_LOCAL int  heap_initial_size = MAX_BUFFERLEN;
+static THREAD_LOCAL int  heap_max_size = MAX_BUFFERLEN;
+static THREAD_LOCAL int  gc_policy = UBASIC_GC_FIXED;
+static THREAD_LOCAL int  gc_threshold = GBGCHECK;
+static THREAD_LOCAL struct ubasic_heap_stats heap_stats;
+static THREAD_LOCAL unsigned long long heap_start_time;
+static THREAD_LOCAL int  heap_last_used = 0; // string space in use after the last collection
 #define MAX_SVARNUM 26 
-static char *stringvariables[MAX_SVARNUM];
+#define VM_TEMPS 32 // vm addition - registers after the variables for values being worked out
+static THREAD_LOCAL char *stringvariables[MAX_SVARNUM + VM_TEMPS];
+struct string_literal {
+  char const *program_text_position;
+  char *string;
+};
+static THREAD_LOCAL struct string_literal *literals = NULL; // followed by the literal pool
+static THREAD_LOCAL int  literal_count = 0;
+static THREAD_LOCAL char *literal_pool = NULL;
+static THREAD_LOCAL char *literal_pool_end = NULL;
 // end of string additions
 
+// input additions
+#define INPUT_BUFFERLEN  32768
+static THREAD_LOCAL char *inputbuffer = NULL; // INPUT_BUFFERLEN + 1 for terminating an unterminated last line
+static THREAD_LOCAL int  inputstart = 0;
+static THREAD_LOCAL int  inputend = 0;
+static THREAD_LOCAL int  inputeof = 0;
+static THREAD_LOCAL FILE *inputstream = NULL;
+// end of input additions
+
 
 #define MAX_GOSUB_STACK_DEPTH 10
-static int gosub_stack[MAX_GOSUB_STACK_DEPTH];
-static int gosub_stack_ptr;
+struct gosub_state {
+  char const *return_position; // statement after the GOSUB
+  int line_number;             // line of the GOSUB
+  int target_line;             // line the subroutine starts at (sampler addition)
+};
+static THREAD_LOCAL struct gosub_state gosub_stack[MAX_GOSUB_STACK_DEPTH];
+static THREAD_LOCAL int gosub_stack_ptr;
 
 struct for_state {
-  int line_after_for;
+  char const *position_after_for;
+  int line_number;
   int for_variable;
-  int to;
+  VARIABLE_TYPE to;
 };
 #define MAX_FOR_STACK_DEPTH 4
-static struct for_state for_stack[MAX_FOR_STACK_DEPTH];
-static int for_stack_ptr;
+static THREAD_LOCAL struct for_state for_stack[MAX_FOR_STACK_DEPTH];
+static THREAD_LOCAL int for_stack_ptr;
 
 struct line_index {
   int line_number;
   char const *program_text_position;
   struct line_index *next;
+  struct line_index *chain; // scale addition - next in the same hash bucket
 };
-struct line_index *line_index_head = NULL;
-struct line_index *line_index_current = NULL;
+THREAD_LOCAL struct line_index *line_index_head = NULL;
+THREAD_LOCAL struct line_index *line_index_current = NULL;
+// scale additions - lines are found through a hash table that doubles
+// once it holds as many lines as it has buckets, and a search for a line
+// not in it carries on from where the last one stopped
+static THREAD_LOCAL struct line_index **line_index_buckets = NULL;
+static THREAD_LOCAL int line_index_bits = 0;
+static THREAD_LOCAL int line_index_count = 0;
+static THREAD_LOCAL char const *line_index_scanned = NULL; // lines before this are all in the index
+static THREAD_LOCAL struct line_index *line_index_free = NULL; // entries ubasic_reload() dropped, for reuse
+#define LINE_INDEX_HASH(linenum) ((unsigned)(linenum) * 2654435761u >> (32 - line_index_bits))
+// end of scale additions
 #define MAX_VARNUM 26
-static VARIABLE_TYPE variables[MAX_VARNUM];
+static THREAD_LOCAL VARIABLE_TYPE variables[MAX_VARNUM + VM_TEMPS]; // vm addition
+
+static THREAD_LOCAL int ended;
+
+// error addition - errors unwind to ubasic_run() through error_jmp
+static THREAD_LOCAL jmp_buf error_jmp;
+static THREAD_LOCAL struct ubasic_error error_info;
+static THREAD_LOCAL int current_linenum;
+// end of error addition
+
+// scheduler addition
+static THREAD_LOCAL int yield_time = -1; // set by SLEEP and YIELD
+// end of scheduler addition
+
+// structured additions - IF, ELSE, WHILE and WEND jump targets, resolved at load time
+struct jump_target {
+  char const *program_text_position; // the IF, ELSE, WHILE or WEND token
+  char const *target;                // where execution continues
+};
+#define MAX_STRUCTURE_DEPTH 16
+static THREAD_LOCAL struct jump_target *jump_targets = NULL;
+static THREAD_LOCAL int jump_target_count = 0;
+// end of structured additions
+
+// fraction additions - a program with a decimal point runs in fixed point
+static THREAD_LOCAL int fraction_bits = 0; // FIXED_POINT_BITS, or 0 for integer arithmetic
+#define FRACTION_DIGITS (FIXED_POINT_BITS * 3 / 10) // decimals worth printing
+// end of fraction additions
+
+// label additions - GOTO @name and GOSUB @name are jump targets too
+static THREAD_LOCAL char const **line_starts = NULL; // text lines of an unnumbered program
+static THREAD_LOCAL int line_count = 0;
+// end of label additions
+
+// parallel additions - a PARFOR splits its range into slices, each run by
+// an interpreter of its own that starts from a copy of the one at the PARFOR
+#define MAX_REDUCE 4
+struct parfor_slice {
+  struct ubasic_context const *parent;
+  char const *body;           // first statement of the body
+  char const *end;            // the NEXT ending it
+  int var;
+  VARIABLE_TYPE first;
+  long count;                 // iterations
+  int reduce_op[MAX_REDUCE];  // TOKENIZER_SUM, TOKENIZER_MIN or TOKENIZER_MAX
+  int reduce_var[MAX_REDUCE];
+  int reduce_count;
+  VARIABLE_TYPE result[MAX_REDUCE];
+  struct ubasic_error error;
+};
+static int workers = 1; // set by the host for every interpreter
+// end of parallel additions
+
+// call additions - host functions, and which one each CALL in the program runs
+#define MAX_FUNCTIONS 32
+#define MAX_NAMELEN   16
+#define MAX_CALL_ARGS 8
+struct host_function {
+  char name[MAX_NAMELEN + 1];
+  call_func fn;
+  int arity;
+  char types[MAX_CALL_ARGS + 2]; // result type, then one per argument
+};
+static struct host_function functions[MAX_FUNCTIONS]; // shared by every interpreter
+static int function_count = 0;
+struct call_site {
+  char const *program_text_position; // the function name
+  int function;                      // index into functions, -1 if not registered
+};
+static THREAD_LOCAL struct call_site *call_sites = NULL;
+static THREAD_LOCAL int call_site_count = 0;
+// end of call additions
+
+// superinstruction additions - the commonest statement shapes, decoded at
+// load time and run without the expression parser
+struct fused {
+  char const *program_text_position; // the first token of the statement
+  char const *next;                  // the statement after it
+  char const *target;                // where the GOTO of an IF goes
+  int kind;                          // UBASIC_FUSED_...
+  int var;
+  int op;                            // IF: relational token, LET: PLUS or MINUS
+  int a_var, b_var;                  // -1 when the operand is the constant a or b
+  VARIABLE_TYPE a, b;
+};
+static int fused_enabled = 1; // set by the host for every interpreter
+static THREAD_LOCAL struct fused *fused = NULL;
+static THREAD_LOCAL int fused_count = 0;
+static THREAD_LOCAL struct ubasic_fused_stats fused_stats;
+// end of superinstruction additions
+
+// optimizer additions - GOTO and GOSUB line numbers resolved at load time,
+// jumps that land on a GOTO sent on to its target, lines nothing reaches
+// left out of the program that runs
+#define MAX_THREAD_HOPS 16
+struct jump_line {
+  int line_number;
+  char const *program_text_position;
+};
+static int optimize_enabled = 1; // set by the host for every interpreter
+static THREAD_LOCAL int jumps_resolved = 0;          // line number jumps are in jump_targets
+static THREAD_LOCAL char *optimized_program = NULL;  // the program without its unreachable lines
+static THREAD_LOCAL struct ubasic_finding *findings = NULL;
+static THREAD_LOCAL int finding_count = 0;
+// end of optimizer additions
+
+// vm additions - each statement compiled at load time into code for a
+// register machine, the statements it cannot compile left to the tree walker
+struct vm_op {
+  unsigned char op;      // VM_...
+  unsigned char d, a, b; // registers
+  int x;                 // a register, token, line, print mode or instruction, by op
+  union {
+    VARIABLE_TYPE k;     // a constant operand
+    char const *pos;     // where the program continues
+    char *s;             // a string literal
+  } u;
+};
+struct vm_entry {
+  char const *program_text_position; // where ubasic_run() starts the statement
+  int code;                          // its first instruction
+};
+static int engine = UBASIC_ENGINE_TREE; // set by the host for every interpreter
+static THREAD_LOCAL struct vm_op *vm_code = NULL;
+static THREAD_LOCAL int vm_code_count = 0;
+static THREAD_LOCAL struct vm_entry *vm_entries = NULL;
+static THREAD_LOCAL int vm_entry_count = 0;
+static THREAD_LOCAL int vm_pc = -1; // entry to run next, -1 while the tokenizer has the position
+// end of vm additions
 
-static int ended;
+// context addition - everything above that belongs to one interpreter
+struct ubasic_context {
+  char const *program_ptr;
+  struct arena load_arena; // arena addition
+  struct arena run_arena;  // arena addition
+  struct tokenizer_state tokenizer;
+  char *stringbuffer;
+  int freebufptr;
+  int heap_size;
+  int heap_initial_size;
+  int heap_max_size;
+  int gc_policy;
+  int gc_threshold;
+  struct ubasic_heap_stats heap_stats;
+  unsigned long long heap_start_time;
+  int heap_last_used;
+  char *stringvariables[MAX_SVARNUM];
+  struct string_literal *literals;
+  int literal_count;
+  char *literal_pool;
+  char *literal_pool_end;
+  char *inputbuffer;
+  int inputstart;
+  int inputend;
+  int inputeof;
+  FILE *inputstream;
+  struct gosub_state gosub_stack[MAX_GOSUB_STACK_DEPTH];
+  int gosub_stack_ptr;
+  struct for_state for_stack[MAX_FOR_STACK_DEPTH];
+  int for_stack_ptr;
+  struct line_index *line_index_head;
+  struct line_index *line_index_current;
+  struct line_index **line_index_buckets; // scale addition
+  int line_index_bits;
+  int line_index_count;
+  char const *line_index_scanned;
+  struct line_index *line_index_free;
+  VARIABLE_TYPE variables[MAX_VARNUM];
+  int ended;
+  peek_func peek_function;
+  poke_func poke_function;
+  peek_async_func peek_async_function;
+  poke_async_func poke_async_function;
+  peek_block_func peek_block_function;
+  poke_block_func poke_block_function;
+  int pending;
+  int pending_var;
+  VARIABLE_TYPE pending_addr;
+  struct ubasic_error error_info;
+  int current_linenum;
+  int yield_time;
+  struct jump_target *jump_targets;
+  int jump_target_count;
+  char const **line_starts;
+  int line_count;
+  int fraction_bits;
+  struct call_site *call_sites;
+  int call_site_count;
+  struct replay_log *replay;
+  struct fused *fused;
+  int fused_count;
+  struct ubasic_fused_stats fused_stats;
+  int jumps_resolved;
+  char *optimized_program;
+  struct ubasic_finding *findings;
+  int finding_count;
+  struct vm_op *vm_code;
+  int vm_code_count;
+  struct vm_entry *vm_entries;
+  int vm_entry_count;
+  int vm_pc;
+};
+// end of context addition
 
 static VARIABLE_TYPE expr(void);
 static void line_statement(void);
 static void statement(void);
 
-static void index_free(void);
+// structured additions
+static void structure_init(const char *);
+static void statement_end(void);
+static char const* jump_find(char const *);
+// end of structured additions
+
+static void index_clear(void); // scale addition
+
+static int relation(void); // condition addition
+
+// call additions
+static void call_init(const char *);
+static union ubasic_value call_function(int);
+// end of call additions
+
+// superinstruction additions
+static void fuse_init(const char *);
+static int fused_statement(int);
+// end of superinstruction additions
+
+// optimizer additions
+static const char* optimize_init(const char *, int *);
+static void jump_init(const char *, int);
+static void jump_thread(const char *);
+static int optimize_line(const char *, char const *);
+// end of optimizer additions
+
+static void vm_init(const char *); // vm addition
 
-peek_func peek_function = NULL;
-poke_func poke_function = NULL;
+// fraction additions
+static VARIABLE_TYPE num_int(VARIABLE_TYPE);
+static VARIABLE_TYPE num_from_int(VARIABLE_TYPE);
+static VARIABLE_TYPE num_parse(char const *);
+static char* num_format(char *, VARIABLE_TYPE);
+#define NUM_FORMATLEN 32
+// end of fraction additions
+
+THREAD_LOCAL peek_func peek_function = NULL;
+THREAD_LOCAL poke_func poke_function = NULL;
+
+// async addition - set while a PEEK/POKE callback has not completed
+static THREAD_LOCAL peek_async_func peek_async_function = NULL;
+static THREAD_LOCAL poke_async_func poke_async_function = NULL;
+static THREAD_LOCAL int pending = 0;
+static THREAD_LOCAL int pending_var;          // variable a PEEK fills in, -1 for POKE
+static THREAD_LOCAL VARIABLE_TYPE pending_addr;
+static THREAD_LOCAL int async_calling = 0;    // inside a callback, which may resume at once
+static THREAD_LOCAL int async_resumed;
+static THREAD_LOCAL VARIABLE_TYPE async_value;
+// end of async addition
+
+// block addition
+static THREAD_LOCAL peek_block_func peek_block_function = NULL;
+static THREAD_LOCAL poke_block_func poke_block_function = NULL;
+// end of block addition
+
+// trace addition - a single test of trace_function when nobody is listening
+static THREAD_LOCAL trace_func trace_function = NULL;
+#define TRACE(event, arg1, arg2) \
+  do { if(trace_function != NULL) trace_function((event), (arg1), (arg2)); } while(0)
+// end of trace addition
+
+// profile additions - a sample of the clock and counters at each statement
+// and on entering and leaving each string function; the difference from
+// the one before goes to the token that was running
+#define PROFILE_KINDS (TOKENIZER_CR + 1)
+#define PROFILE_DEPTH 32                     // string functions within one another
+#define PROFILE_SAMPLE (1 + UBASIC_COUNTERS) // the time, then the counters
+static THREAD_LOCAL int profiling = 0;
+static THREAD_LOCAL int profile_open = 0;    // counters open, as 1 << UBASIC_COUNTER_...
+static THREAD_LOCAL struct ubasic_profile profile_kinds[PROFILE_KINDS];
+static THREAD_LOCAL int profile_current;     // token running, TOKENIZER_ERROR between runs
+static THREAD_LOCAL int profile_stack[PROFILE_DEPTH]; // tokens the functions were called from
+static THREAD_LOCAL int profile_depth;
+static THREAD_LOCAL unsigned long long profile_last[PROFILE_SAMPLE];
+static THREAD_LOCAL unsigned long long profile_cost[PROFILE_SAMPLE]; // of taking a sample
+#if PERF_COUNTERS
+static THREAD_LOCAL int profile_fd[UBASIC_COUNTERS];
+static THREAD_LOCAL int profile_leader = -1; // counter leading the group
+#endif
+#define PROFILE_BEGIN() \
+  do { if(profiling) profile_begin(); } while(0)
+#define PROFILE_END() \
+  do { if(profiling) profile_end(); } while(0)
+#define PROFILE_STATEMENT(token) \
+  do { if(profiling) profile_statement(token); } while(0)
+#define PROFILE_RESUME(token) \
+  do { if(profiling) profile_resume(token); } while(0)
+#define PROFILE_ENTER(token) \
+  do { if(profiling) profile_enter(token); } while(0)
+#define PROFILE_LEAVE() \
+  do { if(profiling) profile_leave(); } while(0)
+// end of profile additions
+
+// replay additions - every value that reaches the script from outside goes
+// through the log while recording and comes from it while replaying
+#define REPLAY_MAGIC "UBREPLY1"
+enum {
+  REPLAY_PEEK,    // value
+  REPLAY_BLOCK,   // count, values
+  REPLAY_LINE,    // string read by INPUT or LINE INPUT
+  REPLAY_NOLINE,  // INPUT or LINE INPUT at the end of the input
+  REPLAY_EOF,     // value of EOF
+  REPLAY_CALL,    // value
+  REPLAY_CALLSTR, // string
+  REPLAY_SET,     // statement, variable, value - set by the host
+  REPLAY_SETSTR,  // statement, variable, string - set by the host
+  REPLAY_END = -1,
+  REPLAY_UNREAD = -2
+};
+struct replay_log {
+  FILE *file;
+  int replaying;            // 0 while recording
+  unsigned long statements; // run since recording or replaying started
+  int next;                 // replaying: kind of the next entry
+  unsigned long next_at;    // replaying: statement a host set entry comes before
+  char text[INPUT_BUFFERLEN + 1];
+};
+static THREAD_LOCAL struct replay_log *replay = NULL; // NULL unless recording or replaying
+#define RECORDING (replay != NULL && !replay->replaying)
+#define REPLAYING (replay != NULL && replay->replaying)
+static void replay_statement(void);
+static void replay_put(int);
+static void replay_write(unsigned long long);
+static void replay_write_num(VARIABLE_TYPE);
+static void replay_write_str(char const *);
+static void replay_put_num(int, VARIABLE_TYPE);
+static void replay_put_str(int, char const *);
+static int replay_next(void);
+static void replay_get(int);
+static unsigned long long replay_read(void);
+static VARIABLE_TYPE replay_read_num(void);
+static char* replay_read_str(void);
+static VARIABLE_TYPE replay_get_num(int);
+static char* replay_get_str(int);
+static void set_variable(int, VARIABLE_TYPE);
+static void set_stringvariable(int, char *);
+// end of replay additions
 
 // string additions
 static const char nullstring[] = "\0"; 
 static void  var_init(void);
+static void  heap_init(void);
+static void  literal_init(const char *);
 static char* sexpr(void);
 static char* scpy(char *);
 static char* sconcat(char *, char *);
 static char* sleft(char *, int); 
 static char* sright(char *,int);
 static char* smid(char *, int, int);
-static char* sstr(int);
+static char* sstr(VARIABLE_TYPE);
 static char* schr(int);
 static int sinstr(int, char*, char*);
 // end of string additions
 
+// input additions
+static char* input_line(void);
+static int input_eof(void);
+// end of input additions
+
+// arena additions
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_HEADER   ARENA_ROUND(sizeof(struct arena_block))
+#define ARENA_DATA(b)  ((char *)(b) + ARENA_HEADER)
+/*---------------------------------------------------------------------------*/
+static void* arena_alloc(struct arena *a, size_t n) { // NULL if out of memory
+   struct arena_block *b = a->current;
+   struct arena_block *fresh;
+   size_t size;
+
+   n = ARENA_ROUND(n);
+   if (b == NULL || b->size - b->used < n) {
+      // on to the next block, or a new one before it if that is too small
+      if (b != NULL && b->next != NULL && b->next->size >= n) {
+         b = b->next;
+      } else {
+         size = b != NULL ? 2 * b->size : ARENA_BLOCK;
+         while (size < n)
+            size *= 2;
+         if ((fresh = malloc(ARENA_HEADER + size)) == NULL)
+            return NULL;
+         fresh->size = size;
+         if (b != NULL) {
+            fresh->next = b->next;
+            b->next = fresh;
+         } else {
+            fresh->next = NULL;
+            a->first = fresh;
+         }
+         b = fresh;
+      }
+      b->used = 0;
+      a->current = b;
+   }
+   b->used += n;
+   return ARENA_DATA(b) + b->used - n;
+}
+/*---------------------------------------------------------------------------*/
+static void* arena_grow(struct arena *a, void *p, size_t old, size_t n) {
+   // like realloc(), growing in place when p was the last allocation;
+   // otherwise the old copy stays where it is until the arena is rewound
+   struct arena_block *b = a->current;
+   char *q;
+
+   old = ARENA_ROUND(old);
+   n = ARENA_ROUND(n);
+   if (p != NULL && old > 0 && b != NULL && (char *)p + old == ARENA_DATA(b) + b->used &&
+       (size_t)((char *)p - ARENA_DATA(b)) + n <= b->size) {
+      b->used = (char *)p - ARENA_DATA(b) + n;
+      return p;
+   }
+   if ((q = arena_alloc(a, n)) != NULL && p != NULL)
+      memcpy(q, p, old < n ? old : n);
+   return q;
+}
+/*---------------------------------------------------------------------------*/
+static struct arena_mark arena_save(struct arena *a) { // where arena_restore() rewinds to
+   struct arena_mark mark;
+
+   mark.block = a->current;
+   mark.used = a->current != NULL ? a->current->used : 0;
+   return mark;
+}
+/*---------------------------------------------------------------------------*/
+static void arena_restore(struct arena *a, struct arena_mark mark) { // give back what came after mark
+   a->current = mark.block != NULL ? mark.block : a->first;
+   if (a->current != NULL)
+      a->current->used = mark.used;
+}
+/*---------------------------------------------------------------------------*/
+static void arena_reset(struct arena *a) { // give back everything, keeping the blocks
+   a->current = a->first;
+   if (a->current != NULL)
+      a->current->used = 0;
+}
+/*---------------------------------------------------------------------------*/
+static void arena_free(struct arena *a) {
+   struct arena_block *b, *next;
+
+   for (b = a->first; b != NULL; b = next) {
+      next = b->next;
+      free(b);
+   }
+   a->first = a->current = NULL;
+}
+// end of arena additions
+// scale addition
+/*---------------------------------------------------------------------------*/
+long ubasic_memory(void) {
+   struct arena_block *b;
+   long bytes = inputbuffer != NULL ? INPUT_BUFFERLEN + 1 : 0;
+
+   for (b = load_arena.first; b != NULL; b = b->next)
+      bytes += ARENA_HEADER + b->size;
+   for (b = run_arena.first; b != NULL; b = b->next)
+      bytes += ARENA_HEADER + b->size;
+   return bytes;
+}
+// end of scale addition
+
+// context additions
+/*---------------------------------------------------------------------------*/
+struct ubasic_context *ubasic_context_new(void){
+  struct ubasic_context *ctx;
+
+  ctx = calloc(1, sizeof(struct ubasic_context));
+  if(ctx != NULL) {
+    // host bindings and settings are inherited from the running interpreter
+    ctx->heap_initial_size = heap_initial_size;
+    ctx->heap_max_size = heap_max_size;
+    ctx->gc_policy = gc_policy;
+    ctx->gc_threshold = gc_threshold;
+    ctx->peek_function = peek_function;
+    ctx->poke_function = poke_function;
+    ctx->peek_async_function = peek_async_function;
+    ctx->poke_async_function = poke_async_function;
+    ctx->peek_block_function = peek_block_function;
+    ctx->poke_block_function = poke_block_function;
+    ctx->ended = 1; // nothing to run until ubasic_init()
+    ctx->yield_time = -1;
+  }
+  return ctx;
+}
+/*---------------------------------------------------------------------------*/
+void ubasic_context_free(struct ubasic_context *ctx){
+  if(ctx == NULL) {
+    return;
+  }
+  arena_free(&ctx->load_arena); // arena addition - the tables, line index and strings
+  arena_free(&ctx->run_arena);
+  free(ctx->inputbuffer);
+  free(ctx->replay); // replay addition - the log file stays the host's
+  free(ctx);
+}
+/*---------------------------------------------------------------------------*/
+void ubasic_context_save(struct ubasic_context *ctx){
+  ctx->program_ptr = program_ptr;
+  ctx->load_arena = load_arena; // arena addition
+  ctx->run_arena = run_arena;   // arena addition
+  tokenizer_save(&ctx->tokenizer);
+  ctx->stringbuffer = stringbuffer;
+  ctx->freebufptr = freebufptr;
+  ctx->heap_size = heap_size;
+  ctx->heap_initial_size = heap_initial_size;
+  ctx->heap_max_size = heap_max_size;
+  ctx->gc_policy = gc_policy;
+  ctx->gc_threshold = gc_threshold;
+  ctx->heap_stats = heap_stats;
+  ctx->heap_start_time = heap_start_time;
+  ctx->heap_last_used = heap_last_used;
+  memcpy(ctx->stringvariables, stringvariables, sizeof(ctx->stringvariables));
+  ctx->literals = literals;
+  ctx->literal_count = literal_count;
+  ctx->literal_pool = literal_pool;
+  ctx->literal_pool_end = literal_pool_end;
+  ctx->inputbuffer = inputbuffer;
+  ctx->inputstart = inputstart;
+  ctx->inputend = inputend;
+  ctx->inputeof = inputeof;
+  ctx->inputstream = inputstream;
+  memcpy(ctx->gosub_stack, gosub_stack, sizeof(gosub_stack));
+  ctx->gosub_stack_ptr = gosub_stack_ptr;
+  memcpy(ctx->for_stack, for_stack, sizeof(for_stack));
+  ctx->for_stack_ptr = for_stack_ptr;
+  ctx->line_index_head = line_index_head;
+  ctx->line_index_current = line_index_current;
+  ctx->line_index_buckets = line_index_buckets; // scale addition
+  ctx->line_index_bits = line_index_bits;
+  ctx->line_index_count = line_index_count;
+  ctx->line_index_scanned = line_index_scanned;
+  ctx->line_index_free = line_index_free;
+  memcpy(ctx->variables, variables, sizeof(ctx->variables));
+  ctx->ended = ended;
+  ctx->peek_function = peek_function;
+  ctx->poke_function = poke_function;
+  ctx->peek_async_function = peek_async_function;
+  ctx->poke_async_function = poke_async_function;
+  ctx->peek_block_function = peek_block_function;
+  ctx->poke_block_function = poke_block_function;
+  ctx->pending = pending;
+  ctx->pending_var = pending_var;
+  ctx->pending_addr = pending_addr;
+  ctx->error_info = error_info;
+  ctx->current_linenum = current_linenum;
+  ctx->yield_time = yield_time;
+  ctx->jump_targets = jump_targets;
+  ctx->jump_target_count = jump_target_count;
+  ctx->line_starts = line_starts;
+  ctx->line_count = line_count;
+  ctx->fraction_bits = fraction_bits;
+  ctx->call_sites = call_sites;
+  ctx->call_site_count = call_site_count;
+  ctx->replay = replay;
+  ctx->fused = fused;
+  ctx->fused_count = fused_count;
+  ctx->fused_stats = fused_stats;
+  ctx->jumps_resolved = jumps_resolved;
+  ctx->optimized_program = optimized_program;
+  ctx->findings = findings;
+  ctx->finding_count = finding_count;
+  ctx->vm_code = vm_code;
+  ctx->vm_code_count = vm_code_count;
+  ctx->vm_entries = vm_entries;
+  ctx->vm_entry_count = vm_entry_count;
+  ctx->vm_pc = vm_pc;
+}
+/*---------------------------------------------------------------------------*/
+void ubasic_context_load(const struct ubasic_context *ctx){
+  program_ptr = ctx->program_ptr;
+  load_arena = ctx->load_arena; // arena addition
+  run_arena = ctx->run_arena;   // arena addition
+  tokenizer_load(&ctx->tokenizer);
+  stringbuffer = ctx->stringbuffer;
+  freebufptr = ctx->freebufptr;
+  heap_size = ctx->heap_size;
+  heap_initial_size = ctx->heap_initial_size;
+  heap_max_size = ctx->heap_max_size;
+  gc_policy = ctx->gc_policy;
+  gc_threshold = ctx->gc_threshold;
+  heap_stats = ctx->heap_stats;
+  heap_start_time = ctx->heap_start_time;
+  heap_last_used = ctx->heap_last_used;
+  memcpy(stringvariables, ctx->stringvariables, sizeof(ctx->stringvariables));
+  literals = ctx->literals;
+  literal_count = ctx->literal_count;
+  literal_pool = ctx->literal_pool;
+  literal_pool_end = ctx->literal_pool_end;
+  inputbuffer = ctx->inputbuffer;
+  inputstart = ctx->inputstart;
+  inputend = ctx->inputend;
+  inputeof = ctx->inputeof;
+  inputstream = ctx->inputstream;
+  memcpy(gosub_stack, ctx->gosub_stack, sizeof(gosub_stack));
+  gosub_stack_ptr = ctx->gosub_stack_ptr;
+  memcpy(for_stack, ctx->for_stack, sizeof(for_stack));
+  for_stack_ptr = ctx->for_stack_ptr;
+  line_index_head = ctx->line_index_head;
+  line_index_current = ctx->line_index_current;
+  line_index_buckets = ctx->line_index_buckets; // scale addition
+  line_index_bits = ctx->line_index_bits;
+  line_index_count = ctx->line_index_count;
+  line_index_scanned = ctx->line_index_scanned;
+  line_index_free = ctx->line_index_free;
+  memcpy(variables, ctx->variables, sizeof(ctx->variables));
+  ended = ctx->ended;
+  peek_function = ctx->peek_function;
+  poke_function = ctx->poke_function;
+  peek_async_function = ctx->peek_async_function;
+  poke_async_function = ctx->poke_async_function;
+  peek_block_function = ctx->peek_block_function;
+  poke_block_function = ctx->poke_block_function;
+  pending = ctx->pending;
+  pending_var = ctx->pending_var;
+  pending_addr = ctx->pending_addr;
+  error_info = ctx->error_info;
+  current_linenum = ctx->current_linenum;
+  yield_time = ctx->yield_time;
+  jump_targets = ctx->jump_targets;
+  jump_target_count = ctx->jump_target_count;
+  line_starts = ctx->line_starts;
+  line_count = ctx->line_count;
+  fraction_bits = ctx->fraction_bits;
+  call_sites = ctx->call_sites;
+  call_site_count = ctx->call_site_count;
+  replay = ctx->replay;
+  fused = ctx->fused;
+  fused_count = ctx->fused_count;
+  fused_stats = ctx->fused_stats;
+  jumps_resolved = ctx->jumps_resolved;
+  optimized_program = ctx->optimized_program;
+  findings = ctx->findings;
+  finding_count = ctx->finding_count;
+  vm_code = ctx->vm_code;
+  vm_code_count = ctx->vm_code_count;
+  vm_entries = ctx->vm_entries;
+  vm_entry_count = ctx->vm_entry_count;
+  vm_pc = ctx->vm_pc;
+}
+// end of context additions
 /*---------------------------------------------------------------------------*/
 void ubasic_init(const char *program){
+  int structured; // optimizer addition
+
+  // arena addition - everything the last program had goes at once
+  arena_reset(&load_arena);
+  arena_reset(&run_arena);
+  line_index_head = line_index_current = NULL;
+  // end of arena addition
+  index_clear(); // scale addition
+  error_info.kind = UBASIC_ERROR_NONE; // error addition - structure_init() may set it
+  program = optimize_init(program, &structured); // optimizer addition
   program_ptr = program;
   for_stack_ptr = gosub_stack_ptr = 0;
-  index_free();
+  literal_init(program); // string addition
+  // optimizer addition - unless optimize_init() already has
+  if(!structured) {
+    structure_init(program); // structured addition
+    jump_init(program, 0);
+  }
+  jump_thread(program);
+  // end of optimizer addition
+  call_init(program); // call addition
+  fuse_init(program); // superinstruction addition
+  vm_init(program); // vm addition
   tokenizer_init(program);
   var_init(); // string addition
-  ended = 0;
+  ended = error_info.kind != UBASIC_ERROR_NONE; // error addition - nothing runs if it did not load
+  current_linenum = 0;
+  yield_time = -1; // scheduler addition
+  pending = 0; // async addition
 }
 /*---------------------------------------------------------------------------*/
 void ubasic_init_peek_poke(const char *program, peek_func peek, poke_func poke){
-  program_ptr = program;
-  for_stack_ptr = gosub_stack_ptr = 0;
-  index_free();
   peek_function = peek;
   poke_function = poke;
-  tokenizer_init(program);
-  ended = 0;
+  ubasic_init(program);
+}
+/*---------------------------------------------------------------------------*/
+unsigned long long ubasic_clock(void){
+#ifdef _WIN32
+  LARGE_INTEGER f, c;
+  QueryPerformanceFrequency(&f);
+  QueryPerformanceCounter(&c);
+  return (c.QuadPart / f.QuadPart) * 1000000000ULL +
+         (c.QuadPart % f.QuadPart) * 1000000000ULL / f.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+void ubasic_set_trace(trace_func trace){
+  trace_function = trace;
+}
+// profile additions
+/*---------------------------------------------------------------------------*/
+static void profile_read(unsigned long long *sample)
+{
+  // the time, then each counter open (the others are left alone)
+#if PERF_COUNTERS
+  unsigned long long values[3 + UBASIC_COUNTERS]; // count, time enabled and running, values
+  int c, i = 3;
+#endif
+
+  sample[0] = ubasic_clock();
+#if PERF_COUNTERS
+  if(profile_open != 0 &&
+     read(profile_fd[profile_leader], values, sizeof(values)) > 0) {
+    for(c = 0; c < UBASIC_COUNTERS; c++) {
+      if(profile_open & 1 << c) {
+        sample[1 + c] = values[i++];
+      }
+    }
+  }
+#endif
+}
+/*---------------------------------------------------------------------------*/
+static void profile_sample(void)
+{
+  // add what was used since the last sample to the token running
+  struct ubasic_profile *p = profile_kinds + profile_current;
+  unsigned long long now[PROFILE_SAMPLE];
+  unsigned long long d;
+  int c;
+
+  memset(now, 0, sizeof(now));
+  profile_read(now);
+  d = now[0] - profile_last[0];
+  p->time += d > profile_cost[0] ? d - profile_cost[0] : 0;
+  for(c = 0; c < UBASIC_COUNTERS; c++) {
+    d = now[1 + c] - profile_last[1 + c];
+    p->counters[c] += d > profile_cost[1 + c] ? d - profile_cost[1 + c] : 0;
+  }
+  memcpy(profile_last, now, sizeof(now));
+}
+/*---------------------------------------------------------------------------*/
+static void profile_begin(void)
+{
+  // ubasic_run() starts, after whatever the host did
+  memset(profile_last, 0, sizeof(profile_last));
+  profile_read(profile_last);
+  profile_current = TOKENIZER_ERROR;
+  profile_depth = 0; // an error may have left functions behind
+}
+/*---------------------------------------------------------------------------*/
+static void profile_end(void)
+{
+  profile_sample();
+  profile_current = TOKENIZER_ERROR; // never reported
+}
+/*---------------------------------------------------------------------------*/
+static void profile_resume(int token)
+{
+  // token runs from here on, without starting again
+  profile_sample();
+  profile_current = token;
+}
+/*---------------------------------------------------------------------------*/
+static void profile_statement(int token)
+{
+  profile_resume(token);
+  profile_kinds[token].count++;
+}
+/*---------------------------------------------------------------------------*/
+static void profile_enter(int token)
+{
+  profile_sample();
+  if(profile_depth < PROFILE_DEPTH) {
+    profile_stack[profile_depth] = profile_current;
+  }
+  profile_depth++;
+  profile_current = token;
+  profile_kinds[token].count++;
+}
+/*---------------------------------------------------------------------------*/
+static void profile_leave(void)
+{
+  profile_sample();
+  if(profile_depth > 0 && --profile_depth < PROFILE_DEPTH) {
+    profile_current = profile_stack[profile_depth];
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void profile_close(void)
+{
+#if PERF_COUNTERS
+  int c;
+
+  for(c = 0; c < UBASIC_COUNTERS; c++) {
+    if(profile_open & 1 << c) {
+      close(profile_fd[c]);
+    }
+  }
+  profile_leader = -1;
+#endif
+  profile_open = 0;
+}
+/*---------------------------------------------------------------------------*/
+#if PERF_COUNTERS
+static void profile_counters(void)
+{
+  // open the counters the system has and allows, as one group so that a
+  // single read() samples them all
+  static const struct {
+    unsigned int type;
+    unsigned long long config;
+  } events[UBASIC_COUNTERS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                         PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                         PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES}
+  };
+  struct perf_event_attr attr;
+  unsigned long long values[3 + UBASIC_COUNTERS];
+  int c;
+
+  for(c = 0; c < UBASIC_COUNTERS; c++) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[c].type;
+    attr.config = events[c].config;
+    attr.disabled = profile_leader < 0;
+    attr.exclude_kernel = 1; // nor the reads themselves
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    profile_fd[c] = syscall(SYS_perf_event_open, &attr, 0, -1,
+                            profile_leader < 0 ? -1 : profile_fd[profile_leader], 0);
+    if(profile_fd[c] >= 0) {
+      if(profile_leader < 0) {
+        profile_leader = c;
+      }
+      profile_open |= 1 << c;
+    }
+  }
+  if(profile_open == 0) {
+    return;
+  }
+  ioctl(profile_fd[profile_leader], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(profile_fd[profile_leader], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  // a group the processor cannot count all at once never runs
+  if(read(profile_fd[profile_leader], values, sizeof(values)) <= 0 || values[2] == 0) {
+    profile_close();
+  }
+}
+#endif
+/*---------------------------------------------------------------------------*/
+int ubasic_set_profile(int on)
+{
+  unsigned long long now[PROFILE_SAMPLE];
+  int c, i;
+
+  profile_close();
+  memset(profile_kinds, 0, sizeof(profile_kinds));
+  memset(profile_cost, 0, sizeof(profile_cost));
+  profiling = on;
+  if(!on) {
+    return 0;
+  }
+#if PERF_COUNTERS
+  profile_counters();
+#endif
+  // what a sample costs, taken off every one
+  memset(now, 0, sizeof(now));
+  profile_read(now);
+  for(i = 0; i < 64; i++) {
+    memcpy(profile_last, now, sizeof(now));
+    profile_read(now);
+    for(c = 0; c < PROFILE_SAMPLE; c++) {
+      if(i == 0 || now[c] - profile_last[c] < profile_cost[c]) {
+        profile_cost[c] = now[c] - profile_last[c];
+      }
+    }
+  }
+  profile_current = TOKENIZER_ERROR;
+  return profile_open;
+}
+/*---------------------------------------------------------------------------*/
+int ubasic_profile(struct ubasic_profile *list, int max)
+{
+  int i, c, n = 0;
+
+  for(i = 0; i < PROFILE_KINDS; i++) {
+    if(profile_kinds[i].count == 0) {
+      continue;
+    }
+    if(n < max) {
+      list[n] = profile_kinds[i];
+      list[n].token = i;
+      for(c = 0; c < UBASIC_COUNTERS; c++) {
+        if(!(profile_open & 1 << c)) {
+          list[n].counters[c] = -1;
+        }
+      }
+    }
+    n++;
+  }
+  return n;
+}
+// end of profile additions
+/*---------------------------------------------------------------------------*/
+static void basic_error(int kind, int expected){
+  error_info.kind = kind;
+  error_info.line = current_linenum;
+  error_info.expected = expected;
+  error_info.found = tokenizer_token();
+  ended = 1;
+  longjmp(error_jmp, kind);
+}
+/*---------------------------------------------------------------------------*/
+int ubasic_error(struct ubasic_error *error){
+  if(error != NULL) {
+    *error = error_info;
+  }
+  return error_info.kind;
 }
 /*---------------------------------------------------------------------------*/
 static void accept(int token){
@@ -140,7 +1118,7 @@ static void accept(int token){
                 tokenizer_token_name(token),
 				tokenizer_token_name(tokenizer_token()));
     tokenizer_error_print();
-    exit(1);
+    basic_error(UBASIC_ERROR_SYNTAX, token);
   }
   DEBUG_PRINTF("accept: Expected '%s', got it.\n", tokenizer_token_name(token));
   tokenizer_next();
@@ -150,48 +1128,193 @@ static void accept(int token){
 /*---------------------------------------------------------------------------*/
 static void var_init() {
    int i;
-   freebufptr = 0;
+   heap_init();
    for (i=0; i<MAX_VARNUM; i++) 
       variables[i] = 0;
    for (i=0; i<MAX_SVARNUM; i++) 
-	  stringvariables[i] = scpy(nullstring);
+	  stringvariables[i] = (char *)nullstring;
+}
+/*---------------------------------------------------------------------------*/
+static void literal_init(const char *program) {
+   // copy every string literal into one read-only pool, once, so that
+   // expressions and PRINT can use them in place; each keeps up to
+   // MAX_STRINGVARLEN (255) characters, as much as a string variable holds
+   int n = 0;
+   int bytes = 0;
+   int l;
+   char *p;
+
+   literals = NULL;
+   literal_count = 0;
+   tokenizer_init(program);
+   while (!tokenizer_finished()) {
+      if (tokenizer_token() == TOKENIZER_STRING) {
+         l = tokenizer_string_len();
+         n++;
+         bytes += (l < MAX_STRINGVARLEN ? l : MAX_STRINGVARLEN) + 1;
+      }
+      tokenizer_next();
+   }
+   if (n == 0)
+      return;
+   literals = arena_alloc(&load_arena, n * sizeof(struct string_literal) + bytes);
+   p = literal_pool = (char *)(literals + n);
+   literal_pool_end = literal_pool + bytes;
+   tokenizer_init(program);
+   while (!tokenizer_finished()) {
+      if (tokenizer_token() == TOKENIZER_STRING) {
+         literals[literal_count].program_text_position = tokenizer_pos();
+         literals[literal_count].string = p;
+         tokenizer_string(p, MAX_STRINGVARLEN);
+         p += strlen(p) + 1;
+         literal_count++;
+      }
+      tokenizer_next();
+   }
+}
+/*---------------------------------------------------------------------------*/
+static char* sliteral(void) { // return the pooled copy of the current string literal
+   int lo = 0;
+   int hi = literal_count - 1;
+   int mid;
+   char const *pos = tokenizer_pos();
+   while (lo <= hi) {
+      mid = (lo + hi) / 2;
+      if (literals[mid].program_text_position == pos)
+         return literals[mid].string;
+      if (literals[mid].program_text_position < pos)
+         lo = mid + 1;
+      else
+         hi = mid - 1;
+   }
+   return (char *)nullstring;
+}
+/*---------------------------------------------------------------------------*/
+static int sconst(char *s) { // return true if s is never moved or freed
+   return s == nullstring || (s >= literal_pool && s < literal_pool_end);
+}
+/*---------------------------------------------------------------------------*/
+void ubasic_heap_config(int initial_size, int max_size, int policy, int threshold) {
+   heap_initial_size = initial_size > 0 ? initial_size : MAX_BUFFERLEN;
+   heap_max_size = max_size > heap_initial_size ? max_size : heap_initial_size;
+   gc_policy = policy;
+   gc_threshold = threshold;
+}
+/*---------------------------------------------------------------------------*/
+void ubasic_heap_stats(struct ubasic_heap_stats *stats) {
+   double elapsed = (ubasic_clock() - heap_start_time) / 1e9;
+   *stats = heap_stats;
+   stats->heap_size = heap_size;
+   stats->bytes_allocated += freebufptr - heap_last_used;
+   stats->allocation_rate = elapsed > 0 ? stats->bytes_allocated / elapsed : 0;
+}
+/*---------------------------------------------------------------------------*/
+static void heap_init(void) {
+   stringbuffer = arena_alloc(&run_arena, heap_initial_size); // arena addition
+   heap_size = stringbuffer != NULL ? heap_initial_size : 0;
+   freebufptr = 0;
+   heap_last_used = 0;
+   memset(&heap_stats, 0, sizeof(heap_stats));
+   heap_start_time = ubasic_clock();
+}
+/*---------------------------------------------------------------------------*/
+static int gc_due(void) { // return true if the collection policy calls for a collection
+   switch (gc_policy) {
+      case UBASIC_GC_RATIO:
+         if (freebufptr * 100 >= heap_size * gc_threshold)
+            return 1;
+         break;
+      case UBASIC_GC_ADAPTIVE:
+         break;
+      default:
+         if (freebufptr >= gc_threshold)
+            return 1;
+         break;
+   }
+   // never let a statement start without room to work in
+   return freebufptr >= heap_size - (heap_size / 4 < GBGHEADROOM ? heap_size / 4 : GBGHEADROOM);
 }
 /*---------------------------------------------------------------------------*/
 int string_space_check(int l) {
    // returns true if not enough room for new string
    int i;
-   i = ((MAX_BUFFERLEN - freebufptr) <= (l + 2)); // +2 to play it safe
+   i = ((heap_size - freebufptr) <= (l + 2)); // +2 to play it safe
    if (i) {
-      ended = 1;
+      basic_error(UBASIC_ERROR_MEMORY, TOKENIZER_ERROR);
    }
    return i;
 }
 /*---------------------------------------------------------------------------*/
 void garbage_collect() {
+  // strings are compacted into a fresh buffer, which is also when the
+  // heap grows: if more than half of it is still live after a collection
+  // (a quarter for the adaptive policy) it doubles, up to heap_max_size
   int totused = 0;
+  int inuse;
+  int size;
   int i;
   char *temp;
   char *tp;
-  if (freebufptr < GBGCHECK)
+  struct arena_mark mark; // arena addition
+  unsigned long long start;
+  if (freebufptr > heap_stats.peak_occupancy)
+     heap_stats.peak_occupancy = freebufptr;
+  if (!gc_due())
      return;
+  start = ubasic_clock();
   for (i=0; i< MAX_SVARNUM; i++) { // calculate used space
-     totused += strlen(stringvariables[i]) + 1;
+     if (!sconst(stringvariables[i]))
+        totused += strlen(stringvariables[i]) + 1;
   }
   DEBUG_PRINTF("Garbage collector called - reclaiming %d bytes\n", (freebufptr - totused));
-  temp = malloc(totused);	// alloc temporary space to store vars
-  tp = temp;
-  for (i=0; i< MAX_SVARNUM; i++) { // copy used strings to temporary store
-     strcpy(tp, stringvariables[i]);
-	 tp += strlen(tp) + 1;
-  }
-  freebufptr = 0;
-  tp = temp;
-  for (i=0; i< MAX_SVARNUM; i++) { //copy back to buffer
-     stringvariables[i] = scpy(tp);
-	 tp+= strlen(tp) + 1;
+  TRACE(UBASIC_TRACE_GC_START, freebufptr, 0);
+  inuse = freebufptr;
+  size = heap_size;
+  while (size < heap_max_size &&
+         totused > (gc_policy == UBASIC_GC_ADAPTIVE ? size / 4 : size / 2))
+     size *= 2;
+  if (size > heap_max_size)
+     size = heap_max_size;
+  // arena addition - a bigger heap comes from the arena and the strings
+  // are copied straight into it, the old one going when the arena is
+  // rewound; otherwise they go through scratch space given back after
+  mark = arena_save(&run_arena);
+  if (size != heap_size && (tp = arena_alloc(&run_arena, size)) != NULL) {
+     DEBUG_PRINTF("Garbage collector growing string space to %d bytes\n", size);
+     stringbuffer = tp;
+     heap_size = size;
+     freebufptr = 0;
+     for (i=0; i< MAX_SVARNUM; i++) {
+        if (!sconst(stringvariables[i]))
+           stringvariables[i] = scpy(stringvariables[i]);
+     }
+  } else {
+     if ((temp = arena_alloc(&run_arena, totused)) == NULL)
+        return; // no room to compact, try again at the next statement
+     tp = temp;
+     for (i=0; i< MAX_SVARNUM; i++) { // copy used strings to temporary store
+        if (sconst(stringvariables[i]))
+           continue;
+        strcpy(tp, stringvariables[i]);
+        tp += strlen(tp) + 1;
+     }
+     freebufptr = 0;
+     tp = temp;
+     for (i=0; i< MAX_SVARNUM; i++) { //copy back to buffer
+        if (sconst(stringvariables[i]))
+           continue;
+        stringvariables[i] = scpy(tp);
+        tp+= strlen(tp) + 1;
+     }
+     arena_restore(&run_arena, mark);
   }
-  
-  free(temp); // free temp space
+  // end of arena addition
+  heap_stats.collections++;
+  heap_stats.bytes_reclaimed += inuse - freebufptr;
+  heap_stats.bytes_allocated += inuse - heap_last_used;
+  heap_stats.pause_time += (ubasic_clock() - start) / 1e9;
+  heap_last_used = freebufptr;
+  TRACE(UBASIC_TRACE_GC_END, freebufptr, inuse - freebufptr);
  }
 /*---------------------------------------------------------------------------*/
 static char* scpy(char *s1) { // return a copy of s1
@@ -283,12 +1406,14 @@ static char* smid(char *s1, int l1, int l2) { // return the l2 chars of s1 start
    int rp = bp;
    int i, j;
    j = strlen(s1);
+   if (l1<1) // a start before the string starts at its first character
+      l1 = 1;
    if (l2<1 || l1>j) 
       return scpy(nullstring);
    if (string_space_check(l2))
       return nullstring;
-   if (l2 > j-l1)
-     l2 = j-l1;
+   if (l2 > j-l1+1) // up to and including the last character
+     l2 = j-l1+1;
    for (i=l1; i<l1+l2; i++) {
       *(stringbuffer + bp) = *(s1 + l1 -1);
       bp++;
@@ -299,12 +1424,12 @@ static char* smid(char *s1, int l1, int l2) { // return the l2 chars of s1 start
    return stringbuffer + rp;
 }
 /*---------------------------------------------------------------------------*/
-static char* sstr(int j) { // return the integer j as a string
+static char* sstr(VARIABLE_TYPE j) { // return the number j as a string
    int bp = freebufptr;
    int rp = bp;
-   if (string_space_check(10))
+   if (string_space_check(NUM_FORMATLEN))
       return nullstring;
-   sprintf((stringbuffer+bp),"%d",j);
+   num_format(stringbuffer+bp, j);
    freebufptr = bp + strlen(stringbuffer+bp) + 1;
    return stringbuffer + rp;
 }
@@ -321,9 +1446,61 @@ static char* schr(int j) { // return the character whose ASCII code is j
    return stringbuffer + rp;
 }
 /*---------------------------------------------------------------------------*/
-static int sinstr(int j, char *s, char *s1) { // return the position of s1 in s (or 0) 
+static char* ssearch(char *s, int sl, char *s1, int s1l) { // return the first s1 in s (or NULL)
+   // candidates are positions where both the first and the last byte of
+   // s1 match, only those are compared in full
+   char *p;
+   int i = 0;
+   int last = s1l - 1;
+   if (s1l == 0)
+      return s;
+#if SSE2_SEARCH
+   {
+      __m128i first = _mm_set1_epi8(*s1);
+      __m128i final = _mm_set1_epi8(*(s1 + last));
+      unsigned mask;
+      int bit;
+      for (; i + last + 16 <= sl; i += 16) {
+         mask = _mm_movemask_epi8(_mm_and_si128(
+                   _mm_cmpeq_epi8(first, _mm_loadu_si128((__m128i const *)(s + i))),
+                   _mm_cmpeq_epi8(final, _mm_loadu_si128((__m128i const *)(s + i + last)))));
+         for (bit = 0; mask != 0; bit++, mask >>= 1) {
+            if ((mask & 1) && memcmp(s + i + bit, s1, s1l) == 0)
+               return s + i + bit;
+         }
+      }
+   }
+#endif
+   for (; i + last < sl; i++) {
+      p = memchr(s + i, *s1, sl - last - i);
+      if (p == NULL)
+         return NULL;
+      i = p - s;
+      if (*(p + last) == *(s1 + last) && memcmp(p, s1, s1l) == 0)
+         return p;
+   }
+   return NULL;
+}
+/*---------------------------------------------------------------------------*/
+static char* sfromvalues(VARIABLE_TYPE *v, int n) { // return the values v as characters, up to the first 0
+   int bp = freebufptr;
+   int i;
+   if (string_space_check(n))
+      return nullstring;
+   for (i=0; i<n && v[i] != 0; i++)
+      *(stringbuffer + bp + i) = (char)v[i];
+   *(stringbuffer + bp + i) = '\0';
+   freebufptr = bp + i + 1;
+   return stringbuffer + bp;
+}
+/*---------------------------------------------------------------------------*/
+static int sinstr(int j, char *s, char *s1) { // return the position of s1 in s (or 0) searching from position j
    char *p;
-   p = strstr(s+j, s1);
+   int l;
+   l = strlen(s);
+   if (j > l)
+      return 0;
+   p = ssearch(s + j - 1, l - j + 1, s1, strlen(s1));
    if (p == NULL)
       return 0;
    return (p - s + 1);
@@ -339,55 +1516,67 @@ static int sinstr(int j, char *s, char *s1) { // return the position of s1 in s
 		  accept(TOKENIZER_RIGHTPAREN);
 		  break;
 	   case TOKENIZER_STRING:
-	      tokenizer_string(string, sizeof(string));
-		  r= scpy(string);
+		  r = sliteral();
   	      accept(TOKENIZER_STRING);
 	      break;
  	case TOKENIZER_LEFT$:
+	      PROFILE_ENTER(TOKENIZER_LEFT$); // profile addition
 	      accept(TOKENIZER_LEFT$);
 		  accept(TOKENIZER_LEFTPAREN);
           s = sexpr();
 		  accept(TOKENIZER_COMMA);
-		  i = expr();
+		  i = num_int(expr());
 		  r = sleft(s,i);
 		  accept(TOKENIZER_RIGHTPAREN);
+		  PROFILE_LEAVE();
           break;
 	case TOKENIZER_RIGHT$:
+	      PROFILE_ENTER(TOKENIZER_RIGHT$);
 	      accept(TOKENIZER_RIGHT$);
 		  accept(TOKENIZER_LEFTPAREN);
 		  s = sexpr();
 		  accept(TOKENIZER_COMMA);
-		  i = expr();
+		  i = num_int(expr());
 		  r = sright(s,i);
 		  accept(TOKENIZER_RIGHTPAREN);
+		  PROFILE_LEAVE();
           break;
 	case TOKENIZER_MID$:
+	      PROFILE_ENTER(TOKENIZER_MID$);
 	      accept(TOKENIZER_MID$);
 		  accept(TOKENIZER_LEFTPAREN);
 		  s = sexpr();
 		  accept(TOKENIZER_COMMA);
-		  i = expr();
+		  i = num_int(expr());
 		  if (tokenizer_token() == TOKENIZER_COMMA) {
 		     accept(TOKENIZER_COMMA);
-			 j = expr();
+			 j = num_int(expr());
 		  } else {
 		     j = 999; // ensure we get all of it
 		  }
 		  r = smid(s,i,j);
 		  accept(TOKENIZER_RIGHTPAREN);
+		  PROFILE_LEAVE();
           break;
     case TOKENIZER_STR$:
+	      PROFILE_ENTER(TOKENIZER_STR$);
 	      accept(TOKENIZER_STR$);
-	      j = expr();
-		  r = sstr(j);
+		  r = sstr(expr());
+		  PROFILE_LEAVE();
 	      break;
 	case TOKENIZER_CHR$:
+	     PROFILE_ENTER(TOKENIZER_CHR$);
 	     accept(TOKENIZER_CHR$);
-		 j = expr();
+		 j = num_int(expr());
 		 if (j<0 || j>255)
 		    j = 0;
 		 r = schr(j);
+		 PROFILE_LEAVE();
 		 break;
+	case TOKENIZER_CALL: // call addition
+	     r = (char *)call_function('s').str;
+	     r = r != NULL ? scpy(r) : (char *)nullstring;
+	     break;
 	default:	  
 		  r = ubasic_get_stringvariable(tokenizer_variable_num());
 	      accept(TOKENIZER_STRINGVARIABLE);
@@ -424,44 +1613,300 @@ static int slogexpr() { // string logical expression
 	     s2 = sexpr();
 	     r = (strcmp(s1,s2) == 0);
 		 break;
+      case TOKENIZER_LT:
+	     if (tokenizer_token() == TOKENIZER_GT) {
+	        tokenizer_next();
+	        s2 = sexpr();
+	        r = (strcmp(s1,s2) != 0);
+	     } else if (tokenizer_token() == TOKENIZER_EQ) {
+	        tokenizer_next();
+	        s2 = sexpr();
+	        r = (strcmp(s1,s2) <= 0);
+	     } else {
+	        s2 = sexpr();
+	        r = (strcmp(s1,s2) < 0);
+	     }
+		 break;
+      case TOKENIZER_GT:
+	     if (tokenizer_token() == TOKENIZER_EQ) {
+	        tokenizer_next();
+	        s2 = sexpr();
+	        r = (strcmp(s1,s2) >= 0);
+	     } else {
+	        s2 = sexpr();
+	        r = (strcmp(s1,s2) > 0);
+	     }
+		 break;
+      // condition additions
+      case TOKENIZER_NE:
+	     s2 = sexpr();
+	     r = (strcmp(s1,s2) != 0);
+		 break;
+      case TOKENIZER_LE:
+	     s2 = sexpr();
+	     r = (strcmp(s1,s2) <= 0);
+		 break;
+      case TOKENIZER_GE:
+	     s2 = sexpr();
+	     r = (strcmp(s1,s2) >= 0);
+		 break;
+      // end of condition additions
    }
    return r;
 }
 // end of string additions
 
+// input additions
 /*---------------------------------------------------------------------------*/
-static int
-varfactor(void)
-{
-  int r;
-  DEBUG_PRINTF("varfactor: obtaining %d from variable %d.\n", variables[tokenizer_variable_num()], tokenizer_variable_num());
-  r = ubasic_get_variable(tokenizer_variable_num());
-  accept(TOKENIZER_VARIABLE);
-  return r;
+void ubasic_set_input(FILE *stream) {
+   inputstream = stream;
+   inputstart = inputend = 0;
+   inputeof = 0;
 }
 /*---------------------------------------------------------------------------*/
-static int factor(void){
-  int r;
- // string function additions
-  int j;
-  char *s, *s1;
-  
-  DEBUG_PRINTF("factor: token '%s'.\n", tokenizer_token_name(tokenizer_token()));
-  switch(tokenizer_token()) {
-     case TOKENIZER_LEN:
-      accept(TOKENIZER_LEN);
-      r = strlen(sexpr());
-      break;  
-    case TOKENIZER_VAL:
-     accept(TOKENIZER_VAL);
-     r = atoi(sexpr());
-	 break;
+static void input_adopt(void) {
+   // string variables may point straight into the input buffer - copy any
+   // that are still in use into the string buffer before it is overwritten
+   int i;
+   if (inputbuffer == NULL)
+      return;
+   for (i=0; i<MAX_SVARNUM; i++) {
+      if (stringvariables[i] >= inputbuffer &&
+          stringvariables[i] <= inputbuffer + INPUT_BUFFERLEN)
+         stringvariables[i] = scpy(stringvariables[i]);
+   }
+}
+/*---------------------------------------------------------------------------*/
+static int input_fill(void) { // read more input, returns 0 if nothing was added
+   int n;
+   if (inputeof)
+      return 0;
+   if (inputstream == NULL)
+      inputstream = stdin;
+   if (inputbuffer == NULL &&
+       (inputbuffer = malloc(INPUT_BUFFERLEN + 1)) == NULL)
+      return 0;
+   input_adopt();
+   if (inputstart > 0) {
+      memmove(inputbuffer, inputbuffer + inputstart, inputend - inputstart);
+      inputend -= inputstart;
+      inputstart = 0;
+   }
+   if (inputend == INPUT_BUFFERLEN)
+      return 0; // line longer than the buffer
+   n = fread(inputbuffer + inputend, 1, INPUT_BUFFERLEN - inputend, inputstream);
+   if (n <= 0) {
+      inputeof = 1;
+      return 0;
+   }
+   inputend += n;
+   return 1;
+}
+/*---------------------------------------------------------------------------*/
+static char* input_read_line(void) { // return the next input line (or NULL), split in place
+   char *line, *p;
+   int scanned = 0;
+   for (;;) {
+      // nothing to search before the first fill, when there is no buffer yet
+      p = inputend - inputstart > scanned ?
+          memchr(inputbuffer + inputstart + scanned, '\n', inputend - inputstart - scanned) : NULL;
+      if (p != NULL)
+         break;
+      scanned = inputend - inputstart;
+      if (!input_fill()) {
+         if (inputstart == inputend)
+            return NULL;
+         p = inputbuffer + inputend; // unterminated last line
+         break;
+      }
+   }
+   line = inputbuffer + inputstart;
+   inputstart = (p == inputbuffer + inputend) ? inputend : p - inputbuffer + 1;
+   *p = '\0';
+   if (p > line && *(p-1) == '\r')
+      *(--p) = '\0';
+   if (p - line > MAX_STRINGVARLEN)
+      *(line + MAX_STRINGVARLEN) = '\0';
+   return line;
+}
+/*---------------------------------------------------------------------------*/
+static char* input_field(char **line) { // split the next comma separated field off *line
+   char *field = *line;
+   char *p;
+   if (field == NULL)
+      return (char *)nullstring;
+   p = strchr(field, ',');
+   if (p != NULL) {
+      *p = '\0';
+      *line = p + 1;
+   } else {
+      *line = NULL;
+   }
+   return field;
+}
+/*---------------------------------------------------------------------------*/
+static int input_read_eof(void) { // return 1 (true) if there is no more input
+   while (inputstart == inputend) {
+      if (!input_fill())
+         return 1;
+   }
+   return 0;
+}
+/*---------------------------------------------------------------------------*/
+static char* input_line(void) { // input_read_line(), through the replay log
+   char *line;
+   if (REPLAYING) {
+      if (replay_next() == REPLAY_NOLINE) {
+         replay_get(REPLAY_NOLINE);
+         return NULL;
+      }
+      line = replay_get_str(REPLAY_LINE);
+      if (inputbuffer == NULL &&
+          (inputbuffer = malloc(INPUT_BUFFERLEN + 1)) == NULL)
+         basic_error(UBASIC_ERROR_MEMORY, TOKENIZER_ERROR);
+      input_adopt();
+      return strcpy(inputbuffer, line); // INPUT splits it in place
+   }
+   line = input_read_line();
+   if (RECORDING) {
+      if (line == NULL)
+         replay_put(REPLAY_NOLINE);
+      else
+         replay_put_str(REPLAY_LINE, line);
+   }
+   return line;
+}
+/*---------------------------------------------------------------------------*/
+static int input_eof(void) { // input_read_eof(), through the replay log
+   int eof;
+   if (REPLAYING)
+      return (int)replay_get_num(REPLAY_EOF);
+   eof = input_read_eof();
+   if (RECORDING)
+      replay_put_num(REPLAY_EOF, eof);
+   return eof;
+}
+// end of input additions
+
+// fraction additions
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE num_int(VARIABLE_TYPE v) { // return the integer part of v
+   return fraction_bits == 0 ? v : v / ((VARIABLE_TYPE)1 << fraction_bits);
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE num_from_int(VARIABLE_TYPE i) { // return the integer i as a number
+   return fraction_bits == 0 ? i : i * ((VARIABLE_TYPE)1 << fraction_bits);
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE num_mul(VARIABLE_TYPE a, VARIABLE_TYPE b) {
+   // a * b shifted back, in two parts so the product of two large numbers
+   // does not overflow before the shift
+   unsigned long long ua = a < 0 ? -(unsigned long long)a : (unsigned long long)a;
+   unsigned long long ub = b < 0 ? -(unsigned long long)b : (unsigned long long)b;
+   unsigned long long r = ua * (ub >> fraction_bits) +
+                          ((ua * (ub & ((1ULL << fraction_bits) - 1))) >> fraction_bits);
+   return (a < 0) != (b < 0) ? -(VARIABLE_TYPE)r : (VARIABLE_TYPE)r;
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE num_div(VARIABLE_TYPE a, VARIABLE_TYPE b) {
+   return (VARIABLE_TYPE)((long long)a * (1LL << fraction_bits) / b);
+}
+/*---------------------------------------------------------------------------*/
+static int num_fraction(char const *s) { // return 1 (true) if the number at s has a decimal point
+   while (isdigit((unsigned char)*s))
+      s++;
+   return *s == '.';
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE num_parse(char const *s) { // return the number written at s
+   VARIABLE_TYPE v = 0;
+   long long f = 0;
+   long long d = 1;
+   int neg = 0;
+
+   while (*s == ' ' || *s == '\t')
+      s++;
+   if (*s == '-' || *s == '+')
+      neg = (*s++ == '-');
+   while (isdigit((unsigned char)*s))
+      v = v * 10 + (*s++ - '0');
+   v = num_from_int(v);
+   if (*s == '.' && fraction_bits > 0) {
+      for (s++; isdigit((unsigned char)*s) && d < 1000000000; s++) {
+         f = f * 10 + (*s - '0');
+         d *= 10;
+      }
+      v += (VARIABLE_TYPE)(((f << fraction_bits) + d / 2) / d);
+   }
+   return neg ? -v : v;
+}
+/*---------------------------------------------------------------------------*/
+static char* num_format(char *buf, VARIABLE_TYPE v) { // write v to buf, with up to FRACTION_DIGITS decimals
+   unsigned long long u, ip, fp, scale = 1;
+   int i;
+
+   if (fraction_bits == 0) {
+      sprintf(buf, "%lld", (long long)v);
+      return buf;
+   }
+   for (i = 0; i < FRACTION_DIGITS; i++)
+      scale *= 10;
+   u = v < 0 ? -(unsigned long long)v : (unsigned long long)v;
+   ip = u >> fraction_bits;
+   fp = ((u & ((1ULL << fraction_bits) - 1)) * scale + (1ULL << (fraction_bits - 1))) >> fraction_bits;
+   if (fp >= scale) { // rounded up to the next integer
+      ip++;
+      fp -= scale;
+   }
+   i = sprintf(buf, "%s%llu", v < 0 ? "-" : "", ip);
+   if (fp != 0) {
+      i += sprintf(buf + i, ".%0*llu", FRACTION_DIGITS, fp);
+      while (buf[i - 1] == '0')
+         buf[--i] = 0;
+   }
+   return buf;
+}
+// end of fraction additions
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE
+varfactor(void)
+{
+  VARIABLE_TYPE r;
+  DEBUG_PRINTF("varfactor: obtaining %d from variable %d.\n", variables[tokenizer_variable_num()], tokenizer_variable_num());
+  r = ubasic_get_variable(tokenizer_variable_num());
+  accept(TOKENIZER_VARIABLE);
+  return r;
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE factor(void){
+  VARIABLE_TYPE r;
+ // string function additions
+  int j;
+  char *s, *s1;
+  
+  DEBUG_PRINTF("factor: token '%s'.\n", tokenizer_token_name(tokenizer_token()));
+  switch(tokenizer_token()) {
+     case TOKENIZER_LEN:
+      PROFILE_ENTER(TOKENIZER_LEN); // profile addition
+      accept(TOKENIZER_LEN);
+      r = num_from_int(strlen(sexpr()));
+      PROFILE_LEAVE();
+      break;  
+    case TOKENIZER_VAL:
+     PROFILE_ENTER(TOKENIZER_VAL);
+     accept(TOKENIZER_VAL);
+     r = num_parse(sexpr());
+     PROFILE_LEAVE();
+	 break;
    case TOKENIZER_ASC:
+    PROFILE_ENTER(TOKENIZER_ASC);
     accept(TOKENIZER_ASC);
 	s = sexpr();
-	r = *s; 
+	r = num_from_int(*s); 
+	PROFILE_LEAVE();
 	break;
    case TOKENIZER_INSTR:
+    PROFILE_ENTER(TOKENIZER_INSTR);
     accept(TOKENIZER_INSTR);
 	accept(TOKENIZER_LEFTPAREN);
 	j = 1;
@@ -470,18 +1915,33 @@ static int factor(void){
 	  accept(TOKENIZER_NUMBER);
 	  accept(TOKENIZER_COMMA);
 	} 
-	if (j <1)
+	if (j <1) {
+	   PROFILE_LEAVE();
 	   return 0;
+	}
 	s = sexpr();
 	accept(TOKENIZER_COMMA);
 	s1 = sexpr();
 	accept(TOKENIZER_RIGHTPAREN);
-	r = sinstr(j, s, s1);
+	r = num_from_int(sinstr(j, s, s1));
+	PROFILE_LEAVE();
 	break;	
  // end of string additions 
+ // input addition
+   case TOKENIZER_EOF:
+    accept(TOKENIZER_EOF);
+    r = num_from_int(input_eof());
+    break;
+ // end of input addition
+ // call addition
+  case TOKENIZER_CALL:
+    r = num_from_int(call_function('n').num);
+    break;
+ // end of call addition
 	 
   case TOKENIZER_NUMBER:
-    r = tokenizer_num();
+    // fraction addition - integer programs keep the plain conversion
+    r = fraction_bits == 0 ? tokenizer_num() : num_parse(tokenizer_pos());
     DEBUG_PRINTF("factor: number %d.\n", r);
     accept(TOKENIZER_NUMBER);
     break;
@@ -498,11 +1958,11 @@ static int factor(void){
   return r;
 }
 /*---------------------------------------------------------------------------*/
-static int term(void){
-  int f1, f2;
+static VARIABLE_TYPE term(void){
+  VARIABLE_TYPE f1, f2;
   int op;
   if (tokenizer_stringlookahead()) {
-    f1 = slogexpr();
+    f1 = num_from_int(slogexpr());
   } else {
    f1 = factor();
    op = tokenizer_token();
@@ -515,12 +1975,16 @@ static int term(void){
      DEBUG_PRINTF("term: %d %d %d\n", f1, op, f2);
      switch(op) {
        case TOKENIZER_ASTR:
-        f1 = f1 * f2;
+        f1 = fraction_bits == 0 ? f1 * f2 : num_mul(f1, f2);
         break;
        case TOKENIZER_SLASH:
-        f1 = f1 / f2;
+        if (f2 == 0)
+          basic_error(UBASIC_ERROR_DIVIDE, TOKENIZER_ERROR);
+        f1 = fraction_bits == 0 ? f1 / f2 : num_div(f1, f2);
         break;
        case TOKENIZER_MOD:
+        if (f2 == 0)
+          basic_error(UBASIC_ERROR_DIVIDE, TOKENIZER_ERROR);
         f1 = f1 % f2;
         break;
      }
@@ -532,7 +1996,7 @@ static int term(void){
 }
 /*---------------------------------------------------------------------------*/
 static VARIABLE_TYPE expr(void){
-  int t1, t2;
+  VARIABLE_TYPE t1, t2;
   int op;
   
   t1 = term();
@@ -565,73 +2029,120 @@ static VARIABLE_TYPE expr(void){
   return t1;
 }
 /*---------------------------------------------------------------------------*/
-static int relation(void){
-  int r1, r2;
+static int comparison(void){
+  VARIABLE_TYPE r1, r2;
   int op;
 
   r1 = expr();
   op = tokenizer_token();
-  DEBUG_PRINTF("relation: token %d.\n", op);
+  DEBUG_PRINTF("comparison: token %d.\n", op);
   while(op == TOKENIZER_LT ||
        op == TOKENIZER_GT ||
-       op == TOKENIZER_EQ) {
+       op == TOKENIZER_EQ ||
+       op == TOKENIZER_LE || // condition additions
+       op == TOKENIZER_GE ||
+       op == TOKENIZER_NE) {
     tokenizer_next();
     r2 = expr();
-    DEBUG_PRINTF("relation: %d %d %d.\n", r1, op, r2);
+    DEBUG_PRINTF("comparison: %d %d %d.\n", r1, op, r2);
     switch(op) {
     case TOKENIZER_LT:
-      r1 = r1 < r2;
+      r1 = num_from_int(r1 < r2);
       break;
     case TOKENIZER_GT:
-      r1 = r1 > r2;
+      r1 = num_from_int(r1 > r2);
       break;
     case TOKENIZER_EQ:
-      r1 = r1 == r2;
+      r1 = num_from_int(r1 == r2);
+      break;
+    // condition additions
+    case TOKENIZER_LE:
+      r1 = num_from_int(r1 <= r2);
+      break;
+    case TOKENIZER_GE:
+      r1 = num_from_int(r1 >= r2);
+      break;
+    case TOKENIZER_NE:
+      r1 = num_from_int(r1 != r2);
       break;
+    // end of condition additions
     }
     op = tokenizer_token();
   }
-  DEBUG_PRINTF("relation: expr=%d.\n", r1);
-  return r1;
+  DEBUG_PRINTF("comparison: expr=%d.\n", r1);
+  return r1 != 0;
 }
+// condition additions
 /*---------------------------------------------------------------------------*/
-static void index_free(void) {
-  if(line_index_head != NULL) {
-    line_index_current = line_index_head;
-    do {
-      DEBUG_PRINTF("Freeing index for line %d.\n", line_index_current->line_number);
-      line_index_head = line_index_current;
-      line_index_current = line_index_current->next;
-      free(line_index_head);
-    } while (line_index_current != NULL);
-    line_index_head = NULL;
+static int negation(void){
+  char const *pos = tokenizer_pos();
+  int r;
+
+  if(tokenizer_token() == TOKENIZER_NOT) {
+    accept(TOKENIZER_NOT);
+    return !negation();
+  }
+  // ubasic_init() marks the parentheses that group a condition
+  if(tokenizer_token() == TOKENIZER_LEFTPAREN && jump_find(pos) != NULL) {
+    accept(TOKENIZER_LEFTPAREN);
+    r = relation();
+    accept(TOKENIZER_RIGHTPAREN);
+    return r;
+  }
+  return comparison();
+}
+/*---------------------------------------------------------------------------*/
+static int conjunction(void){
+  char const *pos, *skip;
+  int r;
+
+  r = negation();
+  while(tokenizer_token() == TOKENIZER_LAND) {
+    pos = tokenizer_pos();
+    // a false operand skips the rest of the AND chain, as worked out by ubasic_init()
+    if(!r && (skip = jump_find(pos)) != NULL) {
+      tokenizer_goto(skip);
+      break;
+    }
+    accept(TOKENIZER_LAND);
+    r = negation() && r;
+  }
+  return r;
+}
+// end of condition additions
+/*---------------------------------------------------------------------------*/
+static int relation(void){
+  // condition additions - OR of ANDs, a true operand skips the rest
+  char const *pos, *skip;
+  int r;
+
+  r = conjunction();
+  while(tokenizer_token() == TOKENIZER_LOR) {
+    pos = tokenizer_pos();
+    if(r && (skip = jump_find(pos)) != NULL) {
+      tokenizer_goto(skip);
+      break;
+    }
+    accept(TOKENIZER_LOR);
+    r = conjunction() || r;
   }
+  DEBUG_PRINTF("relation: %d.\n", r);
+  return r;
+  // end of condition additions
 }
 /*---------------------------------------------------------------------------*/
 static char const* index_find(int linenum) {
   struct line_index *lidx;
-  lidx = line_index_head;
-
-  #if DEBUG
-  int step = 0;
-  #endif
 
+  // scale addition - the line's hash bucket rather than the whole list
+  if(line_index_buckets == NULL) {
+    return NULL;
+  }
+  lidx = line_index_buckets[LINE_INDEX_HASH(linenum)];
   while(lidx != NULL && lidx->line_number != linenum) {
-    lidx = lidx->next;
-
-    #if DEBUG
-	#if VERBOSE
-    if(lidx != NULL) {
-      DEBUG_PRINTF("index_find: Step %3d. Found index for line %d: %p.\n",
-			step,
-			lidx->line_number,
-			lidx->program_text_position - tokenizer_start());
-    }
-    step++;
-	#endif
-    #endif
+    lidx = lidx->chain;
   }
-  if(lidx != NULL && lidx->line_number == linenum) {
+  if(lidx != NULL) {
 	#if DEBUG
 	#if VERBOSE
     DEBUG_PRINTF("index_find: Returning index for line %d.\n", linenum);
@@ -642,18 +2153,76 @@ static char const* index_find(int linenum) {
   DEBUG_PRINTF("index_find: Returning NULL.\n", linenum);
   return NULL;
 }
+// scale additions
 /*---------------------------------------------------------------------------*/
-static void index_add(int linenum, char const* sourcepos) {
-  if(line_index_head != NULL && index_find(linenum)) {
-    return;
-  }
+static void index_clear(void) { // forget the hash table, the lines are already gone
+  line_index_buckets = NULL;
+  line_index_bits = 0;
+  line_index_count = 0;
+  line_index_scanned = NULL;
+  line_index_free = NULL;
+}
+/*---------------------------------------------------------------------------*/
+static void index_rehash(int bits) { // put every line in a table of 1 << bits buckets
+  struct line_index **buckets;
+  struct line_index *lidx;
+  unsigned h;
 
+  // a table of the same size is used again, so ubasic_reload() takes no more
+  if(line_index_buckets != NULL && bits == line_index_bits) {
+    buckets = line_index_buckets;
+  } else {
+    buckets = arena_alloc(&run_arena, sizeof(struct line_index *) << bits);
+  }
+  if(buckets == NULL) {
+    return; // keep the table there is, fuller
+  }
+  memset(buckets, 0, sizeof(struct line_index *) << bits);
+  line_index_buckets = buckets;
+  line_index_bits = bits;
+  line_index_count = 0;
+  for(lidx = line_index_head; lidx != NULL; lidx = lidx->next) {
+    h = LINE_INDEX_HASH(lidx->line_number);
+    lidx->chain = buckets[h];
+    buckets[h] = lidx;
+    line_index_count++;
+  }
+}
+// end of scale additions
+/*---------------------------------------------------------------------------*/
+static void index_add(int linenum, char const* sourcepos) {
   struct line_index *new_lidx;
+  unsigned h;
 
-  new_lidx = malloc(sizeof(struct line_index));
+  if(index_find(linenum)) {
+    return;
+  }
+  // arena addition - one ubasic_reload() dropped first, so reloads do not
+  // take more and more of the arena
+  if(line_index_free != NULL) {
+    new_lidx = line_index_free;
+    line_index_free = new_lidx->next;
+  } else {
+    new_lidx = arena_alloc(&run_arena, sizeof(struct line_index));
+  }
+  // end of arena addition
+  if(new_lidx == NULL) {
+    return; // the line is found by searching
+  }
   new_lidx->line_number = linenum;
   new_lidx->program_text_position = sourcepos;
   new_lidx->next = NULL;
+  // scale addition - into its bucket, the table doubling when full
+  if(line_index_buckets == NULL || line_index_count >= 1 << line_index_bits) {
+    index_rehash(line_index_bits < 4 ? 4 : line_index_bits + 1);
+  }
+  if(line_index_buckets != NULL) {
+    h = LINE_INDEX_HASH(linenum);
+    new_lidx->chain = line_index_buckets[h];
+    line_index_buckets[h] = new_lidx;
+    line_index_count++;
+  }
+  // end of scale addition
 
   if(line_index_head != NULL) {
     line_index_current->next = new_lidx;
@@ -668,8 +2237,17 @@ static void index_add(int linenum, char const* sourcepos) {
 /*---------------------------------------------------------------------------*/
 static void jump_linenum_slow(int linenum)
 {
-  tokenizer_init(program_ptr);
-  while(tokenizer_num() != linenum) {
+  // scale addition - carry on from where the last search stopped, putting
+  // each line passed in the index, so the program is only read once
+  if(line_index_scanned == NULL) {
+    tokenizer_init(program_ptr);
+  } else {
+    tokenizer_goto(line_index_scanned);
+  }
+  while(tokenizer_token() != TOKENIZER_NUMBER || tokenizer_num() != linenum) {
+    if(tokenizer_token() == TOKENIZER_NUMBER) {
+      index_add(tokenizer_num(), tokenizer_pos());
+    }
     do {
       do {
         tokenizer_next();
@@ -678,6 +2256,10 @@ static void jump_linenum_slow(int linenum)
       if(tokenizer_token() == TOKENIZER_LF) {
         tokenizer_next();
       }
+      line_index_scanned = tokenizer_pos();
+      if(tokenizer_finished()) {
+        basic_error(UBASIC_ERROR_LINE, TOKENIZER_NUMBER);
+      }
     } while(tokenizer_token() != TOKENIZER_NUMBER);
 	#if DEBUG
 	#if VERBOSE
@@ -700,202 +2282,3198 @@ static void jump_linenum(int linenum)
   }
 }
 /*---------------------------------------------------------------------------*/
-static void goto_statement(void)
-{
-  accept(TOKENIZER_GOTO);
-  jump_linenum(tokenizer_num());
+// structured additions
+/*---------------------------------------------------------------------------*/
+static int structure_add(char const *pos) {
+   jump_targets[jump_target_count].program_text_position = pos;
+   jump_targets[jump_target_count].target = NULL;
+   return jump_target_count++;
 }
 /*---------------------------------------------------------------------------*/
-static void print_statement(void) {
-// string additions
-  static char buf[128];
-  buf[0]=0;
-
-  accept(TOKENIZER_PRINT);
-  DEBUG_PRINTF("print_statement: Loop.\n");
-  do {
-    if(tokenizer_token() == TOKENIZER_STRING) {
-      tokenizer_string(string, sizeof(string));
-      printf("%s", string);
-      tokenizer_next();
-    } else if(tokenizer_token() == TOKENIZER_COMMA) {
-      printf(" ");
-      tokenizer_next();
-    } else if(tokenizer_token() == TOKENIZER_SEMICOLON) {
-      tokenizer_next();
-    } else if(tokenizer_token() == TOKENIZER_VARIABLE ||
-          tokenizer_token() == TOKENIZER_NUMBER) {
-      printf("%d", expr());
-	} else if (tokenizer_token() == TOKENIZER_CR){
-		tokenizer_next();
-    } else {
-      if (tokenizer_stringlookahead()) {
-          sprintf(buf+strlen(buf), "%s", sexpr());
-      } else {
-         sprintf(buf+strlen(buf), "%d", expr());
-	  }
-	  // end of string additions
-	  break;
-	  
-    }
-  } while(tokenizer_token() != TOKENIZER_LF &&
-	  tokenizer_token() != TOKENIZER_ENDOFINPUT);
-  printf(buf);
-  printf("\n");
-  DEBUG_PRINTF("print_statement: End of print.\n");
-  tokenizer_next();
+static int structure_compare(const void *a, const void *b) {
+   char const *pa = ((const struct jump_target *)a)->program_text_position;
+   char const *pb = ((const struct jump_target *)b)->program_text_position;
+   return pa < pb ? -1 : pa > pb;
 }
 /*---------------------------------------------------------------------------*/
-static void if_statement(void){
-  int r;
-  
-  accept(TOKENIZER_IF);
-
-  r = relation();
-  DEBUG_PRINTF("if_statement: relation %d.\n", r);
-  accept(TOKENIZER_THEN);
-  if(r) {
-    statement();
-  } else {
-    do {
-      tokenizer_next();
-    } while(tokenizer_token() != TOKENIZER_ELSE &&
-        tokenizer_token() != TOKENIZER_LF &&
-        tokenizer_token() != TOKENIZER_ENDOFINPUT);
-    if(tokenizer_token() == TOKENIZER_ELSE) {
-      tokenizer_next();
-      statement();
-    } else if(tokenizer_token() == TOKENIZER_LF) {
-      tokenizer_next();
-    }
-  }
+static int label_char(char c) {
+   return isalnum((unsigned char)c) || c == '_';
 }
 /*---------------------------------------------------------------------------*/
-static void let_statement(void){
-// string additions here
-  int var;
-  if (tokenizer_token() == TOKENIZER_VARIABLE) {
-     var = tokenizer_variable_num();
-     accept(TOKENIZER_VARIABLE);
-     accept(TOKENIZER_EQ);
-     ubasic_set_variable(var, expr());
-     DEBUG_PRINTF("let_statement: assign %d to %d.\n", variables[var], var);
-     accept(TOKENIZER_LF);
-  } else if (tokenizer_token() == TOKENIZER_STRINGVARIABLE) {
-     var = tokenizer_variable_num();
-	 accept(TOKENIZER_STRINGVARIABLE);
-     accept(TOKENIZER_EQ);
-	 ubasic_set_stringvariable(var, sexpr());
-	 DEBUG_PRINTF("let_statement: string assign '%s' to %d\n", stringvariables[var], var);
-	 accept(TOKENIZER_LF);
-
-  }
-  // end of string additions
+static int label_compare(char const *a, char const *b) { // compare the labels at a and b
+   for (a++, b++; label_char(*a) && *a == *b; a++, b++)
+      ;
+   return (label_char(*a) ? (unsigned char)*a : 0) -
+          (label_char(*b) ? (unsigned char)*b : 0);
 }
 /*---------------------------------------------------------------------------*/
-static void
-gosub_statement(void)
-{
-  int linenum;
-  accept(TOKENIZER_GOSUB);
-  linenum = tokenizer_num();
-  accept(TOKENIZER_NUMBER);
-  accept(TOKENIZER_LF);
-  if(gosub_stack_ptr < MAX_GOSUB_STACK_DEPTH) {
-    gosub_stack[gosub_stack_ptr] = tokenizer_num();
-    gosub_stack_ptr++;
-    jump_linenum(linenum);
-  } else {
-    DEBUG_PRINTF("gosub_statement: gosub stack exhausted.\n");
-  }
+static int label_sort(const void *a, const void *b) {
+   char const *pa = *(char const * const *)a;
+   char const *pb = *(char const * const *)b;
+   int c = label_compare(pa, pb);
+   return c != 0 ? c : (pa < pb ? -1 : pa > pb); // first definition first
 }
 /*---------------------------------------------------------------------------*/
-static void return_statement(void){
-  accept(TOKENIZER_RETURN);
-  if(gosub_stack_ptr > 0) {
-    gosub_stack_ptr--;
-    jump_linenum(gosub_stack[gosub_stack_ptr]);
-  } else {
-    DEBUG_PRINTF("return_statement: non-matching return.\n");
-  }
+static char const* label_find(char const **labels, int n, char const *name) { // return the first definition of name (or NULL)
+   int lo = 0;
+   int hi = n;
+   int mid;
+   while (lo < hi) {
+      mid = (lo + hi) / 2;
+      if (label_compare(labels[mid], name) < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return lo < n && label_compare(labels[lo], name) == 0 ? labels[lo] : NULL;
 }
 /*---------------------------------------------------------------------------*/
-static void next_statement(void){
-  int var;
-
-  accept(TOKENIZER_NEXT);
-  var = tokenizer_variable_num();
-  accept(TOKENIZER_VARIABLE);
-  if(for_stack_ptr > 0 &&
-     var == for_stack[for_stack_ptr - 1].for_variable) {
-    ubasic_set_variable(var,
-                       ubasic_get_variable(var) + 1);
-    if(ubasic_get_variable(var) <= for_stack[for_stack_ptr - 1].to) {
-      jump_linenum(for_stack[for_stack_ptr - 1].line_after_for);
-    } else {
-      for_stack_ptr--;
-      accept(TOKENIZER_LF);
-    }
-  } else {
-    DEBUG_PRINTF("next_statement: non-matching next (expected %d, found %d).\n", for_stack[for_stack_ptr - 1].for_variable, var);
-    accept(TOKENIZER_LF);
-  }
+static void line_starts_init(const char *program) {
+   // an unnumbered program reports text lines, so remember where each begins
+   char const *p;
 
+   line_count = 1;
+   for (p = program; *p != 0; p++)
+      if (*p == '\n')
+         line_count++;
+   line_starts = arena_alloc(&load_arena, line_count * sizeof(char const *));
+   line_count = 0;
+   line_starts[line_count++] = program;
+   for (p = program; *p != 0; p++)
+      if (*p == '\n')
+         line_starts[line_count++] = p + 1;
 }
 /*---------------------------------------------------------------------------*/
-static void for_statement(void) {
-  int for_variable, to;
-
-  accept(TOKENIZER_FOR);
-  for_variable = tokenizer_variable_num();
-  accept(TOKENIZER_VARIABLE);
-  accept(TOKENIZER_EQ);
-  ubasic_set_variable(for_variable, expr());
-  accept(TOKENIZER_TO);
-  to = expr();
-  accept(TOKENIZER_LF);
+static int source_line(char const *pos) { // return the text line holding pos
+   int lo = 0;
+   int hi = line_count - 1;
+   int mid;
+   if (line_starts == NULL)
+      return 0;
+   while (lo < hi) {
+      mid = (lo + hi + 1) / 2;
+      if (line_starts[mid] <= pos)
+         lo = mid;
+      else
+         hi = mid - 1;
+   }
+   return lo + 1;
+}
+/*---------------------------------------------------------------------------*/
+// parallel additions
+/*---------------------------------------------------------------------------*/
+struct parfor_scan {
+   char const *parfor;  // the PARFOR whose body is being checked (or NULL)
+   int entry;           // its jump target
+   char const *bad;     // first thing in the body a worker cannot run
+   char const *next;    // a NEXT that may end the body
+   char const *carried[MAX_VARNUM]; // first read of each variable before any assignment
+   int var;             // loop variable
+   int header;          // still in the PARFOR statement
+   int reduce;          // after REDUCE
+   int peek;            // 1 in a PEEK, 2 in its targets
+   int range;           // first variable of a PEEK range
+   unsigned long reduce_vars, assigned, assigning;
+};
+/*---------------------------------------------------------------------------*/
+static void parfor_scan(struct parfor_scan *ps, int t, int prev, char const *pos, int start) {
+   // follow one token of a PARFOR, pointing its jump target at the NEXT
+   // ending it or at the first thing in the body that a worker cannot run:
+   // output, input, a jump out of the body, a string assignment, or a
+   // variable that keeps its value from one iteration to the next
+   int v, i;
 
-  if(for_stack_ptr < MAX_FOR_STACK_DEPTH) {
-    for_stack[for_stack_ptr].line_after_for = tokenizer_num();
+   if (ps->next != NULL) {
+      if (t == TOKENIZER_VARIABLE && tokenizer_variable_num() == ps->var) {
+         for (i = 0; i < MAX_VARNUM; i++) {
+            if (ps->carried[i] != NULL && (ps->assigned & (1UL << i)) &&
+                !(ps->reduce_vars & (1UL << i)) &&
+                (ps->bad == NULL || ps->carried[i] < ps->bad))
+               ps->bad = ps->carried[i];
+         }
+         jump_targets[ps->entry].target = ps->bad != NULL ? ps->bad : ps->next;
+         ps->parfor = NULL;
+      }
+      ps->next = NULL; // otherwise the NEXT of an inner FOR
+      return;
+   }
+   if (ps->header) {
+      if (t == TOKENIZER_VARIABLE) {
+         v = tokenizer_variable_num();
+         if (ps->var < 0)
+            ps->var = v;
+         else if (ps->reduce)
+            ps->reduce_vars |= 1UL << v;
+      } else if (t == TOKENIZER_REDUCE) {
+         ps->reduce = 1;
+      } else if (t == TOKENIZER_COLON || t == TOKENIZER_LF) {
+         ps->header = 0;
+      }
+      return;
+   }
+   if (t == TOKENIZER_COLON || t == TOKENIZER_LF || t == TOKENIZER_ELSE) {
+      // an assignment counts once the value assigned has been read
+      ps->assigned |= ps->assigning;
+      ps->assigning = 0;
+      ps->peek = 0;
+      return;
+   }
+   if (start) {
+      switch (t) {
+      case TOKENIZER_NEXT:
+         ps->next = pos;
+         return;
+      case TOKENIZER_PEEK:
+         ps->peek = 1;
+         return;
+      case TOKENIZER_PRINT:
+      case TOKENIZER_INPUT:
+      case TOKENIZER_LINE:
+      case TOKENIZER_SLEEP:
+      case TOKENIZER_YIELD:
+      case TOKENIZER_GOTO:
+      case TOKENIZER_GOSUB:
+      case TOKENIZER_RETURN:
+      case TOKENIZER_END:
+      case TOKENIZER_PARFOR:
+      case TOKENIZER_STRINGVARIABLE:
+         if (ps->bad == NULL)
+            ps->bad = pos;
+         return;
+      }
+   }
+   if (ps->peek == 1 && t == TOKENIZER_COMMA) {
+      ps->peek = 2;
+      return;
+   }
+   if (ps->peek == 2 && t == TOKENIZER_STRINGVARIABLE && ps->bad == NULL)
+      ps->bad = pos;
+   if (t != TOKENIZER_VARIABLE)
+      return;
+   v = tokenizer_variable_num();
+   if (start || prev == TOKENIZER_LET || prev == TOKENIZER_FOR || ps->peek == 2) {
+      if (ps->peek == 2 && prev == TOKENIZER_TO) {
+         for (i = ps->range; i < v; i++)
+            ps->assigning |= 1UL << i;
+      }
+      ps->assigning |= 1UL << v;
+      ps->range = v;
+      if (v == ps->var && ps->bad == NULL)
+         ps->bad = pos; // the loop variable belongs to PARFOR
+   } else if (!(ps->assigned & (1UL << v)) && ps->carried[v] == NULL) {
+      ps->carried[v] = pos;
+   }
+}
+// end of parallel additions
+// condition additions
+/*---------------------------------------------------------------------------*/
+#define MAX_CONDITION_OPS 32
+struct cond_scan {
+   int active;                               // in the condition of an IF or WHILE
+   int depth;                                // parentheses open in it
+   char const *paren[MAX_STRUCTURE_DEPTH + 1]; // the ( at each depth
+   int grouped[MAX_STRUCTURE_DEPTH + 1];     // 1 if it holds a condition
+   int pending[MAX_CONDITION_OPS];           // ANDs and ORs waiting for their target
+   int pending_token[MAX_CONDITION_OPS];
+   int pending_depth[MAX_CONDITION_OPS];
+   int npending;
+};
+/*---------------------------------------------------------------------------*/
+static void cond_resolve(struct cond_scan *cs, int depth, int token, char const *pos) {
+   // point the pending ANDs (token TOKENIZER_LAND) or ANDs and ORs (0) at
+   // depth, or at any depth (-1), at pos
+   while (cs->npending > 0 &&
+          (depth < 0 || cs->pending_depth[cs->npending - 1] == depth) &&
+          (token == 0 || cs->pending_token[cs->npending - 1] == token)) {
+      cs->npending--;
+      jump_targets[cs->pending[cs->npending]].target = pos;
+   }
+}
+/*---------------------------------------------------------------------------*/
+static void cond_scan(struct cond_scan *cs, int t, char const *pos) {
+   // an AND whose left side is false continues at the next OR or the end of
+   // its parentheses or condition, an OR whose left side is true at the end
+   int d = cs->depth;
+
+   switch (t) {
+   case TOKENIZER_LOR:
+      cond_resolve(cs, d, TOKENIZER_LAND, pos);
+      // fall through
+   case TOKENIZER_LAND:
+      if (cs->npending < MAX_CONDITION_OPS) {
+         cs->pending[cs->npending] = structure_add(pos);
+         cs->pending_token[cs->npending] = t;
+         cs->pending_depth[cs->npending++] = d;
+      }
+      // fall through
+   case TOKENIZER_NOT:
+   case TOKENIZER_LT: case TOKENIZER_GT: case TOKENIZER_EQ:
+   case TOKENIZER_LE: case TOKENIZER_GE: case TOKENIZER_NE:
+      if (d > 0 && d <= MAX_STRUCTURE_DEPTH)
+         cs->grouped[d] = 1;
+      break;
+   case TOKENIZER_LEFTPAREN:
+      if (++cs->depth <= MAX_STRUCTURE_DEPTH) {
+         cs->paren[cs->depth] = pos;
+         cs->grouped[cs->depth] = 0;
+      }
+      break;
+   case TOKENIZER_RIGHTPAREN:
+      if (d > 0) {
+         cond_resolve(cs, d, 0, pos);
+         if (d <= MAX_STRUCTURE_DEPTH && cs->grouped[d]) {
+            jump_targets[structure_add(cs->paren[d])].target = pos;
+            // a condition in parentheses only stands where a condition
+            // does, so parentheses around it, as in ((a = 1)), group one too
+            if (d > 1)
+               cs->grouped[d - 1] = 1;
+         }
+         cs->depth--;
+      }
+      break;
+   case TOKENIZER_THEN:
+   case TOKENIZER_LF:
+   case TOKENIZER_COLON:
+   case TOKENIZER_ELSE:
+      cond_resolve(cs, -1, 0, pos);
+      cs->active = 0;
+      break;
+   }
+}
+// end of condition additions
+/*---------------------------------------------------------------------------*/
+static void structure_error(const char *program, char const *pos, int kind, int expected, int found) {
+   // keep the first WHILE, WEND, IF or ENDIF that does not pair up, so the
+   // program stops before it starts rather than going astray
+   if (error_info.kind != UBASIC_ERROR_NONE)
+      return;
+   error_info.kind = kind;
+   error_info.line = optimize_line(program, pos);
+   error_info.expected = expected;
+   error_info.found = found;
+   ended = 1;
+}
+/*---------------------------------------------------------------------------*/
+static void structure_init(const char *program) {
+   // resolve where every IF, ELSE, WHILE and WEND continues, where every
+   // GOTO @label and GOSUB @label goes and where every PARFOR body ends,
+   // once, so that branches, loops and label jumps go straight to a
+   // source position
+   struct {
+      int token;        // TOKENIZER_IF, TOKENIZER_ELSE or TOKENIZER_WHILE
+      char const *pos;  // its token
+      char const *here; // its statement, for WEND to go back to
+   } open[MAX_STRUCTURE_DEPTH];
+   int ifs[MAX_STRUCTURE_DEPTH];   // single line IFs waiting for ELSE or the next line
+   int elses[MAX_STRUCTURE_DEPTH]; // single line ELSEs waiting for the next line
+   int fix[3 * MAX_STRUCTURE_DEPTH]; // jumps waiting for the next statement
+   int depth = 0, nifs = 0, nelses = 0, nfix = 0;
+   int line_start = 1, statement_start = 1, first = 0, then_seen = 0;
+   char const *pos, *here, *line_pos = program, *if_pos = NULL;
+   char const **labels; // label definitions
+   int nlabels = 0;
+   struct arena_mark mark; // arena addition
+   struct parfor_scan ps; // parallel addition
+   struct cond_scan cs;   // condition addition
+   int prev = TOKENIZER_LF;
+   int n = 0;
+   int i, t;
+
+   jump_targets = NULL;
+   jump_target_count = 0;
+   line_starts = NULL; // label addition
+   line_count = 0;
+   fraction_bits = 0; // fraction addition
+   tokenizer_init(program);
+   if (!tokenizer_finished() && tokenizer_token() != TOKENIZER_NUMBER)
+      line_starts_init(program);
+   while (!tokenizer_finished()) {
+      t = tokenizer_token();
+      if (t == TOKENIZER_NUMBER && num_fraction(tokenizer_pos()))
+         fraction_bits = FIXED_POINT_BITS; // fraction addition
+      if (t == TOKENIZER_IF || t == TOKENIZER_ELSE ||
+          t == TOKENIZER_WHILE || t == TOKENIZER_WEND ||
+          t == TOKENIZER_LABEL || t == TOKENIZER_PARFOR ||
+          t == TOKENIZER_LAND || t == TOKENIZER_LOR || t == TOKENIZER_LEFTPAREN)
+         n++;
+      tokenizer_next();
+   }
+   if (n == 0)
+      return;
+   jump_targets = arena_alloc(&load_arena, n * sizeof(struct jump_target));
+   mark = arena_save(&load_arena); // arena addition - labels are only needed here
+   labels = arena_alloc(&load_arena, n * sizeof(char const *));
+   ps.parfor = NULL;
+   cs.active = cs.depth = cs.npending = 0;
+   tokenizer_init(program);
+   while (!tokenizer_finished()) {
+      t = tokenizer_token();
+      pos = tokenizer_pos();
+      if (then_seen) {
+         // THEN at the end of the line opens a block
+         then_seen = 0;
+         if (t == TOKENIZER_LF) {
+            if (depth < MAX_STRUCTURE_DEPTH) {
+               open[depth].token = TOKENIZER_IF;
+               open[depth].pos = if_pos;
+               depth++;
+            } else {
+               structure_error(program, if_pos, UBASIC_ERROR_STACK, TOKENIZER_ERROR, TOKENIZER_IF);
+            }
+         } else if (nifs < MAX_STRUCTURE_DEPTH) {
+            ifs[nifs++] = structure_add(if_pos);
+         }
+      }
+      if (t == TOKENIZER_NUMBER && line_start) {
+         line_pos = pos;
+         line_start = 0;
+         statement_start = first = 1;
+         tokenizer_next();
+         continue;
+      }
+      line_start = 0;
+      here = first ? line_pos : pos;
+      if (statement_start) {
+         while (nfix > 0)
+            jump_targets[fix[--nfix]].target = here;
+         first = 0;
+      }
+      // parallel addition
+      if (ps.parfor != NULL) {
+         parfor_scan(&ps, t, prev, pos, statement_start || prev == TOKENIZER_THEN);
+      } else if (t == TOKENIZER_PARFOR && statement_start) {
+         memset(&ps, 0, sizeof(ps));
+         ps.parfor = pos;
+         ps.entry = structure_add(pos);
+         ps.var = -1;
+         ps.header = 1;
+      }
+      prev = t;
+      // end of parallel addition
+      // condition addition
+      if (cs.active) {
+         cond_scan(&cs, t, pos);
+      } else if (t == TOKENIZER_IF || t == TOKENIZER_WHILE) {
+         cs.active = 1;
+         cs.depth = cs.npending = 0;
+      }
+      // end of condition addition
+      switch (t) {
+      case TOKENIZER_IF:
+         if_pos = pos;
+         break;
+      case TOKENIZER_THEN:
+         then_seen = 1;
+         break;
+      case TOKENIZER_ELSE:
+         if (statement_start && depth > 0 && open[depth - 1].token == TOKENIZER_IF) {
+            // a false block IF continues after the ELSE, a true one jumps from it to ENDIF
+            if (nfix < 3 * MAX_STRUCTURE_DEPTH)
+               fix[nfix++] = structure_add(open[depth - 1].pos);
+            open[depth - 1].token = TOKENIZER_ELSE;
+            open[depth - 1].pos = pos;
+         } else {
+            // false single line IFs continue with the statement after the ELSE
+            while (nifs > 0 && nfix < 3 * MAX_STRUCTURE_DEPTH)
+               fix[nfix++] = ifs[--nifs];
+            nifs = 0;
+            if (nelses < MAX_STRUCTURE_DEPTH)
+               elses[nelses++] = structure_add(pos);
+            statement_start = 1;
+            tokenizer_next();
+            continue;
+         }
+         break;
+      case TOKENIZER_ENDIF:
+         if (statement_start && depth > 0 && open[depth - 1].token != TOKENIZER_WHILE) {
+            depth--;
+            if (nfix < 3 * MAX_STRUCTURE_DEPTH)
+               fix[nfix++] = structure_add(open[depth].pos);
+         } else if (statement_start) {
+            structure_error(program, pos, UBASIC_ERROR_SYNTAX,
+                            depth > 0 ? TOKENIZER_WEND : TOKENIZER_IF, TOKENIZER_ENDIF);
+         }
+         break;
+      case TOKENIZER_WHILE:
+         if (statement_start && depth < MAX_STRUCTURE_DEPTH) {
+            open[depth].token = TOKENIZER_WHILE;
+            open[depth].pos = pos;
+            open[depth].here = here;
+            depth++;
+         } else if (statement_start) {
+            structure_error(program, pos, UBASIC_ERROR_STACK, TOKENIZER_ERROR, TOKENIZER_WHILE);
+         }
+         break;
+      case TOKENIZER_WEND:
+         if (statement_start && depth > 0 && open[depth - 1].token == TOKENIZER_WHILE) {
+            depth--;
+            if (nfix < 3 * MAX_STRUCTURE_DEPTH)
+               fix[nfix++] = structure_add(open[depth].pos);
+            jump_targets[structure_add(pos)].target = open[depth].here;
+         } else if (statement_start) {
+            structure_error(program, pos, UBASIC_ERROR_SYNTAX,
+                            depth > 0 ? TOKENIZER_ENDIF : TOKENIZER_WHILE, TOKENIZER_WEND);
+         }
+         break;
+      // label additions
+      case TOKENIZER_LABEL:
+         if (statement_start) {
+            // a definition, the statement after it starts a statement too
+            labels[nlabels++] = pos;
+            tokenizer_next();
+            continue;
+         }
+         structure_add(pos); // GOTO or GOSUB @label, resolved below
+         break;
+      // end of label additions
+      case TOKENIZER_LF:
+         while (nifs > 0 && nfix < 3 * MAX_STRUCTURE_DEPTH)
+            fix[nfix++] = ifs[--nifs];
+         while (nelses > 0 && nfix < 3 * MAX_STRUCTURE_DEPTH)
+            fix[nfix++] = elses[--nelses];
+         nifs = nelses = 0;
+         line_start = statement_start = 1;
+         first = 0;
+         tokenizer_next();
+         continue;
+      }
+      statement_start = (t == TOKENIZER_COLON);
+      tokenizer_next();
+   }
+   // a block still open has no WEND or ENDIF
+   if (depth > 0)
+      structure_error(program, open[depth - 1].pos, UBASIC_ERROR_SYNTAX,
+                      open[depth - 1].token == TOKENIZER_WHILE ? TOKENIZER_WEND : TOKENIZER_ENDIF,
+                      open[depth - 1].token);
+   // whatever is still waiting continues at the end of the program
+   pos = tokenizer_pos();
+   if (cs.active)
+      cond_resolve(&cs, -1, 0, pos); // condition addition
+   while (nfix > 0)
+      jump_targets[fix[--nfix]].target = pos;
+   while (nifs > 0)
+      jump_targets[ifs[--nifs]].target = pos;
+   while (nelses > 0)
+      jump_targets[elses[--nelses]].target = pos;
+   // label addition - point each GOTO and GOSUB @label at its definition
+   qsort(labels, nlabels, sizeof(char const *), label_sort);
+   for (i = 0; i < jump_target_count; i++) {
+      if (*jump_targets[i].program_text_position == '@')
+         jump_targets[i].target = label_find(labels, nlabels, jump_targets[i].program_text_position);
+   }
+   arena_restore(&load_arena, mark);
+   // end of label addition
+   qsort(jump_targets, jump_target_count, sizeof(struct jump_target), structure_compare);
+}
+/*---------------------------------------------------------------------------*/
+static char const* jump_find(char const *pos) { // return where the token at pos continues (or NULL)
+   int lo = 0;
+   int hi = jump_target_count - 1;
+   int mid;
+   while (lo <= hi) {
+      mid = (lo + hi) / 2;
+      if (jump_targets[mid].program_text_position == pos)
+         return jump_targets[mid].target;
+      if (jump_targets[mid].program_text_position < pos)
+         lo = mid + 1;
+      else
+         hi = mid - 1;
+   }
+   return NULL;
+}
+/*---------------------------------------------------------------------------*/
+static char const* jump_target(char const *pos, int expected) { // return where the structure at pos continues
+   char const *target = jump_find(pos);
+   if (target == NULL)
+      basic_error(UBASIC_ERROR_SYNTAX, expected); // no matching WEND, ENDIF or WHILE
+   return target;
+}
+/*---------------------------------------------------------------------------*/
+static char const* label_target(void) { // return the definition of the current @label
+   char const *target = jump_find(tokenizer_pos());
+   if (target == NULL)
+      basic_error(UBASIC_ERROR_LINE, TOKENIZER_LABEL); // no such label
+   return target;
+}
+/*---------------------------------------------------------------------------*/
+static void statement_end(void) {
+  switch(tokenizer_token()) {
+  case TOKENIZER_COLON:
+    tokenizer_next();
+    break;
+  case TOKENIZER_ELSE:
+    // the THEN part of a single line IF is done, skip the ELSE part
+    tokenizer_goto(jump_target(tokenizer_pos(), TOKENIZER_LF));
+    break;
+  case TOKENIZER_ENDOFINPUT:
+    break;
+  default:
+    accept(TOKENIZER_LF);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void while_statement(void)
+{
+  char const *pos = tokenizer_pos();
+
+  accept(TOKENIZER_WHILE);
+  if(relation()) {
+    statement_end();
+  } else {
+    tokenizer_goto(jump_target(pos, TOKENIZER_WEND));
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void wend_statement(void)
+{
+  tokenizer_goto(jump_target(tokenizer_pos(), TOKENIZER_WHILE));
+}
+/*---------------------------------------------------------------------------*/
+static void else_statement(void)
+{
+  // reached at the end of the THEN part of a block IF
+  tokenizer_goto(jump_target(tokenizer_pos(), TOKENIZER_ENDIF));
+}
+/*---------------------------------------------------------------------------*/
+static void endif_statement(void)
+{
+  accept(TOKENIZER_ENDIF);
+  statement_end();
+}
+// end of structured additions
+// optimizer additions
+/*---------------------------------------------------------------------------*/
+static void finding_add(int kind, int line, int target) {
+   struct ubasic_finding *grown;
+
+   if ((finding_count & (finding_count - 1)) == 0) { // 0, 1, 2, 4 ... grow
+      grown = arena_grow(&load_arena, findings, finding_count * sizeof(struct ubasic_finding),
+                         (finding_count ? 2 * finding_count : 1) * sizeof(struct ubasic_finding));
+      if (grown == NULL)
+         return;
+      findings = grown;
+   }
+   findings[finding_count].kind = kind;
+   findings[finding_count].line = line;
+   findings[finding_count].target = target;
+   finding_count++;
+}
+/*---------------------------------------------------------------------------*/
+static int optimize_line(const char *program, char const *pos) { // return the line pos is on
+   if (line_starts != NULL)
+      return source_line(pos); // the text line of an unnumbered program
+   while (pos > program && pos[-1] != '\n')
+      pos--;
+   return atoi(pos);
+}
+/*---------------------------------------------------------------------------*/
+static int jump_line_compare(const void *a, const void *b) {
+   const struct jump_line *la = a;
+   const struct jump_line *lb = b;
+   if (la->line_number != lb->line_number)
+      return la->line_number < lb->line_number ? -1 : 1;
+   return la->program_text_position < lb->program_text_position ? -1 :
+          la->program_text_position > lb->program_text_position;
+}
+/*---------------------------------------------------------------------------*/
+static char const* jump_line_find(struct jump_line const *lines, int n, int linenum) {
+   // the first line with that number, as jump_linenum_slow() finds it
+   char const *pos = NULL;
+   int lo = 0;
+   int hi = n - 1;
+   int mid;
+   while (lo <= hi) {
+      mid = (lo + hi) / 2;
+      if (lines[mid].line_number < linenum) {
+         lo = mid + 1;
+      } else {
+         if (lines[mid].line_number == linenum)
+            pos = lines[mid].program_text_position;
+         hi = mid - 1;
+      }
+   }
+   return pos;
+}
+/*---------------------------------------------------------------------------*/
+static char const* jump_follow(char const *target) {
+   // where a jump to target ends up once the GOTOs it lands on are taken
+   char const *next;
+   int hops;
+
+   for (hops = 0; hops < MAX_THREAD_HOPS; hops++) {
+      tokenizer_goto(target);
+      if (tokenizer_token() == TOKENIZER_NUMBER || tokenizer_token() == TOKENIZER_LABEL)
+         tokenizer_next(); // the line number or the label definition
+      if (tokenizer_token() == TOKENIZER_COLON)
+         tokenizer_next();
+      if (tokenizer_token() != TOKENIZER_GOTO)
+         break;
+      tokenizer_next();
+      next = jump_find(tokenizer_pos());
+      if (next == NULL || next == target)
+         break; // a bad target is reported where it is, a loop stays a loop
+      target = next;
+   }
+   return target;
+}
+/*---------------------------------------------------------------------------*/
+static void jump_init(const char *program, int report) {
+   // point every GOTO and GOSUB line number at its line, report adds the
+   // ones that have none to the findings
+   struct jump_line *lines;
+   struct jump_target *grown;
+   char const *pos;
+   int nlines = 1, size = jump_target_count, first = jump_target_count;
+   int line_start = 1, prev = TOKENIZER_LF;
+   int i, t;
+
+   jumps_resolved = 0;
+   if (!optimize_enabled)
+      return;
+   for (pos = program; *pos != 0; pos++)
+      if (*pos == '\n')
+         nlines++;
+   if ((lines = arena_alloc(&load_arena, nlines * sizeof(struct jump_line))) == NULL)
+      return; // jumps search for their lines as they run
+   nlines = 0;
+   tokenizer_init(program);
+   while (!tokenizer_finished()) {
+      t = tokenizer_token();
+      if (t == TOKENIZER_NUMBER && line_start) {
+         lines[nlines].line_number = tokenizer_num();
+         lines[nlines].program_text_position = tokenizer_pos();
+         nlines++;
+      } else if (t == TOKENIZER_NUMBER && (prev == TOKENIZER_GOTO || prev == TOKENIZER_GOSUB)) {
+         if (jump_target_count == size) {
+            size = 2 * size + 16;
+            grown = arena_grow(&load_arena, jump_targets, jump_target_count * sizeof(struct jump_target),
+                               size * sizeof(struct jump_target));
+            if (grown == NULL) {
+               jump_target_count = first; // jumps search for their lines as they run
+               return;
+            }
+            jump_targets = grown;
+         }
+         structure_add(tokenizer_pos());
+      }
+      line_start = (t == TOKENIZER_LF);
+      prev = t;
+      tokenizer_next();
+   }
+   qsort(lines, nlines, sizeof(struct jump_line), jump_line_compare);
+   for (i = 0; i < jump_target_count; i++) {
+      pos = jump_targets[i].program_text_position;
+      if (*pos >= '0' && *pos <= '9') {
+         jump_targets[i].target = jump_line_find(lines, nlines, atoi(pos));
+         if (jump_targets[i].target == NULL && report)
+            finding_add(UBASIC_FINDING_TARGET, optimize_line(program, pos), atoi(pos));
+      } else if (*pos == '@' && jump_targets[i].target == NULL && report) {
+         finding_add(UBASIC_FINDING_TARGET, optimize_line(program, pos), -1);
+      }
+   }
+   qsort(jump_targets, jump_target_count, sizeof(struct jump_target), structure_compare);
+   jumps_resolved = 1;
+}
+/*---------------------------------------------------------------------------*/
+static void jump_thread(const char *program) {
+   // send each jump that lands on a GOTO on to where that GOTO goes, so
+   // GOTO 100 where line 100 is GOTO 200 goes to 200, and add it to the
+   // findings
+   char const *pos, *target;
+   int i;
+
+   if (!jumps_resolved)
+      return;
+   for (i = 0; i < jump_target_count; i++) {
+      pos = jump_targets[i].program_text_position;
+      if (jump_targets[i].target == NULL || !((*pos >= '0' && *pos <= '9') || *pos == '@'))
+         continue;
+      target = jump_follow(jump_targets[i].target);
+      if (target != jump_targets[i].target) {
+         jump_targets[i].target = target;
+         finding_add(UBASIC_FINDING_THREADED, optimize_line(program, pos), optimize_line(program, target));
+      }
+   }
+}
+/*---------------------------------------------------------------------------*/
+static int optimize_jumps(char const *pos) { // return the first jump_targets entry at pos or after
+   int lo = 0;
+   int hi = jump_target_count;
+   int mid;
+   while (lo < hi) {
+      mid = (lo + hi) / 2;
+      if (jump_targets[mid].program_text_position < pos)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return lo;
+}
+/*---------------------------------------------------------------------------*/
+static int optimize_find(char const **starts, int n, char const *pos) { // return the text line holding pos
+   int lo = 0;
+   int hi = n - 1;
+   int mid;
+   while (lo < hi) {
+      mid = (lo + hi + 1) / 2;
+      if (starts[mid] <= pos)
+         lo = mid;
+      else
+         hi = mid - 1;
+   }
+   return lo;
+}
+/*---------------------------------------------------------------------------*/
+static const char* optimize_init(const char *program, int *structured) {
+   // return the program without the lines nothing can reach, going by
+   // the jumps as written; structured is set if the jumps of the program
+   // returned are resolved already. A line is reached from the one before
+   // unless a GOTO, END or RETURN ends it with no jump landing after it,
+   // and from every line with a jump to it. A line holding a token that
+   // structure_init() pairs is kept whether it is reached or not, since
+   // the IF, ELSE, WHILE or WEND at the other end counts on it.
+   char const **starts, **barrier, **last;
+   char const *pos, *end;
+   char *reached, *used, *paired, *p;
+   int *queue;
+   int n, i, l, t, head, tail, dropped = 0;
+   int start, line_head;
+
+   optimized_program = NULL;
+   finding_count = 0;
+   *structured = 0;
+   if (!optimize_enabled)
+      return program;
+   structure_init(program);
+   jump_init(program, 1);
+   *structured = 1;
+
+   n = 1;
+   for (end = program; *end != 0; end++)
+      if (*end == '\n')
+         n++;
+   // arena addition - these last until the arena is rewound
+   starts = arena_alloc(&load_arena, n * sizeof(char const *));
+   barrier = arena_alloc(&load_arena, n * sizeof(char const *)); // the last GOTO, END or RETURN statement
+   last = arena_alloc(&load_arena, n * sizeof(char const *));    // the last place a jump lands
+   reached = arena_alloc(&load_arena, n);
+   used = arena_alloc(&load_arena, n);                           // holds a statement
+   paired = arena_alloc(&load_arena, n);                         // holds a block or PARFOR token
+   queue = arena_alloc(&load_arena, n * sizeof(int));
+   if (starts == NULL || barrier == NULL || last == NULL || reached == NULL ||
+       used == NULL || paired == NULL || queue == NULL)
+      return program; // run as written
+   memset(barrier, 0, n * sizeof(char const *));
+   memset(last, 0, n * sizeof(char const *));
+   memset(reached, 0, n);
+   memset(used, 0, n);
+   memset(paired, 0, n);
+   // end of arena addition
+   n = 0;
+   starts[n++] = program;
+   for (pos = program; pos < end; pos++)
+      if (*pos == '\n')
+         starts[n++] = pos + 1;
+
+   for (i = 0; i < jump_target_count; i++) {
+      pos = jump_targets[i].target;
+      if (pos != NULL && pos < end) {
+         l = optimize_find(starts, n, pos);
+         if (pos > last[l])
+            last[l] = pos;
+      }
+   }
+   tokenizer_init(program);
+   l = 0;
+   start = line_head = 1;
+   while (!tokenizer_finished()) {
+      t = tokenizer_token();
+      pos = tokenizer_pos();
+      while (l + 1 < n && starts[l + 1] <= pos) {
+         l++;
+         start = line_head = 1;
+      }
+      if (t == TOKENIZER_NUMBER && line_head) {
+         line_head = 0;
+         tokenizer_next();
+         continue;
+      }
+      line_head = 0;
+      if (t != TOKENIZER_LF)
+         used[l] = 1;
+      if (t == TOKENIZER_IF || t == TOKENIZER_ELSE || t == TOKENIZER_ENDIF ||
+          t == TOKENIZER_WHILE || t == TOKENIZER_WEND ||
+          t == TOKENIZER_PARFOR || t == TOKENIZER_NEXT)
+         paired[l] = 1;
+      if (start && (t == TOKENIZER_GOTO || t == TOKENIZER_END || t == TOKENIZER_RETURN))
+         barrier[l] = pos;
+      if (!(start && t == TOKENIZER_LABEL))
+         start = (t == TOKENIZER_COLON || t == TOKENIZER_THEN || t == TOKENIZER_ELSE);
+      tokenizer_next();
+   }
+
+   // jump_targets is sorted by position, so the jumps of a line are together
+   head = tail = 0;
+   reached[0] = 1;
+   queue[tail++] = 0;
+   while (head < tail) {
+      l = queue[head++];
+      if (l + 1 < n && !reached[l + 1] &&
+          (barrier[l] == NULL || (last[l] != NULL && last[l] > barrier[l]))) {
+         reached[l + 1] = 1;
+         queue[tail++] = l + 1;
+      }
+      for (i = optimize_jumps(starts[l]); i < jump_target_count && (l + 1 == n || jump_targets[i].program_text_position < starts[l + 1]); i++) {
+         pos = jump_targets[i].target;
+         if (pos != NULL && pos < end) {
+            t = optimize_find(starts, n, pos);
+            if (!reached[t]) {
+               reached[t] = 1;
+               queue[tail++] = t;
+            }
+         }
+      }
+   }
+   for (l = 0; l < n; l++) {
+      if (!reached[l] && paired[l])
+         reached[l] = 1; // kept, though nothing runs into it
+      if (!reached[l]) {
+         dropped++;
+         if (used[l])
+            finding_add(UBASIC_FINDING_UNREACHABLE, line_starts != NULL ? l + 1 : atoi(starts[l]), 0);
+      }
+   }
+   if (dropped > 0 && (optimized_program = arena_alloc(&load_arena, end - program + 1)) != NULL) {
+      p = optimized_program;
+      for (l = 0; l < n; l++) {
+         pos = l + 1 < n ? starts[l + 1] : end;
+         if (reached[l]) {
+            memcpy(p, starts[l], pos - starts[l]);
+            p += pos - starts[l];
+         } else if (line_starts != NULL && l + 1 < n) {
+            *p++ = '\n'; // keep the text lines where they were
+         }
+      }
+      *p = 0;
+      program = optimized_program;
+      *structured = 0;
+   }
+   return program;
+}
+/*---------------------------------------------------------------------------*/
+static char const* line_target(void) { // return the line of the current GOTO or GOSUB number
+   char const *target = jump_find(tokenizer_pos());
+   if (target == NULL)
+      basic_error(UBASIC_ERROR_LINE, TOKENIZER_NUMBER); // no such line
+   return target;
+}
+/*---------------------------------------------------------------------------*/
+void ubasic_set_optimize(int on)
+{
+  optimize_enabled = on;
+}
+/*---------------------------------------------------------------------------*/
+int ubasic_findings(struct ubasic_finding *list, int max)
+{
+  int i;
+
+  for(i = 0; i < finding_count && i < max; i++) {
+    list[i] = findings[i];
+  }
+  return finding_count;
+}
+// end of optimizer additions
+/*---------------------------------------------------------------------------*/
+static void goto_statement(void)
+{
+  accept(TOKENIZER_GOTO);
+  // label addition
+  if(tokenizer_token() == TOKENIZER_LABEL) {
+    tokenizer_goto(label_target());
+    return;
+  }
+  // end of label addition
+  // optimizer addition - a line number resolved at load time
+  if(jumps_resolved) {
+    tokenizer_goto(line_target());
+    return;
+  }
+  // end of optimizer addition
+  jump_linenum(tokenizer_num());
+}
+/*---------------------------------------------------------------------------*/
+static void print_statement(void) {
+// string additions
+  static THREAD_LOCAL char buf[MAX_STRINGVARLEN + NUM_FORMATLEN];
+  char num[NUM_FORMATLEN]; // fraction addition
+  buf[0]=0;
+
+  accept(TOKENIZER_PRINT);
+  DEBUG_PRINTF("print_statement: Loop.\n");
+  while(tokenizer_token() != TOKENIZER_LF &&
+	tokenizer_token() != TOKENIZER_COLON &&
+	tokenizer_token() != TOKENIZER_ELSE &&
+	tokenizer_token() != TOKENIZER_ENDOFINPUT) {
+    if(tokenizer_token() == TOKENIZER_STRING) {
+      printf("%s", sliteral());
+      tokenizer_next();
+    } else if(tokenizer_token() == TOKENIZER_COMMA) {
+      printf(" ");
+      tokenizer_next();
+    } else if(tokenizer_token() == TOKENIZER_SEMICOLON) {
+      tokenizer_next();
+    } else if(tokenizer_token() == TOKENIZER_VARIABLE ||
+          tokenizer_token() == TOKENIZER_NUMBER) {
+      printf("%s", num_format(num, expr()));
+	} else if (tokenizer_token() == TOKENIZER_CR){
+		tokenizer_next();
+    } else {
+      if (tokenizer_stringlookahead()) {
+          sprintf(buf+strlen(buf), "%s", sexpr());
+      } else {
+         num_format(buf+strlen(buf), expr());
+	  }
+	  // end of string additions
+	  break;
+	  
+    }
+  }
+  printf(buf);
+  printf("\n");
+  DEBUG_PRINTF("print_statement: End of print.\n");
+  statement_end();
+}
+/*---------------------------------------------------------------------------*/
+static void if_statement(void){
+  char const *pos = tokenizer_pos(); // structured addition
+  int r;
+  
+  accept(TOKENIZER_IF);
+
+  r = relation();
+  DEBUG_PRINTF("if_statement: relation %d.\n", r);
+  accept(TOKENIZER_THEN);
+  // structured addition - THEN at the end of the line opens a block IF
+  if(tokenizer_token() == TOKENIZER_LF) {
+    if(!r) {
+      tokenizer_goto(jump_target(pos, TOKENIZER_ENDIF));
+    } else if(tokenizer_token() == TOKENIZER_LF) {
+      tokenizer_next();
+    }
+    return;
+  }
+  // end of structured addition
+  if(r) {
+    statement();
+  } else {
+    tokenizer_goto(jump_target(pos, TOKENIZER_ELSE));
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void let_statement(void){
+// string additions here
+  int var;
+  if (tokenizer_token() == TOKENIZER_VARIABLE) {
+     var = tokenizer_variable_num();
+     accept(TOKENIZER_VARIABLE);
+     accept(TOKENIZER_EQ);
+     set_variable(var, expr());
+     DEBUG_PRINTF("let_statement: assign %d to %d.\n", variables[var], var);
+     statement_end();
+  } else if (tokenizer_token() == TOKENIZER_STRINGVARIABLE) {
+     var = tokenizer_variable_num();
+	 accept(TOKENIZER_STRINGVARIABLE);
+     accept(TOKENIZER_EQ);
+	 set_stringvariable(var, sexpr());
+	 DEBUG_PRINTF("let_statement: string assign '%s' to %d\n", stringvariables[var], var);
+	 statement_end();
+
+  }
+  // end of string additions
+}
+/*---------------------------------------------------------------------------*/
+static void
+gosub_statement(void)
+{
+  int linenum;
+  char const *target = NULL; // label addition
+  accept(TOKENIZER_GOSUB);
+  // label addition
+  if(tokenizer_token() == TOKENIZER_LABEL) {
+    target = label_target();
+    linenum = source_line(target);
+    accept(TOKENIZER_LABEL);
+  } else {
+  // end of label addition
+    linenum = tokenizer_num();
+    // optimizer addition - a line number resolved at load time
+    if(jumps_resolved) {
+      target = line_target();
+    }
+    // end of optimizer addition
+    accept(TOKENIZER_NUMBER);
+  }
+  statement_end();
+  if(gosub_stack_ptr < MAX_GOSUB_STACK_DEPTH) {
+    TRACE(UBASIC_TRACE_GOSUB, linenum, current_linenum);
+    gosub_stack[gosub_stack_ptr].return_position = tokenizer_pos();
+    gosub_stack[gosub_stack_ptr].line_number = current_linenum;
+    gosub_stack[gosub_stack_ptr].target_line = linenum; // sampler addition
+    gosub_stack_ptr++;
+    if(target != NULL) {
+      tokenizer_goto(target);
+    } else {
+      jump_linenum(linenum);
+    }
+  } else {
+    DEBUG_PRINTF("gosub_statement: gosub stack exhausted.\n");
+    basic_error(UBASIC_ERROR_STACK, TOKENIZER_ERROR);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void return_statement(void){
+  accept(TOKENIZER_RETURN);
+  if(gosub_stack_ptr > 0) {
+    gosub_stack_ptr--;
+    TRACE(UBASIC_TRACE_RETURN, gosub_stack[gosub_stack_ptr].line_number, 0);
+    current_linenum = gosub_stack[gosub_stack_ptr].line_number;
+    tokenizer_goto(gosub_stack[gosub_stack_ptr].return_position);
+  } else {
+    DEBUG_PRINTF("return_statement: non-matching return.\n");
+    basic_error(UBASIC_ERROR_STACK, TOKENIZER_ERROR);
+  }
+}
+// sampler addition
+/*---------------------------------------------------------------------------*/
+int ubasic_call_stack(int *lines, int max)
+{
+  // only reads, so that a signal handler can call it while a statement runs
+  int i, n;
+
+  if(program_ptr == NULL || max <= 0) {
+    return 0;
+  }
+  n = gosub_stack_ptr < max - 1 ? gosub_stack_ptr : max - 1;
+  for(i = 0; i < n; i++) {
+    lines[i] = gosub_stack[i].target_line;
+  }
+  lines[n] = current_linenum;
+  return n + 1;
+}
+// end of sampler addition
+/*---------------------------------------------------------------------------*/
+static void next_statement(void){
+  int var;
+
+  accept(TOKENIZER_NEXT);
+  var = tokenizer_variable_num();
+  accept(TOKENIZER_VARIABLE);
+  if(for_stack_ptr > 0 &&
+     var == for_stack[for_stack_ptr - 1].for_variable) {
+    set_variable(var,
+                 ubasic_get_variable(var) + num_from_int(1));
+    if(ubasic_get_variable(var) <= for_stack[for_stack_ptr - 1].to) {
+      current_linenum = for_stack[for_stack_ptr - 1].line_number;
+      tokenizer_goto(for_stack[for_stack_ptr - 1].position_after_for);
+    } else {
+      for_stack_ptr--;
+      statement_end();
+    }
+  } else {
+    DEBUG_PRINTF("next_statement: no FOR open for variable %d.\n", var);
+    basic_error(UBASIC_ERROR_STACK, TOKENIZER_ERROR);
+  }
+
+}
+/*---------------------------------------------------------------------------*/
+static void for_statement(void) {
+  int for_variable;
+  VARIABLE_TYPE to;
+
+  accept(TOKENIZER_FOR);
+  for_variable = tokenizer_variable_num();
+  accept(TOKENIZER_VARIABLE);
+  accept(TOKENIZER_EQ);
+  set_variable(for_variable, expr());
+  accept(TOKENIZER_TO);
+  to = expr();
+  statement_end();
+
+  if(for_stack_ptr < MAX_FOR_STACK_DEPTH) {
+    for_stack[for_stack_ptr].position_after_for = tokenizer_pos();
+    for_stack[for_stack_ptr].line_number = current_linenum;
     for_stack[for_stack_ptr].for_variable = for_variable;
     for_stack[for_stack_ptr].to = to;
-    DEBUG_PRINTF("for_statement: new for, var %d to %d.\n",
+    DEBUG_PRINTF("for_statement: new for, var %d to %ld.\n",
                 for_stack[for_stack_ptr].for_variable,
-                for_stack[for_stack_ptr].to);
+                (long)for_stack[for_stack_ptr].to);
+
+    for_stack_ptr++;
+  } else {
+    DEBUG_PRINTF("for_statement: for stack depth exceeded.\n");
+    basic_error(UBASIC_ERROR_STACK, TOKENIZER_ERROR);
+  }
+}
+/*---------------------------------------------------------------------------*/
+// block additions
+/*---------------------------------------------------------------------------*/
+static void peek_block(VARIABLE_TYPE addr, VARIABLE_TYPE *dst, int n){
+  int i;
+
+  if(REPLAYING) { // replay addition
+    replay_get(REPLAY_BLOCK);
+    if(replay_read() != (unsigned long long)n) {
+      basic_error(UBASIC_ERROR_REPLAY, TOKENIZER_ERROR);
+    }
+    for(i = 0; i < n; i++) {
+      dst[i] = replay_read_num();
+    }
+  } else if(peek_block_function != NULL) {
+    peek_block_function(addr, dst, n);
+  } else if(peek_function != NULL) {
+    for(i = 0; i < n; i++) {
+      dst[i] = peek_function(addr + i);
+    }
+  } else {
+    basic_error(UBASIC_ERROR_STATEMENT, TOKENIZER_ERROR);
+  }
+  if(RECORDING) { // replay addition
+    replay_put(REPLAY_BLOCK);
+    replay_write(n);
+    for(i = 0; i < n; i++) {
+      replay_write_num(dst[i]);
+    }
+  }
+  TRACE(UBASIC_TRACE_PEEK_BLOCK, addr, n);
+}
+/*---------------------------------------------------------------------------*/
+static void poke_block(VARIABLE_TYPE addr, VARIABLE_TYPE const *src, int n){
+  int i;
+
+  TRACE(UBASIC_TRACE_POKE_BLOCK, addr, n);
+  if(poke_block_function != NULL) {
+    poke_block_function(addr, src, n);
+  } else if(poke_function != NULL) {
+    for(i = 0; i < n; i++) {
+      poke_function(addr + i, src[i]);
+    }
+  } else {
+    basic_error(UBASIC_ERROR_STATEMENT, TOKENIZER_ERROR);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int variable_range(int first){
+  // parse "TO v" after the first variable of a block transfer, returning
+  // the number of variables
+  int last;
+
+  accept(TOKENIZER_TO);
+  last = tokenizer_variable_num();
+  accept(TOKENIZER_VARIABLE);
+  if(last < first || first < 0 || last >= MAX_VARNUM) {
+    basic_error(UBASIC_ERROR_SYNTAX, TOKENIZER_VARIABLE);
+  }
+  return last - first + 1;
+}
+// end of block additions
+/*---------------------------------------------------------------------------*/
+static void peek_statement(void){
+  VARIABLE_TYPE peek_addr;
+  VARIABLE_TYPE value;
+  VARIABLE_TYPE values[MAX_STRINGVARLEN];
+  int var;
+  int n;
+
+  accept(TOKENIZER_PEEK);
+  peek_addr = num_int(expr());
+  accept(TOKENIZER_COMMA);
+  var = tokenizer_variable_num();
+
+  // block addition
+  if(tokenizer_token() == TOKENIZER_STRINGVARIABLE) {
+    accept(TOKENIZER_STRINGVARIABLE);
+    accept(TOKENIZER_COMMA);
+    n = num_int(expr());
+    statement_end();
+    if(n < 0 || n > MAX_STRINGVARLEN) {
+      n = MAX_STRINGVARLEN;
+    }
+    peek_block(peek_addr, values, n);
+    set_stringvariable(var, sfromvalues(values, n));
+    return;
+  }
+  accept(TOKENIZER_VARIABLE);
+  if(tokenizer_token() == TOKENIZER_TO) {
+    n = variable_range(var);
+    statement_end();
+    peek_block(peek_addr, variables + var, n);
+    while(fraction_bits != 0 && n-- > 0) { // fraction addition
+      variables[var + n] = num_from_int(variables[var + n]);
+    }
+    return;
+  }
+  // end of block addition
+  statement_end();
+
+  if(REPLAYING) { // replay addition
+    value = replay_get_num(REPLAY_PEEK);
+  } else if(peek_async_function != NULL) {
+    async_calling = 1;
+    async_resumed = 0;
+    n = peek_async_function(peek_addr, &value);
+    async_calling = 0;
+    if(n == UBASIC_PENDING) {
+      if(!async_resumed) {
+        pending = 1;
+        pending_var = var;
+        pending_addr = peek_addr;
+        return;
+      }
+      value = async_value; // ubasic_resume() came before the callback returned
+    }
+  } else if(peek_function != NULL) {
+    value = peek_function(peek_addr);
+  } else {
+    basic_error(UBASIC_ERROR_STATEMENT, TOKENIZER_ERROR);
+  }
+  if(RECORDING) { // replay addition
+    replay_put_num(REPLAY_PEEK, value);
+  }
+  set_variable(var, num_from_int(value));
+  TRACE(UBASIC_TRACE_PEEK, peek_addr, value);
+}
+/*---------------------------------------------------------------------------*/
+static void poke_statement(void)
+{
+  VARIABLE_TYPE poke_addr;
+  VARIABLE_TYPE value;
+  VARIABLE_TYPE values[MAX_STRINGVARLEN];
+  char *s;
+  int var = -1;
+  int n, i;
+
+  accept(TOKENIZER_POKE);
+  poke_addr = num_int(expr());
+  accept(TOKENIZER_COMMA);
+
+  // block addition
+  if(tokenizer_token() == TOKENIZER_STRINGVARIABLE) {
+    s = sexpr();
+    statement_end();
+    for(n = 0; n < MAX_STRINGVARLEN && s[n] != 0; n++) {
+      values[n] = (unsigned char)s[n];
+    }
+    poke_block(poke_addr, values, n);
+    return;
+  }
+  if(tokenizer_token() == TOKENIZER_VARIABLE) {
+    var = tokenizer_variable_num();
+  }
+  // end of block addition
+  value = expr();
+  // block addition
+  if(var >= 0 && tokenizer_token() == TOKENIZER_TO) {
+    n = variable_range(var);
+    statement_end();
+    if(fraction_bits != 0) { // fraction addition - the host sees integers
+      for(i = 0; i < n; i++) {
+        values[i] = num_int(variables[var + i]);
+      }
+      poke_block(poke_addr, values, n);
+      return;
+    }
+    poke_block(poke_addr, variables + var, n);
+    return;
+  }
+  // end of block addition
+  statement_end();
+
+  value = num_int(value); // fraction addition
+  TRACE(UBASIC_TRACE_POKE, poke_addr, value);
+  if(poke_async_function != NULL) {
+    async_calling = 1;
+    async_resumed = 0;
+    n = poke_async_function(poke_addr, value);
+    async_calling = 0;
+    if(n == UBASIC_PENDING && !async_resumed) {
+      pending = 1;
+      pending_var = -1;
+      pending_addr = poke_addr;
+    }
+  } else if(poke_function != NULL) {
+    poke_function(poke_addr, value);
+  } else {
+    basic_error(UBASIC_ERROR_STATEMENT, TOKENIZER_ERROR);
+  }
+}
+// input additions
+/*---------------------------------------------------------------------------*/
+static void input_statement(void)
+{
+  char *line;
+  int var;
+
+  accept(TOKENIZER_INPUT);
+  line = input_line();
+  for (;;) {
+    var = tokenizer_variable_num();
+    if (tokenizer_token() == TOKENIZER_STRINGVARIABLE) {
+      accept(TOKENIZER_STRINGVARIABLE);
+      set_stringvariable(var, input_field(&line));
+    } else {
+      accept(TOKENIZER_VARIABLE);
+      set_variable(var, num_parse(input_field(&line)));
+    }
+    if (tokenizer_token() != TOKENIZER_COMMA)
+      break;
+    accept(TOKENIZER_COMMA);
+  }
+  statement_end();
+}
+/*---------------------------------------------------------------------------*/
+static void line_input_statement(void)
+{
+  char *line;
+  int var;
+
+  accept(TOKENIZER_LINE);
+  accept(TOKENIZER_INPUT);
+  var = tokenizer_variable_num();
+  accept(TOKENIZER_STRINGVARIABLE);
+  statement_end();
+
+  line = input_line();
+  set_stringvariable(var, line != NULL ? line : (char *)nullstring);
+}
+// end of input additions
+// scheduler additions
+/*---------------------------------------------------------------------------*/
+static void sleep_statement(void)
+{
+  int ms;
+
+  accept(TOKENIZER_SLEEP);
+  ms = num_int(expr());
+  statement_end();
+  yield_time = ms > 0 ? ms : 0;
+}
+/*---------------------------------------------------------------------------*/
+static void yield_statement(void)
+{
+  accept(TOKENIZER_YIELD);
+  statement_end();
+  yield_time = 0;
+}
+// end of scheduler additions
+/*---------------------------------------------------------------------------*/
+// label additions
+/*---------------------------------------------------------------------------*/
+static void label_statement(void)
+{
+  // a label definition, the statement after it runs next
+  accept(TOKENIZER_LABEL);
+  if(tokenizer_token() == TOKENIZER_COLON) {
+    tokenizer_next();
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void text_line(void)
+{
+  // an unnumbered program reports the text line instead of a line number
+  int line = source_line(tokenizer_pos());
+
+  if(line != current_linenum) {
+    current_linenum = line;
+    TRACE(UBASIC_TRACE_LINE, line, 0);
+  }
+}
+// end of label additions
+// call additions
+/*---------------------------------------------------------------------------*/
+static int name_len(char const *pos) { // return the length of the function name at pos
+   char const *p = pos;
+   while (isalnum((unsigned char)*p) || *p == '_')
+      p++;
+   if (*p == '$')
+      p++;
+   return p - pos;
+}
+/*---------------------------------------------------------------------------*/
+static void call_init(const char *program) {
+   // find the host function of every CALL once, so that a call only
+   // looks up its position
+   int n = 0;
+   int l, i;
+   char const *pos;
+
+   call_sites = NULL;
+   call_site_count = 0;
+   tokenizer_init(program);
+   while (!tokenizer_finished()) {
+      if (tokenizer_token() == TOKENIZER_NAME)
+         n++;
+      tokenizer_next();
+   }
+   if (n == 0)
+      return;
+   call_sites = arena_alloc(&load_arena, n * sizeof(struct call_site));
+   tokenizer_init(program);
+   while (!tokenizer_finished()) {
+      if (tokenizer_token() == TOKENIZER_NAME) {
+         pos = tokenizer_pos();
+         l = name_len(pos);
+         call_sites[call_site_count].program_text_position = pos;
+         call_sites[call_site_count].function = -1;
+         for (i = 0; i < function_count; i++) {
+            if (strncmp(functions[i].name, pos, l) == 0 && functions[i].name[l] == 0) {
+               call_sites[call_site_count].function = i;
+               break;
+            }
+         }
+         call_site_count++;
+      }
+      tokenizer_next();
+   }
+}
+/*---------------------------------------------------------------------------*/
+int ubasic_register_function(const char *name, call_func fn, int arity, const char *types) {
+   int i, l;
+
+   l = strlen(name);
+   if (l == 0 || l > MAX_NAMELEN || arity < 0 || arity > MAX_CALL_ARGS ||
+       (int)strlen(types) != arity + 1 || strspn(types, "ns") != strlen(types) ||
+       (name[l - 1] == '$') != (types[0] == 's'))
+      return -1;
+   for (i = 0; i < function_count && strcmp(functions[i].name, name) != 0; i++)
+      ;
+   if (i == MAX_FUNCTIONS)
+      return -1;
+   if (i == function_count)
+      function_count++;
+   strcpy(functions[i].name, name);
+   strcpy(functions[i].types, types);
+   functions[i].fn = fn;
+   functions[i].arity = arity;
+   return 0;
+}
+/*---------------------------------------------------------------------------*/
+static union ubasic_value call_function(int type) { // run CALL name(args), type is 'n', 's' or 0 for either
+   union ubasic_value args[MAX_CALL_ARGS];
+   union ubasic_value result;
+   struct host_function *f = NULL;
+   char const *pos;
+   int lo, hi, mid, i;
+
+   accept(TOKENIZER_CALL);
+   pos = tokenizer_pos();
+   lo = 0;
+   hi = call_site_count - 1;
+   while (lo <= hi) {
+      mid = (lo + hi) / 2;
+      if (call_sites[mid].program_text_position == pos) {
+         if (call_sites[mid].function >= 0)
+            f = functions + call_sites[mid].function;
+         break;
+      }
+      if (call_sites[mid].program_text_position < pos)
+         lo = mid + 1;
+      else
+         hi = mid - 1;
+   }
+   if (f == NULL)
+      basic_error(UBASIC_ERROR_STATEMENT, TOKENIZER_ERROR); // no such function
+   if (type != 0 && f->types[0] != type)
+      basic_error(UBASIC_ERROR_SYNTAX, type == 's' ? TOKENIZER_STRINGVARIABLE : TOKENIZER_VARIABLE);
+   accept(TOKENIZER_NAME);
+   accept(TOKENIZER_LEFTPAREN);
+   for (i = 0; i < f->arity; i++) {
+      if (i > 0)
+         accept(TOKENIZER_COMMA);
+      if (f->types[i + 1] == 's')
+         args[i].str = sexpr();
+      else
+         args[i].num = num_int(expr());
+   }
+   accept(TOKENIZER_RIGHTPAREN);
+   // replay addition - the host function is not called while replaying
+   if (REPLAYING) {
+      if (f->types[0] == 's')
+         result.str = replay_get_str(REPLAY_CALLSTR);
+      else
+         result.num = replay_get_num(REPLAY_CALL);
+      return result;
+   }
+   result = f->fn(args);
+   if (RECORDING) {
+      if (f->types[0] == 's')
+         replay_put_str(REPLAY_CALLSTR, result.str != NULL ? result.str : nullstring);
+      else
+         replay_put_num(REPLAY_CALL, result.num);
+   }
+   // end of replay addition
+   return result;
+}
+// end of call additions
+// parallel additions
+/*---------------------------------------------------------------------------*/
+static void parfor_slice_run(struct parfor_slice *slice)
+{
+  // run a slice of the iterations in an interpreter of its own
+  VARIABLE_TYPE one = num_from_int(1);
+  long i;
+  int r;
+
+  ubasic_context_load(slice->parent);
+  // the parent's strings are only read, never moved; the slice's own come
+  // from an arena of its own (arena addition)
+  memset(&run_arena, 0, sizeof(run_arena));
+  heap_init();
+  peek_async_function = NULL; // a slice cannot park
+  poke_async_function = NULL;
+  for_stack_ptr = 0;
+  for(r = 0; r < slice->reduce_count; r++) {
+    if(slice->reduce_op[r] == TOKENIZER_SUM) {
+      variables[slice->reduce_var[r]] = 0;
+    }
+  }
+  slice->error.kind = UBASIC_ERROR_NONE;
+  if(setjmp(error_jmp) == 0) {
+    for(i = 0; i < slice->count; i++) {
+      variables[slice->var] = slice->first + i * one;
+      tokenizer_goto(slice->body);
+      while(tokenizer_pos() != slice->end) {
+        if(tokenizer_finished()) {
+          basic_error(UBASIC_ERROR_SYNTAX, TOKENIZER_NEXT);
+        }
+        if(tokenizer_token() == TOKENIZER_NUMBER) {
+          current_linenum = tokenizer_num(); // the line index is shared, leave it be
+          tokenizer_next();
+          continue;
+        }
+        garbage_collect();
+        if(line_starts != NULL) {
+          text_line();
+        }
+        statement();
+      }
+    }
+  } else {
+    slice->error = error_info;
+  }
+  for(r = 0; r < slice->reduce_count; r++) {
+    slice->result[r] = variables[slice->reduce_var[r]];
+  }
+  arena_free(&run_arena); // arena addition
+}
+/*---------------------------------------------------------------------------*/
+#if MAX_WORKERS > 1
+#ifdef _WIN32
+static DWORD WINAPI parfor_thread(LPVOID slice)
+{
+  parfor_slice_run(slice);
+  return 0;
+}
+#else
+static void *parfor_thread(void *slice)
+{
+  parfor_slice_run(slice);
+  return NULL;
+}
+#endif
+#endif
+/*---------------------------------------------------------------------------*/
+static void parfor_run(struct parfor_slice *slice, int n)
+{
+  // the first slice runs here, the others on threads of their own
+  jmp_buf caller;
+  int started[MAX_WORKERS];
+  int i;
+#if MAX_WORKERS > 1
+#ifdef _WIN32
+  HANDLE thread[MAX_WORKERS];
+
+  for(i = 1; i < n; i++) {
+    thread[i] = CreateThread(NULL, 0, parfor_thread, slice + i, 0, NULL);
+    started[i] = thread[i] != NULL;
+  }
+#else
+  pthread_t thread[MAX_WORKERS];
+
+  for(i = 1; i < n; i++) {
+    started[i] = pthread_create(&thread[i], NULL, parfor_thread, slice + i) == 0;
+  }
+#endif
+#endif
+  started[0] = 0;
+  memcpy(caller, error_jmp, sizeof(jmp_buf));
+  for(i = 0; i < n; i++) {
+    if(!started[i]) {
+      parfor_slice_run(slice + i);
+    }
+  }
+  memcpy(error_jmp, caller, sizeof(jmp_buf));
+  PROFILE_RESUME(TOKENIZER_PARFOR); // profile addition - waiting is the PARFOR's
+#if MAX_WORKERS > 1
+  for(i = 1; i < n; i++) {
+    if(started[i]) {
+#ifdef _WIN32
+      WaitForSingleObject(thread[i], INFINITE);
+      CloseHandle(thread[i]);
+#else
+      pthread_join(thread[i], NULL);
+#endif
+    }
+  }
+#endif
+}
+/*---------------------------------------------------------------------------*/
+static void parfor_reject(char const *bad)
+{
+  // report what structure_init() found a worker cannot run, from the PARFOR
+  int line_start = 0;
+
+  if(line_starts != NULL) {
+    current_linenum = source_line(bad);
+  } else {
+    while(tokenizer_pos() < bad) {
+      if(line_start && tokenizer_token() == TOKENIZER_NUMBER) {
+        current_linenum = tokenizer_num();
+      }
+      line_start = tokenizer_token() == TOKENIZER_LF;
+      tokenizer_next();
+    }
+  }
+  tokenizer_goto(bad);
+  basic_error(UBASIC_ERROR_STATEMENT, TOKENIZER_ERROR);
+}
+/*---------------------------------------------------------------------------*/
+static void parfor_statement(void)
+{
+  char const *pos = tokenizer_pos();
+  char const *end = jump_target(pos, TOKENIZER_NEXT);
+  struct parfor_slice slice[MAX_WORKERS];
+  struct parfor_slice all;
+  struct ubasic_context *parent = NULL;
+  VARIABLE_TYPE one = num_from_int(1);
+  VARIABLE_TYPE to, v;
+  long count;
+  int n, i, r;
+
+  tokenizer_goto(end);
+  if(tokenizer_token() != TOKENIZER_NEXT) {
+    tokenizer_goto(pos);
+    parfor_reject(end);
+  }
+  tokenizer_goto(pos);
+  accept(TOKENIZER_PARFOR);
+  all.var = tokenizer_variable_num();
+  accept(TOKENIZER_VARIABLE);
+  accept(TOKENIZER_EQ);
+  all.first = expr();
+  accept(TOKENIZER_TO);
+  to = expr();
+  all.reduce_count = 0;
+  if(tokenizer_token() == TOKENIZER_REDUCE) {
+    do {
+      tokenizer_next();
+      r = tokenizer_token();
+      if(r != TOKENIZER_SUM && r != TOKENIZER_MIN && r != TOKENIZER_MAX) {
+        basic_error(UBASIC_ERROR_SYNTAX, TOKENIZER_SUM);
+      }
+      if(all.reduce_count == MAX_REDUCE) {
+        basic_error(UBASIC_ERROR_STACK, TOKENIZER_ERROR);
+      }
+      all.reduce_op[all.reduce_count] = r;
+      tokenizer_next();
+      all.reduce_var[all.reduce_count++] = tokenizer_variable_num();
+      accept(TOKENIZER_VARIABLE);
+    } while(tokenizer_token() == TOKENIZER_COMMA);
+  }
+  statement_end();
+  all.body = tokenizer_pos();
+  all.end = end;
+
+  // split the range into one contiguous slice per worker
+  count = to >= all.first ? (to - all.first) / one + 1 : 0;
+  n = count < workers ? (int)count : workers;
+  if(replay != NULL) {
+    n = 1; // the replay log is read and written in order
+  }
+  if(n > 0) {
+    if((parent = ubasic_context_new()) == NULL) {
+      basic_error(UBASIC_ERROR_MEMORY, TOKENIZER_ERROR);
+    }
+    ubasic_context_save(parent);
+    all.parent = parent;
+    for(i = 0; i < n; i++) {
+      slice[i] = all;
+      slice[i].first = all.first + count * i / n * one;
+      slice[i].count = count * (i + 1) / n - count * i / n;
+    }
+    parfor_run(slice, n);
+    ubasic_context_load(parent);
+    free(parent); // only a copy, everything it points to is still in use
+    for(i = 0; i < n; i++) {
+      if(slice[i].error.kind != UBASIC_ERROR_NONE) {
+        error_info = slice[i].error;
+        ended = 1;
+        longjmp(error_jmp, error_info.kind);
+      }
+    }
+  }
+  for(r = 0; r < all.reduce_count; r++) {
+    v = variables[all.reduce_var[r]];
+    for(i = 0; i < n; i++) {
+      switch(all.reduce_op[r]) {
+      case TOKENIZER_SUM:
+        v += slice[i].result[r];
+        break;
+      case TOKENIZER_MIN:
+        if(slice[i].result[r] < v) {
+          v = slice[i].result[r];
+        }
+        break;
+      default:
+        if(slice[i].result[r] > v) {
+          v = slice[i].result[r];
+        }
+      }
+    }
+    variables[all.reduce_var[r]] = v;
+  }
+  variables[all.var] = all.first + count * one;
+  tokenizer_goto(end);
+  accept(TOKENIZER_NEXT);
+  accept(TOKENIZER_VARIABLE);
+  statement_end();
+}
+/*---------------------------------------------------------------------------*/
+void ubasic_set_workers(int n)
+{
+  workers = n < 1 ? 1 : n > MAX_WORKERS ? MAX_WORKERS : n;
+}
+// end of parallel additions
+// superinstruction additions
+/*---------------------------------------------------------------------------*/
+static int fuse_scan(const char *program, struct fused *sites) {
+   // find the statements that may be fused, or only count them when sites
+   // is NULL
+   int start = 1; // at the start of a statement
+   int line = 1;  // at the start of a line
+   int n = 0;
+   int token;
+
+   tokenizer_init(program);
+   while (!tokenizer_finished()) {
+      token = tokenizer_token();
+      if (token == TOKENIZER_NUMBER && line) {
+         line = 0;
+      } else if (token == TOKENIZER_LF) {
+         start = line = 1;
+      } else if (token == TOKENIZER_COLON || token == TOKENIZER_THEN ||
+                 token == TOKENIZER_ELSE) {
+         start = 1;
+         line = 0;
+      } else if (token == TOKENIZER_LABEL && start) {
+         line = 0; // a label definition, the statement follows it
+      } else {
+         if (start && (token == TOKENIZER_IF || token == TOKENIZER_LET ||
+                       token == TOKENIZER_VARIABLE || token == TOKENIZER_FOR ||
+                       token == TOKENIZER_NEXT || token == TOKENIZER_PRINT)) {
+            if (sites != NULL)
+               sites[n].program_text_position = tokenizer_pos();
+            n++;
+         }
+         start = line = 0;
+      }
+      tokenizer_next();
+   }
+   return n;
+}
+/*---------------------------------------------------------------------------*/
+static int fuse_operand(int *var, VARIABLE_TYPE *value) {
+   // a variable or a constant, as factor() reads it
+   if (tokenizer_token() == TOKENIZER_VARIABLE) {
+      *var = tokenizer_variable_num();
+      *value = 0;
+   } else if (tokenizer_token() == TOKENIZER_NUMBER) {
+      *var = -1;
+      *value = fraction_bits == 0 ? tokenizer_num() : num_parse(tokenizer_pos());
+   } else {
+      return 0;
+   }
+   tokenizer_next();
+   return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int fuse_end(struct fused *f) {
+   // the statement must end the way statement_end() expects, not at an ELSE
+   switch (tokenizer_token()) {
+   case TOKENIZER_LF:
+   case TOKENIZER_COLON:
+      tokenizer_next();
+      break;
+   case TOKENIZER_ENDOFINPUT:
+      break;
+   default:
+      return 0;
+   }
+   f->next = tokenizer_pos();
+   return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int fuse_match(struct fused *f) {
+   // decode the statement at f->program_text_position if it has one of the
+   // fused shapes
+   char const *pos = f->program_text_position;
+   int token;
+
+   tokenizer_goto(pos);
+   f->a_var = f->b_var = -1;
+   f->a = f->b = 0;
+   f->target = NULL;
+   token = tokenizer_token();
+   if (token == TOKENIZER_LET) {
+      tokenizer_next();
+      if (tokenizer_token() != TOKENIZER_VARIABLE)
+         return 0;
+      token = TOKENIZER_VARIABLE;
+   }
+   if (token != TOKENIZER_VARIABLE)
+      tokenizer_next();
+   switch (token) {
+   case TOKENIZER_IF: // IF v relop k THEN GOTO n
+      f->kind = UBASIC_FUSED_IF_GOTO;
+      if (tokenizer_token() != TOKENIZER_VARIABLE)
+         return 0;
+      f->var = tokenizer_variable_num();
+      tokenizer_next();
+      f->op = tokenizer_token();
+      if (f->op != TOKENIZER_LT && f->op != TOKENIZER_GT && f->op != TOKENIZER_EQ &&
+          f->op != TOKENIZER_LE && f->op != TOKENIZER_GE && f->op != TOKENIZER_NE)
+         return 0;
+      tokenizer_next();
+      if (tokenizer_token() != TOKENIZER_NUMBER || !fuse_operand(&f->b_var, &f->b))
+         return 0;
+      if (tokenizer_token() != TOKENIZER_THEN)
+         return 0;
+      tokenizer_next();
+      if (tokenizer_token() != TOKENIZER_GOTO)
+         return 0;
+      tokenizer_next();
+      if (tokenizer_token() == TOKENIZER_LABEL || tokenizer_token() == TOKENIZER_NUMBER)
+         f->target = jump_find(tokenizer_pos()); // resolved by jump_init()
+      if (f->target == NULL)
+         return 0; // left for GOTO to report
+      tokenizer_next();
+      if (!fuse_end(f))
+         return 0;
+      f->next = jump_find(pos); // a false IF skips the rest of its line
+      return f->next != NULL;
+   case TOKENIZER_VARIABLE: // LET v = w + k
+      f->kind = UBASIC_FUSED_ADD;
+      f->var = tokenizer_variable_num();
+      tokenizer_next();
+      if (tokenizer_token() != TOKENIZER_EQ)
+         return 0;
+      tokenizer_next();
+      if (tokenizer_token() != TOKENIZER_VARIABLE || !fuse_operand(&f->a_var, &f->a))
+         return 0;
+      f->op = tokenizer_token();
+      if (f->op != TOKENIZER_PLUS && f->op != TOKENIZER_MINUS)
+         return 0;
+      tokenizer_next();
+      if (tokenizer_token() != TOKENIZER_NUMBER || !fuse_operand(&f->b_var, &f->b))
+         return 0;
+      return fuse_end(f);
+   case TOKENIZER_FOR: // FOR v = a TO b
+      f->kind = UBASIC_FUSED_FOR;
+      if (tokenizer_token() != TOKENIZER_VARIABLE)
+         return 0;
+      f->var = tokenizer_variable_num();
+      tokenizer_next();
+      if (tokenizer_token() != TOKENIZER_EQ)
+         return 0;
+      tokenizer_next();
+      if (!fuse_operand(&f->a_var, &f->a) || tokenizer_token() != TOKENIZER_TO)
+         return 0;
+      tokenizer_next();
+      if (!fuse_operand(&f->b_var, &f->b))
+         return 0;
+      return fuse_end(f);
+   case TOKENIZER_NEXT: // NEXT v, the other end of the loop
+   case TOKENIZER_PRINT: // PRINT v
+      f->kind = token == TOKENIZER_NEXT ? UBASIC_FUSED_NEXT : UBASIC_FUSED_PRINT;
+      if (tokenizer_token() != TOKENIZER_VARIABLE)
+         return 0;
+      f->var = tokenizer_variable_num();
+      tokenizer_next();
+      return fuse_end(f);
+   }
+   return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void fuse_init(const char *program) {
+   int nsites;
+   int i;
+
+   fused = NULL;
+   fused_count = 0;
+   memset(&fused_stats, 0, sizeof(fused_stats));
+   if (!fused_enabled)
+      return;
+   nsites = fuse_scan(program, NULL);
+   if (nsites == 0)
+      return;
+   fused = arena_alloc(&load_arena, nsites * sizeof(struct fused));
+   if (fused == NULL)
+      return; // everything runs unfused
+   fuse_scan(program, fused);
+   for (i = 0; i < nsites; i++) {
+      if (fuse_match(&fused[i])) {
+         fused[fused_count++] = fused[i];
+         fused_stats.sites[fused[fused_count - 1].kind]++;
+      }
+   }
+}
+/*---------------------------------------------------------------------------*/
+static int fused_statement(int token){
+  // run the statement at the current position if it was fused at load time
+  char num[NUM_FORMATLEN];
+  char const *pos;
+  struct fused *f = NULL;
+  VARIABLE_TYPE v, to;
+  int lo, hi, mid, r;
+
+  switch(token) {
+  case TOKENIZER_IF:
+  case TOKENIZER_LET:
+  case TOKENIZER_VARIABLE:
+  case TOKENIZER_FOR:
+  case TOKENIZER_NEXT:
+  case TOKENIZER_PRINT:
+    break;
+  default:
+    return 0;
+  }
+  pos = tokenizer_pos();
+  lo = 0;
+  hi = fused_count - 1;
+  while(lo <= hi) {
+    mid = (lo + hi) / 2;
+    if(fused[mid].program_text_position == pos) {
+      f = &fused[mid];
+      break;
+    }
+    if(fused[mid].program_text_position < pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  if(f == NULL) {
+    return 0;
+  }
+  fused_stats.hits[f->kind]++;
+  switch(f->kind) {
+  case UBASIC_FUSED_IF_GOTO:
+    v = variables[f->var];
+    switch(f->op) {
+    case TOKENIZER_LT: r = v < f->b; break;
+    case TOKENIZER_GT: r = v > f->b; break;
+    case TOKENIZER_EQ: r = v == f->b; break;
+    case TOKENIZER_LE: r = v <= f->b; break;
+    case TOKENIZER_GE: r = v >= f->b; break;
+    default: r = v != f->b; break;
+    }
+    if(r) {
+      TRACE(UBASIC_TRACE_STATEMENT, TOKENIZER_GOTO, 0);
+      tokenizer_goto(f->target);
+    } else {
+      tokenizer_goto(f->next);
+    }
+    break;
+  case UBASIC_FUSED_ADD:
+    v = variables[f->a_var];
+    set_variable(f->var, f->op == TOKENIZER_PLUS ? v + f->b : v - f->b);
+    tokenizer_goto(f->next);
+    break;
+  case UBASIC_FUSED_FOR:
+    // the same order as for_statement(): the variable is set before TO is read
+    set_variable(f->var, f->a_var >= 0 ? variables[f->a_var] : f->a);
+    to = f->b_var >= 0 ? variables[f->b_var] : f->b;
+    tokenizer_goto(f->next);
+    if(for_stack_ptr < MAX_FOR_STACK_DEPTH) {
+      for_stack[for_stack_ptr].position_after_for = f->next;
+      for_stack[for_stack_ptr].line_number = current_linenum;
+      for_stack[for_stack_ptr].for_variable = f->var;
+      for_stack[for_stack_ptr].to = to;
+      for_stack_ptr++;
+    } else {
+      basic_error(UBASIC_ERROR_STACK, TOKENIZER_ERROR);
+    }
+    break;
+  case UBASIC_FUSED_NEXT:
+    if(for_stack_ptr > 0 &&
+       f->var == for_stack[for_stack_ptr - 1].for_variable) {
+      set_variable(f->var, variables[f->var] + num_from_int(1));
+      if(variables[f->var] <= for_stack[for_stack_ptr - 1].to) {
+        current_linenum = for_stack[for_stack_ptr - 1].line_number;
+        tokenizer_goto(for_stack[for_stack_ptr - 1].position_after_for);
+        break;
+      }
+      for_stack_ptr--;
+    } else {
+      basic_error(UBASIC_ERROR_STACK, TOKENIZER_ERROR);
+    }
+    tokenizer_goto(f->next);
+    break;
+  case UBASIC_FUSED_PRINT:
+    printf("%s\n", num_format(num, variables[f->var]));
+    tokenizer_goto(f->next);
+    break;
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+void ubasic_set_fused(int on)
+{
+  fused_enabled = on;
+}
+/*---------------------------------------------------------------------------*/
+void ubasic_fused_stats(struct ubasic_fused_stats *stats)
+{
+  *stats = fused_stats;
+}
+// end of superinstruction additions
+// vm additions
+enum {
+  VM_LINE, VM_TEXTLINE, VM_STATEMENT,
+  VM_MOVE, VM_LOADK,
+  // register forms, each followed by the form taking b as the constant k
+  VM_ADD, VM_ADDK, VM_SUB, VM_SUBK, VM_MUL, VM_MULK, VM_FMUL, VM_FMULK,
+  VM_DIV, VM_DIVK, VM_FDIV, VM_FDIVK, VM_MOD, VM_MODK,
+  VM_AND, VM_ANDK, VM_OR, VM_ORK,
+  VM_LT, VM_LTK, VM_GT, VM_GTK, VM_EQ, VM_EQK,     // d = 1 or 0, in the order of VM_REL_...
+  VM_LE, VM_LEK, VM_GE, VM_GEK, VM_NE, VM_NEK,
+  VM_BLT, VM_BLTK, VM_BGT, VM_BGTK, VM_BEQ, VM_BEQK, // branch to x
+  VM_BLE, VM_BLEK, VM_BGE, VM_BGEK, VM_BNE, VM_BNEK,
+  VM_BTRUE, VM_BFALSE, VM_JUMP,
+  VM_SLOAD, VM_SMOVE, VM_SCAT, VM_SLEFT, VM_SRIGHT, VM_SMID, VM_SSTR, VM_SCHR,
+  VM_SLEN, VM_SVAL, VM_SASC, VM_SINSTR, VM_SCMP,
+  VM_PRINTLIT, VM_PRINTNUM, VM_PRINTEND,
+  VM_GOSUB, VM_RETURN, VM_FOR, VM_NEXT, VM_END, VM_TREE, VM_EXIT
+};
+enum {
+  VM_REL_LT, VM_REL_GT, VM_REL_EQ, VM_REL_LE, VM_REL_GE, VM_REL_NE
+};
+#define VM_CANNOT 1 // a statement the VM leaves to the tree walker
+#define VM_NOMEM  2 // out of memory, compile no more
+struct vm_compile {
+   jmp_buf *fail;            // where giving up on a statement unwinds to
+   int size;                 // instructions vm_code has room for
+   int temps, stemps;        // temporaries in use
+   int value;                // the instruction that worked out the last value, or -1
+   struct jump_line *lines;  // line numbers, when jump_init() has not resolved them
+   int line_count;
+};
+struct vm_operand {
+   int reg;                  // a register, or -1 for the constant k
+   VARIABLE_TYPE k;
+};
+struct vm_cond {
+   int rel;                  // VM_REL_..., or -1 to test a against 0
+   int negate;
+   struct vm_operand a, b;
+};
+static const unsigned char vm_inverse[] = {VM_REL_GE, VM_REL_LE, VM_REL_NE, VM_REL_GT, VM_REL_LT, VM_REL_EQ};
+static const unsigned char vm_mirror[] = {VM_REL_GT, VM_REL_LT, VM_REL_EQ, VM_REL_GE, VM_REL_LE, VM_REL_NE};
+static int vm_relation(struct vm_compile *);
+static struct vm_operand vm_expr(struct vm_compile *);
+static int vm_sexpr(struct vm_compile *);
+static void vm_statement(struct vm_compile *);
+/*---------------------------------------------------------------------------*/
+static void vm_fail(struct vm_compile *c) {
+   longjmp(*c->fail, VM_CANNOT);
+}
+/*---------------------------------------------------------------------------*/
+static void vm_accept(struct vm_compile *c, int token) {
+   if (tokenizer_token() != token)
+      vm_fail(c); // the tree walker reports the error
+   tokenizer_next();
+}
+/*---------------------------------------------------------------------------*/
+static int vm_emit(struct vm_compile *c, int op, int d, int a, int b) { // return the new instruction
+   struct vm_op *grown;
+   if (vm_code_count == c->size) {
+      grown = arena_grow(&load_arena, vm_code, c->size * sizeof(struct vm_op),
+                         (2 * c->size + 64) * sizeof(struct vm_op));
+      if (grown == NULL)
+         longjmp(*c->fail, VM_NOMEM);
+      vm_code = grown;
+      c->size = 2 * c->size + 64;
+   }
+   memset(&vm_code[vm_code_count], 0, sizeof(struct vm_op));
+   vm_code[vm_code_count].op = op;
+   vm_code[vm_code_count].d = d;
+   vm_code[vm_code_count].a = a;
+   vm_code[vm_code_count].b = b;
+   c->value = -1;
+   return vm_code_count++;
+}
+/*---------------------------------------------------------------------------*/
+static void vm_exit(struct vm_compile *c, char const *pos) {
+   int i = vm_emit(c, VM_EXIT, 0, 0, 0);
+   vm_code[i].u.pos = pos;
+}
+/*---------------------------------------------------------------------------*/
+static void vm_patch(int list, int target) { // point the branches chained through x at target
+   int next;
+   while (list >= 0) {
+      next = vm_code[list].x;
+      vm_code[list].x = target;
+      list = next;
+   }
+}
+/*---------------------------------------------------------------------------*/
+static int vm_temp(struct vm_compile *c) {
+   if (c->temps == VM_TEMPS)
+      vm_fail(c);
+   return MAX_VARNUM + c->temps++;
+}
+/*---------------------------------------------------------------------------*/
+static int vm_stemp(struct vm_compile *c) {
+   if (c->stemps == VM_TEMPS)
+      vm_fail(c);
+   return MAX_SVARNUM + c->stemps++;
+}
+/*---------------------------------------------------------------------------*/
+static int vm_reg(struct vm_compile *c, struct vm_operand *o) { // return the register holding o
+   int i;
+   if (o->reg < 0) {
+      o->reg = vm_temp(c);
+      i = vm_emit(c, VM_LOADK, o->reg, 0, 0);
+      vm_code[i].u.k = o->k;
+      c->value = i;
+   }
+   return o->reg;
+}
+/*---------------------------------------------------------------------------*/
+static int vm_rel(int token) { // return the VM_REL_... of a relational token, or -1
+   switch (token) {
+   case TOKENIZER_LT: return VM_REL_LT;
+   case TOKENIZER_GT: return VM_REL_GT;
+   case TOKENIZER_EQ: return VM_REL_EQ;
+   case TOKENIZER_LE: return VM_REL_LE;
+   case TOKENIZER_GE: return VM_REL_GE;
+   case TOKENIZER_NE: return VM_REL_NE;
+   }
+   return -1;
+}
+/*---------------------------------------------------------------------------*/
+static int vm_compare(int rel, VARIABLE_TYPE a, VARIABLE_TYPE b) {
+   switch (rel) {
+   case VM_REL_LT: return a < b;
+   case VM_REL_GT: return a > b;
+   case VM_REL_EQ: return a == b;
+   case VM_REL_LE: return a <= b;
+   case VM_REL_GE: return a >= b;
+   }
+   return a != b;
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE vm_fold(int op, VARIABLE_TYPE a, VARIABLE_TYPE b) { // work out op on two constants
+   switch (op) {
+   case VM_ADD:  return a + b;
+   case VM_SUB:  return a - b;
+   case VM_MUL:  return a * b;
+   case VM_FMUL: return num_mul(a, b);
+   case VM_DIV:  return a / b;
+   case VM_FDIV: return num_div(a, b);
+   case VM_MOD:  return a % b;
+   case VM_AND:  return a & b;
+   case VM_OR:   return a | b;
+   }
+   return num_from_int(vm_compare((op - VM_LT) / 2, a, b));
+}
+/*---------------------------------------------------------------------------*/
+static struct vm_operand vm_binary(struct vm_compile *c, int op, struct vm_operand a, struct vm_operand b) {
+   // op is the register form of an arithmetic or comparing instruction
+   struct vm_operand r;
+   int divide = op == VM_DIV || op == VM_FDIV || op == VM_MOD;
+   int i;
+   if (a.reg < 0 && b.reg < 0 && !(divide && b.k == 0)) {
+      r.reg = -1;
+      r.k = vm_fold(op, a.k, b.k);
+      return r;
+   }
+   if (a.reg < 0 && b.reg >= 0) {
+      if (op >= VM_LT) {
+         r = a; a = b; b = r;
+         op = VM_LT + 2 * vm_mirror[(op - VM_LT) / 2];
+      } else if (op == VM_ADD || op == VM_MUL || op == VM_FMUL || op == VM_AND || op == VM_OR) {
+         r = a; a = b; b = r;
+      }
+   }
+   if (divide && b.reg < 0 && b.k == 0)
+      vm_reg(c, &b); // divides by zero as it runs, as the tree walker does
+   vm_reg(c, &a);
+   r.k = 0;
+   if (a.reg >= MAX_VARNUM)
+      r.reg = a.reg;
+   else if (b.reg >= MAX_VARNUM)
+      r.reg = b.reg;
+   else
+      r.reg = vm_temp(c);
+   if (b.reg < 0) {
+      i = vm_emit(c, op + 1, r.reg, a.reg, 0);
+      vm_code[i].u.k = b.k;
+   } else {
+      i = vm_emit(c, op, r.reg, a.reg, b.reg);
+      if (b.reg == MAX_VARNUM + c->temps - 1 && b.reg != r.reg)
+         c->temps--;
+   }
+   c->value = i;
+   return r;
+}
+/*---------------------------------------------------------------------------*/
+static int vm_branch(struct vm_compile *c, struct vm_cond *cond, int when, int list) {
+   // add a branch taken when cond is when (1 or 0) to list, return the list
+   struct vm_operand a = cond->a, b = cond->b, t;
+   int truth = when ^ cond->negate;
+   int rel = cond->rel;
+   int i;
+   if (rel < 0 && a.reg < 0) {
+      if ((a.k != 0) != truth)
+         return list; // never taken
+      i = vm_emit(c, VM_JUMP, 0, 0, 0);
+   } else if (rel < 0) {
+      i = vm_emit(c, truth ? VM_BTRUE : VM_BFALSE, 0, a.reg, 0);
+   } else {
+      if (!truth)
+         rel = vm_inverse[rel];
+      if (a.reg < 0 && b.reg < 0) {
+         if (!vm_compare(rel, a.k, b.k))
+            return list;
+         i = vm_emit(c, VM_JUMP, 0, 0, 0);
+      } else {
+         if (a.reg < 0) {
+            t = a; a = b; b = t;
+            rel = vm_mirror[rel];
+         }
+         if (b.reg < 0) {
+            i = vm_emit(c, VM_BLTK + 2 * rel, 0, a.reg, 0);
+            vm_code[i].u.k = b.k;
+         } else {
+            i = vm_emit(c, VM_BLT + 2 * rel, 0, a.reg, b.reg);
+         }
+      }
+   }
+   vm_code[i].x = list;
+   return i;
+}
+/*---------------------------------------------------------------------------*/
+static int vm_sfactor(struct vm_compile *c) { // compile sfactor(), return its string register
+   struct vm_operand o;
+   int op, s, n, j = -1, d, i;
+   switch (tokenizer_token()) {
+   case TOKENIZER_LEFTPAREN:
+      tokenizer_next();
+      s = vm_sexpr(c);
+      vm_accept(c, TOKENIZER_RIGHTPAREN);
+      return s;
+   case TOKENIZER_STRING:
+      d = vm_stemp(c);
+      i = vm_emit(c, VM_SLOAD, d, 0, 0);
+      vm_code[i].u.s = sliteral();
+      c->value = i;
+      tokenizer_next();
+      return d;
+   case TOKENIZER_STRINGVARIABLE:
+      s = tokenizer_variable_num();
+      tokenizer_next();
+      return s;
+   case TOKENIZER_LEFT$:  op = VM_SLEFT; break;
+   case TOKENIZER_RIGHT$: op = VM_SRIGHT; break;
+   case TOKENIZER_MID$:   op = VM_SMID; break;
+   case TOKENIZER_STR$:   op = VM_SSTR; break;
+   case TOKENIZER_CHR$:   op = VM_SCHR; break;
+   default:
+      vm_fail(c); // CALL
+      return 0;
+   }
+   tokenizer_next();
+   if (op == VM_SSTR || op == VM_SCHR) {
+      o = vm_expr(c);
+      n = vm_reg(c, &o);
+      d = vm_stemp(c);
+      c->value = vm_emit(c, op, d, n, 0);
+      return d;
+   }
+   vm_accept(c, TOKENIZER_LEFTPAREN);
+   s = vm_sexpr(c);
+   vm_accept(c, TOKENIZER_COMMA);
+   o = vm_expr(c);
+   n = vm_reg(c, &o);
+   if (op == VM_SMID && tokenizer_token() == TOKENIZER_COMMA) {
+      tokenizer_next();
+      o = vm_expr(c);
+      j = vm_reg(c, &o);
+   }
+   vm_accept(c, TOKENIZER_RIGHTPAREN);
+   d = s >= MAX_SVARNUM ? s : vm_stemp(c);
+   i = vm_emit(c, op, d, s, n);
+   vm_code[i].x = j; // MID$ length, -1 for the rest
+   c->value = i;
+   return d;
+}
+/*---------------------------------------------------------------------------*/
+static int vm_sexpr(struct vm_compile *c) { // compile sexpr(), return its string register
+   int s1, s2, d;
+   s1 = vm_sfactor(c);
+   while (tokenizer_token() == TOKENIZER_PLUS) {
+      tokenizer_next();
+      s2 = vm_sfactor(c);
+      d = s1 >= MAX_SVARNUM ? s1 : s2 >= MAX_SVARNUM ? s2 : vm_stemp(c);
+      c->value = vm_emit(c, VM_SCAT, d, s1, s2);
+      s1 = d;
+   }
+   return s1;
+}
+/*---------------------------------------------------------------------------*/
+static struct vm_operand vm_slogexpr(struct vm_compile *c) { // compile slogexpr()
+   struct vm_operand r;
+   int s1, s2, op, i;
+   s1 = vm_sexpr(c);
+   op = tokenizer_token();
+   tokenizer_next();
+   switch (op) {
+   case TOKENIZER_LT:
+      if (tokenizer_token() == TOKENIZER_GT) {
+         tokenizer_next();
+         op = TOKENIZER_NE;
+      } else if (tokenizer_token() == TOKENIZER_EQ) {
+         tokenizer_next();
+         op = TOKENIZER_LE;
+      }
+      break;
+   case TOKENIZER_GT:
+      if (tokenizer_token() == TOKENIZER_EQ) {
+         tokenizer_next();
+         op = TOKENIZER_GE;
+      }
+      break;
+   case TOKENIZER_EQ:
+   case TOKENIZER_NE:
+   case TOKENIZER_LE:
+   case TOKENIZER_GE:
+      break;
+   default:
+      vm_fail(c);
+   }
+   s2 = vm_sexpr(c);
+   r.reg = vm_temp(c);
+   r.k = 0;
+   i = vm_emit(c, VM_SCMP, r.reg, s1, s2);
+   vm_code[i].x = op;
+   c->value = i;
+   return r;
+}
+/*---------------------------------------------------------------------------*/
+static struct vm_operand vm_factor(struct vm_compile *c) { // compile factor()
+   struct vm_operand r;
+   int op, s, s1, i, j;
+   r.reg = -1;
+   r.k = 0;
+   switch (tokenizer_token()) {
+   case TOKENIZER_NUMBER:
+      r.k = fraction_bits == 0 ? tokenizer_num() : num_parse(tokenizer_pos());
+      tokenizer_next();
+      return r;
+   case TOKENIZER_VARIABLE:
+      r.reg = tokenizer_variable_num();
+      tokenizer_next();
+      return r;
+   case TOKENIZER_LEFTPAREN:
+      tokenizer_next();
+      r = vm_expr(c);
+      vm_accept(c, TOKENIZER_RIGHTPAREN);
+      return r;
+   case TOKENIZER_INSTR:
+      tokenizer_next();
+      vm_accept(c, TOKENIZER_LEFTPAREN);
+      j = 1;
+      if (tokenizer_token() == TOKENIZER_NUMBER) {
+         j = tokenizer_num();
+         tokenizer_next();
+         vm_accept(c, TOKENIZER_COMMA);
+      }
+      if (j < 1)
+         vm_fail(c);
+      s = vm_sexpr(c);
+      vm_accept(c, TOKENIZER_COMMA);
+      s1 = vm_sexpr(c);
+      vm_accept(c, TOKENIZER_RIGHTPAREN);
+      r.reg = vm_temp(c);
+      i = vm_emit(c, VM_SINSTR, r.reg, s, s1);
+      vm_code[i].x = j;
+      c->value = i;
+      return r;
+   case TOKENIZER_LEN: op = VM_SLEN; break;
+   case TOKENIZER_VAL: op = VM_SVAL; break;
+   case TOKENIZER_ASC: op = VM_SASC; break;
+   default:
+      vm_fail(c); // EOF and CALL
+      return r;
+   }
+   tokenizer_next();
+   s = vm_sexpr(c);
+   r.reg = vm_temp(c);
+   c->value = vm_emit(c, op, r.reg, s, 0);
+   return r;
+}
+/*---------------------------------------------------------------------------*/
+static struct vm_operand vm_term(struct vm_compile *c) { // compile term()
+   struct vm_operand f1, f2;
+   int op;
+   if (tokenizer_stringlookahead())
+      return vm_slogexpr(c);
+   f1 = vm_factor(c);
+   op = tokenizer_token();
+   while (op == TOKENIZER_ASTR || op == TOKENIZER_SLASH || op == TOKENIZER_MOD) {
+      tokenizer_next();
+      f2 = vm_factor(c);
+      if (op == TOKENIZER_ASTR)
+         f1 = vm_binary(c, fraction_bits == 0 ? VM_MUL : VM_FMUL, f1, f2);
+      else if (op == TOKENIZER_SLASH)
+         f1 = vm_binary(c, fraction_bits == 0 ? VM_DIV : VM_FDIV, f1, f2);
+      else
+         f1 = vm_binary(c, VM_MOD, f1, f2);
+      op = tokenizer_token();
+   }
+   return f1;
+}
+/*---------------------------------------------------------------------------*/
+static struct vm_operand vm_expr(struct vm_compile *c) { // compile expr()
+   struct vm_operand t1, t2;
+   int op;
+   t1 = vm_term(c);
+   op = tokenizer_token();
+   while (op == TOKENIZER_PLUS || op == TOKENIZER_MINUS ||
+          op == TOKENIZER_AND || op == TOKENIZER_OR) {
+      tokenizer_next();
+      t2 = vm_term(c);
+      if (op == TOKENIZER_PLUS)
+         t1 = vm_binary(c, VM_ADD, t1, t2);
+      else if (op == TOKENIZER_MINUS)
+         t1 = vm_binary(c, VM_SUB, t1, t2);
+      else if (op == TOKENIZER_AND)
+         t1 = vm_binary(c, VM_AND, t1, t2);
+      else
+         t1 = vm_binary(c, VM_OR, t1, t2);
+      op = tokenizer_token();
+   }
+   return t1;
+}
+/*---------------------------------------------------------------------------*/
+static struct vm_cond vm_comparison(struct vm_compile *c) { // compile comparison(), left for a branch to test
+   struct vm_cond cond;
+   int rel;
+   cond.rel = -1;
+   cond.negate = 0;
+   cond.a = vm_expr(c);
+   cond.b.reg = -1;
+   cond.b.k = 0;
+   while ((rel = vm_rel(tokenizer_token())) >= 0) {
+      tokenizer_next();
+      if (cond.rel >= 0) // a chain compares the 1 or 0 of the comparison before
+         cond.a = vm_binary(c, VM_LT + 2 * cond.rel, cond.a, cond.b);
+      cond.b = vm_expr(c);
+      cond.rel = rel;
+   }
+   return cond;
+}
+/*---------------------------------------------------------------------------*/
+static struct vm_cond vm_negation(struct vm_compile *c) { // compile negation()
+   struct vm_cond cond;
+   int list, i;
+   if (tokenizer_token() == TOKENIZER_NOT) {
+      tokenizer_next();
+      cond = vm_negation(c);
+      cond.negate = !cond.negate;
+      return cond;
+   }
+   if (tokenizer_token() == TOKENIZER_LEFTPAREN && jump_find(tokenizer_pos()) != NULL) {
+      // a grouped condition leaves a 1 or 0 for the rest to test
+      tokenizer_next();
+      cond.rel = -1;
+      cond.negate = 0;
+      cond.a.reg = vm_temp(c);
+      cond.a.k = 0;
+      cond.b = cond.a;
+      list = vm_relation(c);
+      i = vm_emit(c, VM_LOADK, cond.a.reg, 0, 0);
+      vm_code[i].u.k = 1;
+      i = vm_emit(c, VM_JUMP, 0, 0, 0);
+      vm_patch(list, vm_code_count);
+      vm_emit(c, VM_LOADK, cond.a.reg, 0, 0);
+      vm_code[i].x = vm_code_count;
+      vm_accept(c, TOKENIZER_RIGHTPAREN);
+      return cond;
+   }
+   return vm_comparison(c);
+}
+/*---------------------------------------------------------------------------*/
+static int vm_conjunction(struct vm_compile *c, struct vm_cond *cond) {
+   // compile an AND chain but for its last operand, left in cond; return
+   // the branches taken when an operand before it is false
+   int list = -1;
+   *cond = vm_negation(c);
+   while (tokenizer_token() == TOKENIZER_LAND) {
+      if (jump_find(tokenizer_pos()) == NULL)
+         vm_fail(c); // the tree walker works out every operand
+      tokenizer_next();
+      list = vm_branch(c, cond, 0, list);
+      *cond = vm_negation(c);
+   }
+   return list;
+}
+/*---------------------------------------------------------------------------*/
+static int vm_relation(struct vm_compile *c) {
+   // compile relation(), return the branches taken when it is false; a
+   // true condition falls through
+   struct vm_cond cond;
+   int taken = -1;
+   int list;
+   for (;;) {
+      list = vm_conjunction(c, &cond);
+      if (tokenizer_token() != TOKENIZER_LOR)
+         break;
+      if (jump_find(tokenizer_pos()) == NULL)
+         vm_fail(c);
+      tokenizer_next();
+      taken = vm_branch(c, &cond, 1, taken);
+      vm_patch(list, vm_code_count); // a false AND chain tries the next
+   }
+   list = vm_branch(c, &cond, 0, list);
+   vm_patch(taken, vm_code_count);
+   return list;
+}
+/*---------------------------------------------------------------------------*/
+static char const* vm_continue(struct vm_compile *c) { // compile statement_end(), return where the program goes on
+   char const *pos;
+   switch (tokenizer_token()) {
+   case TOKENIZER_COLON:
+   case TOKENIZER_LF:
+      tokenizer_next();
+      return tokenizer_pos();
+   case TOKENIZER_ELSE:
+      if ((pos = jump_find(tokenizer_pos())) == NULL)
+         vm_fail(c);
+      return pos;
+   case TOKENIZER_ENDOFINPUT:
+      return tokenizer_pos();
+   }
+   vm_fail(c);
+   return NULL;
+}
+/*---------------------------------------------------------------------------*/
+static char const* vm_jump(struct vm_compile *c, char const *pos) { // return where the structure at pos continues
+   char const *target = jump_find(pos);
+   if (target == NULL)
+      vm_fail(c);
+   return target;
+}
+/*---------------------------------------------------------------------------*/
+static char const* vm_target(struct vm_compile *c) { // return the line or label the GOTO or GOSUB goes to
+   char const *target = NULL;
+   if (tokenizer_token() == TOKENIZER_LABEL ||
+       (tokenizer_token() == TOKENIZER_NUMBER && jumps_resolved))
+      target = jump_find(tokenizer_pos());
+   else if (tokenizer_token() == TOKENIZER_NUMBER)
+      target = jump_line_find(c->lines, c->line_count, tokenizer_num());
+   if (target == NULL)
+      vm_fail(c); // the tree walker reports it when it runs
+   return target;
+}
+/*---------------------------------------------------------------------------*/
+static void vm_assign(struct vm_compile *c, int var, struct vm_operand o) {
+   int i;
+   if (o.reg < 0) {
+      i = vm_emit(c, VM_LOADK, var, 0, 0);
+      vm_code[i].u.k = o.k;
+   } else if (o.reg >= MAX_VARNUM && c->value == vm_code_count - 1 && vm_code[c->value].d == o.reg) {
+      vm_code[c->value].d = var; // the value is worked out straight into the variable
+   } else if (o.reg != var) {
+      vm_emit(c, VM_MOVE, var, o.reg, 0);
+   }
+}
+/*---------------------------------------------------------------------------*/
+static void vm_sassign(struct vm_compile *c, int var, int s) {
+   if (s >= MAX_SVARNUM && c->value == vm_code_count - 1 && vm_code[c->value].d == s)
+      vm_code[c->value].d = var;
+   else if (s != var)
+      vm_emit(c, VM_SMOVE, var, s, 0);
+}
+/*---------------------------------------------------------------------------*/
+static void vm_print(struct vm_compile *c) { // compile print_statement()
+   static char space[] = " ";
+   struct vm_operand o;
+   int mode = 0, reg = 0, t, i;
+   tokenizer_next();
+   while ((t = tokenizer_token()) != TOKENIZER_LF && t != TOKENIZER_COLON &&
+          t != TOKENIZER_ELSE && t != TOKENIZER_ENDOFINPUT) {
+      if (t == TOKENIZER_STRING) {
+         i = vm_emit(c, VM_PRINTLIT, 0, 0, 0);
+         vm_code[i].u.s = sliteral();
+         tokenizer_next();
+      } else if (t == TOKENIZER_COMMA) {
+         i = vm_emit(c, VM_PRINTLIT, 0, 0, 0);
+         vm_code[i].u.s = space;
+         tokenizer_next();
+      } else if (t == TOKENIZER_SEMICOLON) {
+         tokenizer_next();
+      } else if (t == TOKENIZER_VARIABLE || t == TOKENIZER_NUMBER) {
+         o = vm_expr(c);
+         reg = vm_reg(c, &o);
+         vm_emit(c, VM_PRINTNUM, 0, reg, 0);
+      } else {
+         // the last item, as print_statement() stops after it
+         if (tokenizer_stringlookahead()) {
+            mode = 1;
+            reg = vm_sexpr(c);
+         } else {
+            mode = 2;
+            o = vm_expr(c);
+            reg = vm_reg(c, &o);
+         }
+         break;
+      }
+   }
+   i = vm_emit(c, VM_PRINTEND, 0, reg, 0);
+   vm_code[i].x = mode;
+   vm_exit(c, vm_continue(c));
+}
+/*---------------------------------------------------------------------------*/
+static void vm_if(struct vm_compile *c) { // compile if_statement()
+   char const *pos = tokenizer_pos();
+   char const *then, *target;
+   jmp_buf fail, *outer;
+   int list, mark, i;
+   tokenizer_next();
+   list = vm_relation(c);
+   vm_accept(c, TOKENIZER_THEN);
+   target = vm_jump(c, pos);
+   if (tokenizer_token() == TOKENIZER_LF) { // a block IF
+      tokenizer_next();
+      vm_exit(c, tokenizer_pos());
+   } else {
+      // the statement after THEN, walked by the tree walker if the VM cannot run it
+      then = tokenizer_pos();
+      mark = vm_code_count;
+      outer = c->fail;
+      c->fail = &fail;
+      switch (setjmp(fail)) {
+      case 0:
+         vm_statement(c);
+         break;
+      case VM_NOMEM:
+         c->fail = outer;
+         longjmp(*outer, VM_NOMEM);
+      default:
+         c->fail = outer;
+         vm_code_count = mark;
+         i = vm_emit(c, VM_TREE, 0, 0, 0);
+         vm_code[i].u.pos = then;
+      }
+      c->fail = outer;
+   }
+   vm_patch(list, vm_code_count);
+   vm_exit(c, target);
+}
+/*---------------------------------------------------------------------------*/
+static void vm_statement(struct vm_compile *c) { // compile statement()
+   char const *pos = tokenizer_pos();
+   char const *target;
+   struct vm_operand o;
+   int token = tokenizer_token();
+   int var, linenum, i;
+
+   i = vm_emit(c, VM_STATEMENT, 0, 0, 0);
+   vm_code[i].x = token;
+   switch (token) {
+   case TOKENIZER_PRINT:
+      vm_print(c);
+      break;
+   case TOKENIZER_IF:
+      vm_if(c);
+      break;
+   case TOKENIZER_GOTO:
+      tokenizer_next();
+      vm_exit(c, vm_target(c));
+      break;
+   case TOKENIZER_GOSUB:
+      tokenizer_next();
+      target = vm_target(c);
+      linenum = tokenizer_token() == TOKENIZER_LABEL ? source_line(target) : tokenizer_num();
+      tokenizer_next();
+      pos = vm_continue(c);
+      i = vm_emit(c, VM_GOSUB, 0, 0, 0);
+      vm_code[i].x = linenum;
+      vm_code[i].u.pos = pos;
+      vm_exit(c, target);
+      break;
+   case TOKENIZER_RETURN:
+      tokenizer_next();
+      vm_emit(c, VM_RETURN, 0, 0, 0);
+      break;
+   case TOKENIZER_FOR:
+      tokenizer_next();
+      if (tokenizer_token() != TOKENIZER_VARIABLE)
+         vm_fail(c);
+      var = tokenizer_variable_num();
+      tokenizer_next();
+      vm_accept(c, TOKENIZER_EQ);
+      vm_assign(c, var, vm_expr(c)); // the variable is set before TO is worked out
+      vm_accept(c, TOKENIZER_TO);
+      o = vm_expr(c);
+      vm_reg(c, &o);
+      pos = vm_continue(c);
+      i = vm_emit(c, VM_FOR, var, o.reg, 0);
+      vm_code[i].u.pos = pos;
+      vm_exit(c, pos);
+      break;
+   case TOKENIZER_NEXT:
+      tokenizer_next();
+      if (tokenizer_token() != TOKENIZER_VARIABLE)
+         vm_fail(c);
+      vm_emit(c, VM_NEXT, tokenizer_variable_num(), 0, 0);
+      tokenizer_next();
+      vm_exit(c, vm_continue(c));
+      break;
+   case TOKENIZER_END:
+      tokenizer_next();
+      i = vm_emit(c, VM_END, 0, 0, 0);
+      vm_code[i].u.pos = tokenizer_pos();
+      break;
+   case TOKENIZER_WHILE:
+      tokenizer_next();
+      i = vm_relation(c);
+      vm_exit(c, vm_continue(c));
+      vm_patch(i, vm_code_count);
+      vm_exit(c, vm_jump(c, pos));
+      break;
+   case TOKENIZER_WEND:
+   case TOKENIZER_ELSE:
+      vm_exit(c, vm_jump(c, pos));
+      break;
+   case TOKENIZER_ENDIF:
+      tokenizer_next();
+      vm_exit(c, vm_continue(c));
+      break;
+   case TOKENIZER_LABEL:
+      tokenizer_next();
+      if (tokenizer_token() == TOKENIZER_COLON)
+         tokenizer_next();
+      vm_exit(c, tokenizer_pos());
+      break;
+   case TOKENIZER_LF:
+      tokenizer_next();
+      vm_exit(c, tokenizer_pos());
+      break;
+   case TOKENIZER_LET:
+      tokenizer_next();
+      /* Fall through. */
+   case TOKENIZER_VARIABLE:
+   case TOKENIZER_STRINGVARIABLE:
+      var = tokenizer_variable_num();
+      if (tokenizer_token() == TOKENIZER_VARIABLE) {
+         tokenizer_next();
+         vm_accept(c, TOKENIZER_EQ);
+         vm_assign(c, var, vm_expr(c));
+      } else if (tokenizer_token() == TOKENIZER_STRINGVARIABLE) {
+         tokenizer_next();
+         vm_accept(c, TOKENIZER_EQ);
+         vm_sassign(c, var, vm_sexpr(c));
+      } else {
+         vm_fail(c);
+      }
+      vm_exit(c, vm_continue(c));
+      break;
+   default:
+      vm_fail(c); // PEEK, POKE, INPUT, SLEEP, YIELD, PARFOR, CALL
+   }
+}
+/*---------------------------------------------------------------------------*/
+static void vm_entry(struct vm_compile *c, char const *pos) { // compile the statement ubasic_run() starts at pos
+   int i;
+   tokenizer_goto(pos);
+   if (tokenizer_token() == TOKENIZER_NUMBER) {
+      i = vm_emit(c, VM_LINE, 0, 0, 0);
+      vm_code[i].x = tokenizer_num();
+      tokenizer_next();
+      if (tokenizer_token() == TOKENIZER_ENDOFINPUT)
+         vm_fail(c);
+   } else if (line_starts != NULL) {
+      i = vm_emit(c, VM_TEXTLINE, 0, 0, 0);
+      vm_code[i].x = source_line(pos);
+   }
+   c->temps = c->stemps = 0;
+   vm_statement(c);
+}
+/*---------------------------------------------------------------------------*/
+static int vm_compile_entry(struct vm_compile *c, char const *pos) { // return 0, VM_CANNOT or VM_NOMEM
+   jmp_buf fail;
+   int mark = vm_code_count;
+   c->fail = &fail;
+   switch (setjmp(fail)) {
+   case 0:
+      vm_entry(c, pos);
+      return 0;
+   case VM_NOMEM:
+      vm_code_count = mark;
+      return VM_NOMEM;
+   }
+   vm_code_count = mark; // left to the tree walker
+   return VM_CANNOT;
+}
+/*---------------------------------------------------------------------------*/
+static int vm_find(char const *pos) { // return the entry of the statement at pos, or -1
+   int lo = 0;
+   int hi = vm_entry_count - 1;
+   int mid;
+   while (lo <= hi) {
+      mid = (lo + hi) / 2;
+      if (vm_entries[mid].program_text_position == pos)
+         return mid;
+      if (vm_entries[mid].program_text_position < pos)
+         lo = mid + 1;
+      else
+         hi = mid - 1;
+   }
+   return -1;
+}
+/*---------------------------------------------------------------------------*/
+static void vm_init(const char *program) {
+   struct vm_compile c;
+   struct vm_entry *grown;
+   char const *p;
+   int size = 0, count = 0, start = 1, line_start = 1;
+   int t, i;
 
-    for_stack_ptr++;
-  } else {
-    DEBUG_PRINTF("for_statement: for stack depth exceeded.\n");
+   vm_code = NULL;
+   vm_entries = NULL;
+   vm_code_count = vm_entry_count = 0;
+   vm_pc = -1;
+   if (engine != UBASIC_ENGINE_VM)
+      return;
+   c.size = 0;
+   c.value = -1;
+   c.lines = NULL;
+   c.line_count = 0;
+   if (!jumps_resolved) { // GOTO and GOSUB find their lines here instead
+      for (p = program, i = 1; *p != 0; p++)
+         i += *p == '\n';
+      c.lines = arena_alloc(&load_arena, i * sizeof(struct jump_line));
+   }
+   // every position ubasic_run() can start a statement at
+   tokenizer_init(program);
+   while (!tokenizer_finished()) {
+      t = tokenizer_token();
+      if (start) {
+         if (count == size) {
+            size = 2 * size + 64;
+            grown = arena_grow(&load_arena, vm_entries, count * sizeof(struct vm_entry),
+                               size * sizeof(struct vm_entry));
+            if (grown == NULL) {
+               vm_entries = NULL;
+               return; // everything is walked by the tree walker
+            }
+            vm_entries = grown;
+         }
+         vm_entries[count++].program_text_position = tokenizer_pos();
+      }
+      if (t == TOKENIZER_NUMBER && line_start && c.lines != NULL) {
+         c.lines[c.line_count].line_number = tokenizer_num();
+         c.lines[c.line_count].program_text_position = tokenizer_pos();
+         c.line_count++;
+      }
+      start = t == TOKENIZER_LF || t == TOKENIZER_COLON || t == TOKENIZER_ELSE ||
+              (t == TOKENIZER_LABEL && start);
+      line_start = t == TOKENIZER_LF;
+      tokenizer_next();
+   }
+   if (c.lines != NULL)
+      qsort(c.lines, c.line_count, sizeof(struct jump_line), jump_line_compare);
+   // compile each, keeping those the VM can run
+   for (i = 0; i < count; i++) {
+      vm_entries[vm_entry_count].code = vm_code_count;
+      t = vm_compile_entry(&c, vm_entries[i].program_text_position);
+      if (t == VM_NOMEM)
+         break;
+      if (t == 0)
+         vm_entries[vm_entry_count++].program_text_position = vm_entries[i].program_text_position;
+   }
+   // an exit to a compiled statement stays on the VM
+   for (i = 0; i < vm_code_count; i++) {
+      if (vm_code[i].op == VM_EXIT)
+         vm_code[i].x = vm_find(vm_code[i].u.pos);
+   }
+}
+/*---------------------------------------------------------------------------*/
+static void vm_exit_to(char const *pos) {
+  // carry on at pos, on the VM if the statement there is compiled
+  vm_pc = vm_find(pos);
+  if(vm_pc < 0) {
+    tokenizer_goto(pos);
   }
 }
 /*---------------------------------------------------------------------------*/
-static void peek_statement(void){
-  VARIABLE_TYPE peek_addr;
-  int var;
-
-  accept(TOKENIZER_PEEK);
-  peek_addr = expr();
-  accept(TOKENIZER_COMMA);
-  var = tokenizer_variable_num();
-  accept(TOKENIZER_VARIABLE);
-  accept(TOKENIZER_LF);
+static void vm_run(void){
+  // run the statement at vm_pc, leaving vm_pc at the next one, or -1 with
+  // the tokenizer there
+  static THREAD_LOCAL char buf[MAX_STRINGVARLEN + NUM_FORMATLEN];
+  char num[NUM_FORMATLEN];
+  struct vm_op const *op = vm_code + vm_entries[vm_pc].code;
+  VARIABLE_TYPE *r = variables;
+  char **s = stringvariables;
+  VARIABLE_TYPE one = num_from_int(1);
+  int j;
 
-  ubasic_set_variable(var, peek_function(peek_addr));
+  for(;;) {
+    switch(op->op) {
+    case VM_LINE:
+      current_linenum = op->x;
+      TRACE(UBASIC_TRACE_LINE, op->x, 0);
+      break;
+    case VM_TEXTLINE:
+      if(op->x != current_linenum) {
+        current_linenum = op->x;
+        TRACE(UBASIC_TRACE_LINE, op->x, 0);
+      }
+      break;
+    case VM_STATEMENT:
+      TRACE(UBASIC_TRACE_STATEMENT, op->x, 0);
+      PROFILE_STATEMENT(op->x); // profile addition
+      fused_stats.statements++;
+      break;
+    case VM_MOVE:  r[op->d] = r[op->a]; break;
+    case VM_LOADK: r[op->d] = op->u.k; break;
+    case VM_ADD:   r[op->d] = r[op->a] + r[op->b]; break;
+    case VM_ADDK:  r[op->d] = r[op->a] + op->u.k; break;
+    case VM_SUB:   r[op->d] = r[op->a] - r[op->b]; break;
+    case VM_SUBK:  r[op->d] = r[op->a] - op->u.k; break;
+    case VM_MUL:   r[op->d] = r[op->a] * r[op->b]; break;
+    case VM_MULK:  r[op->d] = r[op->a] * op->u.k; break;
+    case VM_FMUL:  r[op->d] = num_mul(r[op->a], r[op->b]); break;
+    case VM_FMULK: r[op->d] = num_mul(r[op->a], op->u.k); break;
+    case VM_DIV:
+      if(r[op->b] == 0) {
+        basic_error(UBASIC_ERROR_DIVIDE, TOKENIZER_ERROR);
+      }
+      r[op->d] = r[op->a] / r[op->b];
+      break;
+    case VM_DIVK:  r[op->d] = r[op->a] / op->u.k; break;
+    case VM_FDIV:
+      if(r[op->b] == 0) {
+        basic_error(UBASIC_ERROR_DIVIDE, TOKENIZER_ERROR);
+      }
+      r[op->d] = num_div(r[op->a], r[op->b]);
+      break;
+    case VM_FDIVK: r[op->d] = num_div(r[op->a], op->u.k); break;
+    case VM_MOD:
+      if(r[op->b] == 0) {
+        basic_error(UBASIC_ERROR_DIVIDE, TOKENIZER_ERROR);
+      }
+      r[op->d] = r[op->a] % r[op->b];
+      break;
+    case VM_MODK:  r[op->d] = r[op->a] % op->u.k; break;
+    case VM_AND:   r[op->d] = r[op->a] & r[op->b]; break;
+    case VM_ANDK:  r[op->d] = r[op->a] & op->u.k; break;
+    case VM_OR:    r[op->d] = r[op->a] | r[op->b]; break;
+    case VM_ORK:   r[op->d] = r[op->a] | op->u.k; break;
+    case VM_LT:    r[op->d] = r[op->a] < r[op->b] ? one : 0; break;
+    case VM_LTK:   r[op->d] = r[op->a] < op->u.k ? one : 0; break;
+    case VM_GT:    r[op->d] = r[op->a] > r[op->b] ? one : 0; break;
+    case VM_GTK:   r[op->d] = r[op->a] > op->u.k ? one : 0; break;
+    case VM_EQ:    r[op->d] = r[op->a] == r[op->b] ? one : 0; break;
+    case VM_EQK:   r[op->d] = r[op->a] == op->u.k ? one : 0; break;
+    case VM_LE:    r[op->d] = r[op->a] <= r[op->b] ? one : 0; break;
+    case VM_LEK:   r[op->d] = r[op->a] <= op->u.k ? one : 0; break;
+    case VM_GE:    r[op->d] = r[op->a] >= r[op->b] ? one : 0; break;
+    case VM_GEK:   r[op->d] = r[op->a] >= op->u.k ? one : 0; break;
+    case VM_NE:    r[op->d] = r[op->a] != r[op->b] ? one : 0; break;
+    case VM_NEK:   r[op->d] = r[op->a] != op->u.k ? one : 0; break;
+    case VM_BLT:   if(r[op->a] < r[op->b]) goto branch; break;
+    case VM_BLTK:  if(r[op->a] < op->u.k) goto branch; break;
+    case VM_BGT:   if(r[op->a] > r[op->b]) goto branch; break;
+    case VM_BGTK:  if(r[op->a] > op->u.k) goto branch; break;
+    case VM_BEQ:   if(r[op->a] == r[op->b]) goto branch; break;
+    case VM_BEQK:  if(r[op->a] == op->u.k) goto branch; break;
+    case VM_BLE:   if(r[op->a] <= r[op->b]) goto branch; break;
+    case VM_BLEK:  if(r[op->a] <= op->u.k) goto branch; break;
+    case VM_BGE:   if(r[op->a] >= r[op->b]) goto branch; break;
+    case VM_BGEK:  if(r[op->a] >= op->u.k) goto branch; break;
+    case VM_BNE:   if(r[op->a] != r[op->b]) goto branch; break;
+    case VM_BNEK:  if(r[op->a] != op->u.k) goto branch; break;
+    case VM_BTRUE: if(r[op->a] != 0) goto branch; break;
+    case VM_BFALSE: if(r[op->a] == 0) goto branch; break;
+    case VM_JUMP:
+    branch:
+      op = vm_code + op->x;
+      continue;
+    // the string runtime is the tree walker's
+    case VM_SLOAD: s[op->d] = op->u.s; break;
+    case VM_SMOVE: s[op->d] = s[op->a]; break;
+    case VM_SCAT:  s[op->d] = sconcat(s[op->a], s[op->b]); break;
+    // profile addition - a function's arguments are its statement's on the VM
+    case VM_SLEFT:
+      PROFILE_ENTER(TOKENIZER_LEFT$);
+      s[op->d] = sleft(s[op->a], num_int(r[op->b]));
+      PROFILE_LEAVE();
+      break;
+    case VM_SRIGHT:
+      PROFILE_ENTER(TOKENIZER_RIGHT$);
+      s[op->d] = sright(s[op->a], num_int(r[op->b]));
+      PROFILE_LEAVE();
+      break;
+    case VM_SMID:
+      PROFILE_ENTER(TOKENIZER_MID$);
+      s[op->d] = smid(s[op->a], num_int(r[op->b]), op->x < 0 ? 999 : num_int(r[op->x]));
+      PROFILE_LEAVE();
+      break;
+    case VM_SSTR:
+      PROFILE_ENTER(TOKENIZER_STR$);
+      s[op->d] = sstr(r[op->a]);
+      PROFILE_LEAVE();
+      break;
+    case VM_SCHR:
+      PROFILE_ENTER(TOKENIZER_CHR$);
+      j = num_int(r[op->a]);
+      if(j < 0 || j > 255) {
+        j = 0;
+      }
+      s[op->d] = schr(j);
+      PROFILE_LEAVE();
+      break;
+    case VM_SLEN:
+      PROFILE_ENTER(TOKENIZER_LEN);
+      r[op->d] = num_from_int(strlen(s[op->a]));
+      PROFILE_LEAVE();
+      break;
+    case VM_SVAL:
+      PROFILE_ENTER(TOKENIZER_VAL);
+      r[op->d] = num_parse(s[op->a]);
+      PROFILE_LEAVE();
+      break;
+    case VM_SASC:
+      PROFILE_ENTER(TOKENIZER_ASC);
+      r[op->d] = num_from_int(*s[op->a]);
+      PROFILE_LEAVE();
+      break;
+    case VM_SINSTR:
+      PROFILE_ENTER(TOKENIZER_INSTR);
+      r[op->d] = num_from_int(sinstr(op->x, s[op->a], s[op->b]));
+      PROFILE_LEAVE();
+      break;
+    // end of profile addition
+    case VM_SCMP:
+      j = strcmp(s[op->a], s[op->b]);
+      switch(op->x) {
+      case TOKENIZER_LT: j = j < 0; break;
+      case TOKENIZER_GT: j = j > 0; break;
+      case TOKENIZER_EQ: j = j == 0; break;
+      case TOKENIZER_LE: j = j <= 0; break;
+      case TOKENIZER_GE: j = j >= 0; break;
+      default:           j = j != 0; break;
+      }
+      r[op->d] = j ? one : 0;
+      break;
+    case VM_PRINTLIT:
+      printf("%s", op->u.s);
+      break;
+    case VM_PRINTNUM:
+      printf("%s", num_format(num, r[op->a]));
+      break;
+    case VM_PRINTEND:
+      // as print_statement() ends, with the string or number it stopped at
+      buf[0] = 0;
+      if(op->x == 1) {
+        sprintf(buf, "%s", s[op->a]);
+      } else if(op->x == 2) {
+        num_format(buf, r[op->a]);
+      }
+      printf(buf);
+      printf("\n");
+      break;
+    case VM_GOSUB:
+      if(gosub_stack_ptr >= MAX_GOSUB_STACK_DEPTH) {
+        basic_error(UBASIC_ERROR_STACK, TOKENIZER_ERROR);
+      }
+      TRACE(UBASIC_TRACE_GOSUB, op->x, current_linenum);
+      gosub_stack[gosub_stack_ptr].return_position = op->u.pos;
+      gosub_stack[gosub_stack_ptr].line_number = current_linenum;
+      gosub_stack[gosub_stack_ptr].target_line = op->x; // sampler addition
+      gosub_stack_ptr++;
+      break;
+    case VM_RETURN:
+      if(gosub_stack_ptr == 0) {
+        basic_error(UBASIC_ERROR_STACK, TOKENIZER_ERROR);
+      }
+      gosub_stack_ptr--;
+      TRACE(UBASIC_TRACE_RETURN, gosub_stack[gosub_stack_ptr].line_number, 0);
+      current_linenum = gosub_stack[gosub_stack_ptr].line_number;
+      vm_exit_to(gosub_stack[gosub_stack_ptr].return_position);
+      return;
+    case VM_FOR:
+      if(for_stack_ptr >= MAX_FOR_STACK_DEPTH) {
+        basic_error(UBASIC_ERROR_STACK, TOKENIZER_ERROR);
+      }
+      for_stack[for_stack_ptr].position_after_for = op->u.pos;
+      for_stack[for_stack_ptr].line_number = current_linenum;
+      for_stack[for_stack_ptr].for_variable = op->d;
+      for_stack[for_stack_ptr].to = r[op->a];
+      for_stack_ptr++;
+      break;
+    case VM_NEXT:
+      if(for_stack_ptr > 0 && op->d == for_stack[for_stack_ptr - 1].for_variable) {
+        r[op->d] += one;
+        if(r[op->d] <= for_stack[for_stack_ptr - 1].to) {
+          current_linenum = for_stack[for_stack_ptr - 1].line_number;
+          vm_exit_to(for_stack[for_stack_ptr - 1].position_after_for);
+          return;
+        }
+        for_stack_ptr--;
+      } else {
+        basic_error(UBASIC_ERROR_STACK, TOKENIZER_ERROR);
+      }
+      break;
+    case VM_END:
+      ended = 1;
+      vm_pc = -1;
+      tokenizer_goto(op->u.pos);
+      return;
+    case VM_TREE:
+      vm_pc = -1;
+      tokenizer_goto(op->u.pos);
+      statement();
+      return;
+    case VM_EXIT:
+      vm_pc = op->x;
+      if(vm_pc < 0) {
+        tokenizer_goto(op->u.pos);
+      }
+      return;
+    }
+    op++;
+  }
 }
 /*---------------------------------------------------------------------------*/
-static void poke_statement(void)
+void ubasic_set_engine(int e)
 {
-  VARIABLE_TYPE poke_addr;
-  VARIABLE_TYPE value;
-
-  accept(TOKENIZER_POKE);
-  poke_addr = expr();
-  accept(TOKENIZER_COMMA);
-  value = expr();
-  accept(TOKENIZER_LF);
-
-  poke_function(poke_addr, value);
+  engine = e;
 }
+// end of vm additions
 /*---------------------------------------------------------------------------*/
 static void end_statement(void)
 {
@@ -907,6 +5485,14 @@ static void statement(void){
   int token;
 
   token = tokenizer_token();
+  TRACE(UBASIC_TRACE_STATEMENT, token, 0);
+  PROFILE_STATEMENT(token); // profile addition
+  // superinstruction addition
+  fused_stats.statements++;
+  if(fused_count > 0 && fused_statement(token)) {
+    return;
+  }
+  // end of superinstruction addition
 
   switch(token) {
   case TOKENIZER_PRINT:
@@ -939,6 +5525,55 @@ static void statement(void){
   case TOKENIZER_END:
     end_statement();
     break;
+  // input addition
+  case TOKENIZER_INPUT:
+    input_statement();
+    break;
+  case TOKENIZER_LINE:
+    line_input_statement();
+    break;
+  // end of input addition
+  // scheduler addition
+  case TOKENIZER_SLEEP:
+    sleep_statement();
+    break;
+  case TOKENIZER_YIELD:
+    yield_statement();
+    break;
+  // end of scheduler addition
+  // structured addition
+  case TOKENIZER_WHILE:
+    while_statement();
+    break;
+  case TOKENIZER_WEND:
+    wend_statement();
+    break;
+  case TOKENIZER_ELSE:
+    else_statement();
+    break;
+  case TOKENIZER_ENDIF:
+    endif_statement();
+    break;
+  // end of structured addition
+  // label addition
+  case TOKENIZER_LABEL:
+    label_statement();
+    break;
+  case TOKENIZER_LF:
+    accept(TOKENIZER_LF); // an empty line or a REM
+    break;
+  // end of label addition
+  // parallel addition
+  case TOKENIZER_PARFOR:
+    parfor_statement();
+    break;
+  // end of parallel addition
+  // call addition
+  case TOKENIZER_CALL:
+    call_function(0);
+    statement_end();
+    break;
+  // end of call addition
   case TOKENIZER_LET:
     accept(TOKENIZER_LET);
     /* Fall through. */
@@ -950,61 +5585,536 @@ static void statement(void){
     break;
   default:
     DEBUG_PRINTF("statement: not implemented %d.\n", token);
-    exit(1);
+    basic_error(UBASIC_ERROR_STATEMENT, TOKENIZER_ERROR);
   }
 }
 /*---------------------------------------------------------------------------*/
 static void line_statement(void){
   DEBUG_PRINTF("----------- Line number %d ---------\n", tokenizer_num());
-  index_add(tokenizer_num(), tokenizer_pos());
+  current_linenum = tokenizer_num();
+  TRACE(UBASIC_TRACE_LINE, tokenizer_num(), 0);
+  if(!jumps_resolved) { // scale addition - nothing looks lines up then
+    index_add(tokenizer_num(), tokenizer_pos());
+  }
   accept(TOKENIZER_NUMBER);
+  // structured addition - a last line with nothing after the number
+  if(tokenizer_token() == TOKENIZER_ENDOFINPUT) {
+    return;
+  }
   statement();
   return;
 }
 /*---------------------------------------------------------------------------*/
-void ubasic_run(void){
+int ubasic_run(void){
+  if(pending) {
+    return UBASIC_ERROR_NONE; // parked until ubasic_resume()
+  }
   if(tokenizer_finished()) {
     DEBUG_PRINTF("ubasic_run: Program finished.\n");
-    return;
+    return UBASIC_ERROR_NONE;
+  }
+  // error addition
+  if(setjmp(error_jmp) != 0) {
+    DEBUG_PRINTF("ubasic_run: error %d on line %d.\n", error_info.kind, error_info.line);
+    PROFILE_END(); // profile addition
+    return error_info.kind;
   }
+  // end of error addition
+  // replay addition
+  if(replay != NULL) {
+    replay_statement();
+  }
+  // end of replay addition
   // string additions
   garbage_collect();
   // end of string additions
+  PROFILE_BEGIN(); // profile addition
+  // vm addition - a statement compiled at load time runs on the VM
+  if(vm_pc >= 0 || (vm_entry_count > 0 && (vm_pc = vm_find(tokenizer_pos())) >= 0)) {
+    vm_run();
+    PROFILE_END(); // profile addition
+    return UBASIC_ERROR_NONE;
+  }
+  // end of vm addition
 
-  line_statement();
+  // structured addition - a jump or a colon can leave us in the middle of a line
+  if(tokenizer_token() == TOKENIZER_NUMBER) {
+    line_statement();
+  } else {
+    if(line_starts != NULL) {
+      text_line(); // label addition
+    }
+    statement();
+  }
+  PROFILE_END(); // profile addition
+  return UBASIC_ERROR_NONE;
+}
+// async additions
+/*---------------------------------------------------------------------------*/
+void ubasic_set_async_peek_poke(peek_async_func peek, poke_async_func poke){
+  peek_async_function = peek;
+  poke_async_function = poke;
+}
+/*---------------------------------------------------------------------------*/
+int ubasic_pending(void){
+  return pending;
+}
+/*---------------------------------------------------------------------------*/
+void ubasic_resume(VARIABLE_TYPE value){
+  if(!pending) {
+    // from inside the callback: the statement takes the value and goes on
+    if(async_calling) {
+      async_resumed = 1;
+      async_value = value;
+    }
+    return;
+  }
+  pending = 0;
+  if(pending_var >= 0) {
+    if(RECORDING) { // replay addition
+      replay_put_num(REPLAY_PEEK, value);
+    }
+    set_variable(pending_var, num_from_int(value));
+    TRACE(UBASIC_TRACE_PEEK, pending_addr, value);
+  }
+}
+// end of async additions
+/*---------------------------------------------------------------------------*/
+void ubasic_set_block_peek_poke(peek_block_func peek, poke_block_func poke){
+  peek_block_function = peek;
+  poke_block_function = poke;
+}
+/*---------------------------------------------------------------------------*/
+int ubasic_yielded(void){
+  int ms = yield_time;
+  yield_time = -1;
+  return ms;
 }
 /*---------------------------------------------------------------------------*/
 int ubasic_finished(void){
   return ended || tokenizer_finished();
 }
 /*---------------------------------------------------------------------------*/
-void ubasic_set_variable(int varnum, VARIABLE_TYPE value){
-  if(varnum > 0 && varnum <= MAX_VARNUM) {
+static void set_variable(int varnum, VARIABLE_TYPE value){
+  if(varnum >= 0 && varnum < MAX_VARNUM) {
     variables[varnum] = value;
   }
 }
 /*---------------------------------------------------------------------------*/
+void ubasic_set_variable(int varnum, VARIABLE_TYPE value){
+  // replay addition - while replaying the log sets the variables instead
+  if(replay != NULL) {
+    if(replay->replaying) {
+      return;
+    }
+    replay_put(REPLAY_SET);
+    replay_write(replay->statements);
+    replay_write(varnum);
+    replay_write_num(value);
+  }
+  // end of replay addition
+  set_variable(varnum, value);
+}
+/*---------------------------------------------------------------------------*/
 VARIABLE_TYPE ubasic_get_variable(int varnum){
-  if(varnum > 0 && varnum <= MAX_VARNUM) {
+  if(varnum >= 0 && varnum < MAX_VARNUM) {
     return variables[varnum];
   }
   return 0;
 }
+/*---------------------------------------------------------------------------*/
+int ubasic_fraction_bits(void){
+  return fraction_bits;
+}
 // string additions
 /*---------------------------------------------------------------------------*/
-void ubasic_set_stringvariable(int svarnum, char *svalue) {
+static void set_stringvariable(int svarnum, char *svalue) {
 
     if(svarnum >=0 && svarnum <MAX_SVARNUM) {
 	   stringvariables[svarnum] = svalue;
   	}
 }
 /*---------------------------------------------------------------------------*/
+void ubasic_set_stringvariable(int svarnum, char *svalue) {
+  // replay addition - while replaying the log sets the variables instead
+  if(replay != NULL) {
+    if(replay->replaying) {
+      return;
+    }
+    replay_put(REPLAY_SETSTR);
+    replay_write(replay->statements);
+    replay_write(svarnum);
+    replay_write_str(svalue);
+  }
+  // end of replay addition
+  set_stringvariable(svarnum, svalue);
+}
+/*---------------------------------------------------------------------------*/
 char* ubasic_get_stringvariable(int varnum){
   if(varnum>=0 && varnum< MAX_SVARNUM) {
       return stringvariables[varnum];
   }
-  return scpy(nullstring);
+  return (char *)nullstring;
 }
 // end of string additions
+// reload additions
+/*---------------------------------------------------------------------------*/
+struct reload_line {
+  int number;         // line number, or text line of an unnumbered program
+  char const *start;
+  int length;         // up to and including the LF
+};
+/*---------------------------------------------------------------------------*/
+static int reload_compare(const void *a, const void *b) {
+  int na = ((const struct reload_line *)a)->number;
+  int nb = ((const struct reload_line *)b)->number;
+  return na < nb ? -1 : na > nb;
+}
+/*---------------------------------------------------------------------------*/
+static struct reload_line* reload_lines(const char *program, int numbered, int *count) { // split program into lines
+  struct reload_line *lines;
+  char const *p;
+  int n = 1;
+
+  for(p = program; *p != 0; p++) {
+    if(*p == '\n') {
+      n++;
+    }
+  }
+  lines = arena_alloc(&load_arena, n * sizeof(struct reload_line)); // arena addition
+  n = 0;
+  for(p = program; lines != NULL && *p != 0; n++) {
+    lines[n].start = p;
+    while(*p == ' ' || *p == '\t') {
+      p++;
+    }
+    lines[n].number = numbered ? atoi(p) : n + 1;
+    while(*p != 0 && *p++ != '\n')
+      ;
+    lines[n].length = p - lines[n].start;
+  }
+  *count = n;
+  return lines;
+}
+/*---------------------------------------------------------------------------*/
+static char const* reload_position(char const *pos, const char *old_program,
+                                   struct reload_line *old_lines, int old_count,
+                                   const char *program, struct reload_line *lines, int count) {
+  // where pos in the old program is in the new one: the same place if its
+  // line is unchanged, otherwise the start of that line or of the next one
+  struct reload_line *old;
+  int lo = 0;
+  int hi = old_count - 1;
+  int mid;
+
+  if(pos == NULL) {
+    return NULL;
+  }
+  if(old_count == 0 || pos < old_program || pos >= old_lines[old_count - 1].start + old_lines[old_count - 1].length) {
+    return program + strlen(program); // the end of the program
+  }
+  while(lo < hi) {
+    mid = (lo + hi + 1) / 2;
+    if(old_lines[mid].start <= pos) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  old = old_lines + lo;
+  lo = 0;
+  hi = count;
+  while(lo < hi) { // the first new line numbered old->number or higher
+    mid = (lo + hi) / 2;
+    if(lines[mid].number < old->number) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if(lo == count) {
+    return program + strlen(program);
+  }
+  if(lines[lo].number == old->number && lines[lo].length == old->length &&
+     memcmp(lines[lo].start, old->start, old->length) == 0) {
+    return lines[lo].start + (pos - old->start);
+  }
+  return lines[lo].start;
+}
+/*---------------------------------------------------------------------------*/
+int ubasic_reload(const char *program){
+  // put a new version of the program in place of the running one, keeping
+  // variables, strings and the GOSUB and FOR stacks
+  struct reload_line *old_lines, *lines;
+  struct line_index *lidx, *next, *tail = NULL;
+  const char *old_program = program_ptr;
+  char const *pos;
+  int old_count, count, numbered, bits, need = 0;
+  int i;
+
+  if(old_program == NULL) {
+    ubasic_init(program);
+    return error_info.kind;
+  }
+  // vm addition - the tokenizer takes the position back from the VM
+  if(vm_pc >= 0) {
+    tokenizer_goto(vm_entries[vm_pc].program_text_position);
+    vm_pc = -1;
+  }
+  // end of vm addition
+  // strings still pointing at the old program's literals move to the heap
+  for(i = 0; i < MAX_SVARNUM; i++) {
+    if(stringvariables[i] >= literal_pool && stringvariables[i] < literal_pool_end) {
+      need += strlen(stringvariables[i]) + 1;
+    }
+  }
+  if(heap_size - freebufptr <= need + 2) {
+    return UBASIC_ERROR_MEMORY;
+  }
+  numbered = line_starts == NULL;
+  old_lines = reload_lines(old_program, numbered, &old_count);
+  lines = reload_lines(program, numbered, &count);
+  if(old_lines == NULL || lines == NULL) {
+    return UBASIC_ERROR_MEMORY;
+  }
+  qsort(lines, count, sizeof(struct reload_line), reload_compare);
+#define REMAP(p) reload_position((p), old_program, old_lines, old_count, program, lines, count)
+
+  pos = REMAP(tokenizer_pos());
+  for(i = 0; i < gosub_stack_ptr; i++) {
+    gosub_stack[i].return_position = REMAP(gosub_stack[i].return_position);
+  }
+  for(i = 0; i < for_stack_ptr; i++) {
+    for_stack[i].position_after_for = REMAP(for_stack[i].position_after_for);
+  }
+  // keep the index entries of unchanged lines, which still start where they did
+  for(lidx = line_index_head, line_index_head = NULL; lidx != NULL; lidx = next) {
+    next = lidx->next;
+    lidx->program_text_position = REMAP(lidx->program_text_position);
+    tokenizer_goto(lidx->program_text_position);
+    if(tokenizer_token() == TOKENIZER_NUMBER && tokenizer_num() == lidx->line_number) {
+      if(tail != NULL) {
+        tail->next = lidx;
+      } else {
+        line_index_head = lidx;
+      }
+      tail = lidx;
+      lidx->next = NULL;
+    } else {
+      lidx->next = line_index_free; // arena addition - for index_add() to reuse
+      line_index_free = lidx;
+    }
+  }
+  line_index_current = tail;
+  // scale addition - the table again without the lines that went, and
+  // the next search for a line reads the new program from the top
+  line_index_scanned = NULL;
+  if(line_index_buckets != NULL) {
+    index_rehash(line_index_bits); // in the same table, emptied first
+  }
+  // end of scale addition
+#undef REMAP
+  for(i = 0; i < MAX_SVARNUM; i++) {
+    if(stringvariables[i] >= literal_pool && stringvariables[i] < literal_pool_end) {
+      stringvariables[i] = scpy(stringvariables[i]);
+    }
+  }
+  // arena addition - nothing of the old program's tables is used from here
+  // on, so they go at once; the line index and strings are kept
+  arena_reset(&load_arena);
+
+  bits = fraction_bits;
+  program_ptr = program;
+  literal_init(program);
+  error_info.kind = UBASIC_ERROR_NONE; // error addition - structure_init() may set it
+  structure_init(program);
+  finding_count = 0; // optimizer addition - every line is kept
+  jump_init(program, 1);
+  jump_thread(program);
+  call_init(program);
+  fuse_init(program);
+  vm_init(program); // vm addition
+  tokenizer_init(program);
+  tokenizer_goto(pos);
+  optimized_program = NULL; // optimizer addition - the old program went with the arena
+  // a program that gains or loses its fractions rescales its numbers
+  if(fraction_bits != bits) {
+    for(i = 0; i < MAX_VARNUM; i++) {
+      variables[i] = bits == 0 ? num_from_int(variables[i]) : variables[i] / (1L << bits);
+    }
+    for(i = 0; i < for_stack_ptr; i++) {
+      for_stack[i].to = bits == 0 ? num_from_int(for_stack[i].to) : for_stack[i].to / (1L << bits);
+    }
+  }
+  return error_info.kind; // error addition - a block that does not pair up stops it
+}
+// end of reload additions
+// replay additions
+/*---------------------------------------------------------------------------*/
+static void replay_put(int kind){
+  putc(kind, replay->file);
+}
+/*---------------------------------------------------------------------------*/
+static void replay_write(unsigned long long u){
+  // seven bits a byte, low bits first, so small values take one byte
+  while(u >= 0x80) {
+    putc((int)(u & 0x7f) | 0x80, replay->file);
+    u >>= 7;
+  }
+  putc((int)u, replay->file);
+}
+/*---------------------------------------------------------------------------*/
+static void replay_write_num(VARIABLE_TYPE v){
+  long long n = v;
+
+  // the sign goes in the low bit so small negative values stay short too
+  replay_write(n < 0 ? ~((unsigned long long)n << 1) : (unsigned long long)n << 1);
+}
+/*---------------------------------------------------------------------------*/
+static void replay_write_str(char const *s){
+  size_t len = strlen(s);
+
+  if(len > INPUT_BUFFERLEN) {
+    len = INPUT_BUFFERLEN;
+  }
+  replay_write(len);
+  fwrite(s, 1, len, replay->file);
+}
+/*---------------------------------------------------------------------------*/
+static void replay_put_num(int kind, VARIABLE_TYPE v){
+  replay_put(kind);
+  replay_write_num(v);
+}
+/*---------------------------------------------------------------------------*/
+static void replay_put_str(int kind, char const *s){
+  replay_put(kind);
+  replay_write_str(s);
+}
+/*---------------------------------------------------------------------------*/
+static int replay_next(void){
+  // the kind of the next entry, reading it if need be
+  int c;
+
+  if(replay->next == REPLAY_UNREAD) {
+    c = getc(replay->file);
+    replay->next = c == EOF ? REPLAY_END : c;
+    if(c == REPLAY_SET || c == REPLAY_SETSTR) {
+      replay->next_at = (unsigned long)replay_read();
+    }
+  }
+  return replay->next;
+}
+/*---------------------------------------------------------------------------*/
+static void replay_get(int kind){
+  // the script must ask for what it asked for when it was recorded
+  if(replay_next() != kind) {
+    basic_error(UBASIC_ERROR_REPLAY, TOKENIZER_ERROR);
+  }
+  replay->next = REPLAY_UNREAD;
+}
+/*---------------------------------------------------------------------------*/
+static unsigned long long replay_read(void){
+  unsigned long long u = 0;
+  int shift = 0;
+  int c;
+
+  do {
+    if((c = getc(replay->file)) == EOF || shift > 63) {
+      basic_error(UBASIC_ERROR_REPLAY, TOKENIZER_ERROR);
+    }
+    u |= (unsigned long long)(c & 0x7f) << shift;
+    shift += 7;
+  } while(c & 0x80);
+  return u;
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE replay_read_num(void){
+  unsigned long long u = replay_read();
+
+  return (VARIABLE_TYPE)(long long)((u >> 1) ^ (0 - (u & 1)));
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE replay_get_num(int kind){
+  replay_get(kind);
+  return replay_read_num();
+}
+/*---------------------------------------------------------------------------*/
+static char* replay_read_str(void){
+  unsigned long long len = replay_read();
+
+  if(len > INPUT_BUFFERLEN ||
+     fread(replay->text, 1, (size_t)len, replay->file) != len) {
+    basic_error(UBASIC_ERROR_REPLAY, TOKENIZER_ERROR);
+  }
+  replay->text[len] = '\0';
+  return replay->text;
+}
+/*---------------------------------------------------------------------------*/
+static char* replay_get_str(int kind){
+  replay_get(kind);
+  return replay_read_str();
+}
+/*---------------------------------------------------------------------------*/
+static void replay_statement(void){
+  // count the statement, first setting what the host set before it
+  int kind;
+  int var;
+
+  while(replay->replaying &&
+        (replay_next() == REPLAY_SET || replay_next() == REPLAY_SETSTR) &&
+        replay->next_at == replay->statements) {
+    kind = replay->next;
+    replay_get(kind);
+    var = (int)replay_read();
+    if(kind == REPLAY_SET) {
+      set_variable(var, replay_read_num());
+    } else {
+      set_stringvariable(var, scpy(replay_read_str()));
+    }
+  }
+  replay->statements++;
+}
+/*---------------------------------------------------------------------------*/
+static int replay_start(FILE *log, int replaying){
+  free(replay);
+  replay = NULL;
+  if(log == NULL) {
+    return 0;
+  }
+  if((replay = malloc(sizeof(struct replay_log))) == NULL) {
+    return -1;
+  }
+  replay->file = log;
+  replay->replaying = replaying;
+  replay->statements = 0;
+  replay->next = REPLAY_UNREAD;
+  replay->next_at = 0;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+int ubasic_record(FILE *log){
+  int r = 0;
 
+  if(RECORDING && fflush(replay->file) != 0) {
+    r = -1;
+  }
+  if(replay_start(log, 0) != 0) {
+    r = -1;
+  } else if(log != NULL && fwrite(REPLAY_MAGIC, 1, 8, log) != 8) {
+    replay_start(NULL, 0);
+    r = -1;
+  }
+  return r;
+}
 /*---------------------------------------------------------------------------*/
+int ubasic_replay(FILE *log){
+  char magic[8];
+
+  if(log != NULL &&
+     (fread(magic, 1, 8, log) != 8 || memcmp(magic, REPLAY_MAGIC, 8) != 0)) {
+    replay_start(NULL, 1);
+    return -1;
+  }
+  return replay_start(log, 1);
+}
+// end of replay additions
@@ -39,20 +39,260 @@
 #define __UBASIC_H__
 
 #include "vartype.h"
+#include <stdio.h>
 
 typedef VARIABLE_TYPE (*peek_func)(VARIABLE_TYPE);
 typedef void (*poke_func)(VARIABLE_TYPE, VARIABLE_TYPE);
 
 void ubasic_init(const char *program);
-void ubasic_run(void);
+void ubasic_init_peek_poke(const char *program, peek_func peek, poke_func poke);
+int ubasic_run(void);
 int ubasic_finished(void);
 
 VARIABLE_TYPE ubasic_get_variable(int varnum);
 void ubasic_set_variable(int varum, VARIABLE_TYPE value);
 
+// fraction addition - variables of a program with fractions hold fixed point
+// values with this many fraction bits, 0 for an integer program
+int ubasic_fraction_bits(void);
+// end of fraction addition
+
 // string addition
 char* ubasic_get_stringvariable(int);
 void ubasic_set_stringvariable(int, char *);
 // end of string addition
 
+// input addition
+void ubasic_set_input(FILE *);
+// end of input addition
+
+// trace addition
+enum {
+  UBASIC_TRACE_LINE,       // line number
+  UBASIC_TRACE_STATEMENT,  // statement token
+  UBASIC_TRACE_GOSUB,      // target line, calling line
+  UBASIC_TRACE_RETURN,     // calling line
+  UBASIC_TRACE_GC_START,   // bytes in use
+  UBASIC_TRACE_GC_END,     // bytes in use, bytes reclaimed
+  UBASIC_TRACE_PEEK,       // address, value
+  UBASIC_TRACE_POKE,       // address, value
+  UBASIC_TRACE_PEEK_BLOCK, // address, count
+  UBASIC_TRACE_POKE_BLOCK  // address, count
+};
+typedef void (*trace_func)(int event, int arg1, int arg2);
+void ubasic_set_trace(trace_func);
+// end of trace addition
+
+// heap addition
+enum {
+  UBASIC_GC_FIXED,    // collect once threshold bytes are in use
+  UBASIC_GC_RATIO,    // collect once threshold percent of the heap is in use
+  UBASIC_GC_ADAPTIVE  // collect when nearly full, grow the heap sooner
+};
+struct ubasic_heap_stats {
+  long collections;
+  double pause_time;       // seconds spent collecting
+  long bytes_reclaimed;
+  long bytes_allocated;
+  int peak_occupancy;      // bytes
+  int heap_size;           // bytes
+  double allocation_rate;  // bytes per second since ubasic_init()
+};
+void ubasic_heap_config(int initial_size, int max_size, int policy, int threshold);
+void ubasic_heap_stats(struct ubasic_heap_stats *);
+unsigned long long ubasic_clock(void); // nanoseconds
+// end of heap addition
+
+// error addition
+enum {
+  UBASIC_ERROR_NONE,
+  UBASIC_ERROR_SYNTAX,     // expected token not found
+  UBASIC_ERROR_STATEMENT,  // unknown statement, PEEK/POKE with no host function,
+                           // or a PARFOR body a worker cannot run
+  UBASIC_ERROR_LINE,       // GOTO/GOSUB to a line that does not exist
+  UBASIC_ERROR_STACK,      // GOSUB/FOR nesting too deep, RETURN/NEXT without GOSUB/FOR
+  UBASIC_ERROR_MEMORY,     // out of string space
+  UBASIC_ERROR_DIVIDE,     // division by zero
+  UBASIC_ERROR_REPLAY      // the script asked for an input the replay log does not hold
+};
+struct ubasic_error {
+  int kind;
+  int line;      // line number the error occurred on
+  int expected;  // token expected (TOKENIZER_ERROR if no particular token)
+  int found;     // token found
+};
+int ubasic_error(struct ubasic_error *);
+// end of error addition
+
+// context addition - the running interpreter is whichever context was
+// loaded last; a new context needs ubasic_init() before it can run.
+// Contexts saved from the same interpreter share its program tables and
+// string space, and ubasic_init() on one of them frees what the others
+// still use: give each program its own ubasic_context_new(). Freeing the
+// context that is loaded leaves the running interpreter pointing at freed
+// memory, so load another one first. Unless MAX_WORKERS (vartype.h) is 1
+// the interpreter state is thread local: an interpreter and its contexts
+// belong to the thread that runs them, and another thread calling
+// ubasic_run(), ubasic_context_load() or ubasic_get_variable() sees an
+// interpreter of its own, empty until it calls ubasic_init().
+struct ubasic_context;
+struct ubasic_context *ubasic_context_new(void);
+void ubasic_context_free(struct ubasic_context *);
+void ubasic_context_save(struct ubasic_context *);
+void ubasic_context_load(const struct ubasic_context *);
+// end of context addition
+
+// scheduler addition
+int ubasic_yielded(void); // ms asked for by SLEEP (0 for YIELD), or -1
+// end of scheduler addition
+
+// async addition - a callback returning UBASIC_PENDING parks the script
+// after that statement until the host calls ubasic_resume(); a callback
+// that calls ubasic_resume() itself before returning is not parked
+enum {
+  UBASIC_DONE,
+  UBASIC_PENDING
+};
+typedef int (*peek_async_func)(VARIABLE_TYPE addr, VARIABLE_TYPE *value);
+typedef int (*poke_async_func)(VARIABLE_TYPE addr, VARIABLE_TYPE value);
+void ubasic_set_async_peek_poke(peek_async_func, poke_async_func);
+int ubasic_pending(void);
+void ubasic_resume(VARIABLE_TYPE value); // the PEEK result, ignored for POKE
+// end of async addition
+
+// block addition - PEEK addr, v TO w / PEEK addr, s$, n and the POKE
+// equivalents move a whole range in one call; without block callbacks
+// they fall back to one peek_func/poke_func call per value
+typedef void (*peek_block_func)(VARIABLE_TYPE addr, VARIABLE_TYPE *dst, int n);
+typedef void (*poke_block_func)(VARIABLE_TYPE addr, VARIABLE_TYPE const *src, int n);
+void ubasic_set_block_peek_poke(peek_block_func, poke_block_func);
+// end of block addition
+
+// parallel addition - PARFOR runs its slices on up to n threads at once
+// (at most MAX_WORKERS, 1 by default); with more than one, peek_func and
+// poke_func are called from those threads too
+void ubasic_set_workers(int n);
+// end of parallel addition
+
+// call addition - CALL name(args) runs a host function, as a statement or
+// in an expression. types holds the result type then one per argument,
+// 'n' for a whole number (as for PEEK/POKE) or 's' for a string, which
+// is only valid during the call; a function returning a string has a
+// name ending in $. Register functions before ubasic_init().
+union ubasic_value {
+  VARIABLE_TYPE num;
+  char const *str;
+};
+typedef union ubasic_value (*call_func)(union ubasic_value const *args);
+int ubasic_register_function(const char *name, call_func fn, int arity, const char *types);
+// end of call addition
+
+// reload addition - put a new version of the running program in its place,
+// keeping variables and strings. Positions in lines that are unchanged
+// stay put, ones in changed lines move to the start of that line (or the
+// next one). The old program must stay valid until this returns.
+// A WHILE, WEND, IF or ENDIF that does not pair up stops the program, as
+// in ubasic_init(), and its error is returned.
+int ubasic_reload(const char *program); // UBASIC_ERROR_MEMORY if it cannot
+// end of reload addition
+
+// replay addition - record every value that reaches the script from outside
+// (PEEK and CALL results, INPUT lines and EOF, variables the host sets) to
+// log, or replay a recording in their place: PEEK and CALL then do not call
+// the host, INPUT does not read and ubasic_set_variable() is ignored. Start
+// after ubasic_init(); NULL stops. Both return -1 on failure.
+int ubasic_record(FILE *log); // log opened "wb"
+int ubasic_replay(FILE *log); // log opened "rb"
+// end of replay addition
+
+// superinstruction addition - IF v relop k THEN GOTO n, LET v = w + k,
+// FOR v = a TO b with its NEXT v, and PRINT v are decoded when the program
+// is loaded and run without the expression parser. Counts are kept since
+// ubasic_init() or ubasic_reload().
+enum {
+  UBASIC_FUSED_IF_GOTO,
+  UBASIC_FUSED_ADD,
+  UBASIC_FUSED_FOR,
+  UBASIC_FUSED_NEXT,
+  UBASIC_FUSED_PRINT,
+  UBASIC_FUSED_KINDS
+};
+struct ubasic_fused_stats {
+  long statements;                  // statements run
+  int sites[UBASIC_FUSED_KINDS];    // statements of each kind in the program
+  long hits[UBASIC_FUSED_KINDS];    // of those run
+};
+void ubasic_set_fused(int on); // 1 by default, takes effect at ubasic_init()
+void ubasic_fused_stats(struct ubasic_fused_stats *);
+// end of superinstruction addition
+
+// optimizer addition - ubasic_init() points every GOTO and GOSUB at its
+// line, sends a jump that lands on a GOTO straight on to where that GOTO
+// goes and leaves out the lines nothing can reach (a program without line
+// numbers keeps them as empty lines, so text lines keep their numbers).
+// ubasic_reload() resolves and threads jumps but keeps every line. The
+// findings last until the next ubasic_init() or ubasic_reload().
+enum {
+  UBASIC_FINDING_TARGET,      // GOTO or GOSUB to a line or label that does not exist
+  UBASIC_FINDING_UNREACHABLE, // a line nothing reaches, left out
+  UBASIC_FINDING_THREADED     // a jump that lands on a GOTO, now going to its target
+};
+struct ubasic_finding {
+  int kind;
+  int line;    // line of the jump, or the line left out
+  int target;  // line the jump goes to, -1 for a label that does not exist
+};
+void ubasic_set_optimize(int on); // 1 by default, takes effect at ubasic_init()
+int ubasic_findings(struct ubasic_finding *list, int max); // returns how many there are
+// end of optimizer addition
+
+// vm addition - ubasic_init() can compile each statement into code for a
+// register machine, whose registers are the variables, and run that
+// instead of walking the tokens. Statements it does not compile (PEEK,
+// POKE, INPUT, SLEEP, YIELD, PARFOR and those using EOF or CALL) are
+// walked as before, so a program behaves the same on either engine.
+enum {
+  UBASIC_ENGINE_TREE, // walk the tokens of each statement as it runs
+  UBASIC_ENGINE_VM    // run compiled statements on the register VM
+};
+void ubasic_set_engine(int engine); // UBASIC_ENGINE_TREE by default, takes effect at ubasic_init()
+// end of vm addition
+
+// scale addition - bytes the running interpreter has from malloc() for its
+// program tables, line index, strings and input
+long ubasic_memory(void);
+// end of scale addition
+
+// profile addition - while profiling, the time and hardware counters of the
+// thread running the program go to the kind of statement or string function
+// running, less what the functions it calls take. The counters come from
+// perf_event_open() on Linux; ones the system does not have or allow, and
+// all of them elsewhere, read -1. Collections are left out (see
+// ubasic_heap_stats()), as are PARFOR slices run on other threads.
+enum {
+  UBASIC_COUNTER_CYCLES,
+  UBASIC_COUNTER_INSTRUCTIONS,
+  UBASIC_COUNTER_BRANCH_MISSES,
+  UBASIC_COUNTER_L1D_MISSES,  // level 1 data cache read misses
+  UBASIC_COUNTER_LLC_MISSES,  // last level cache misses
+  UBASIC_COUNTERS
+};
+struct ubasic_profile {
+  int token;                           // statement or string function
+  long count;                          // times run
+  unsigned long long time;             // nanoseconds
+  long long counters[UBASIC_COUNTERS]; // -1 if not available
+};
+int ubasic_set_profile(int on); // starts afresh, returns the counters open as 1 << UBASIC_COUNTER_...
+int ubasic_profile(struct ubasic_profile *list, int max); // returns how many kinds have run
+// end of profile addition
+
+// sampler addition - the line the subroutine of each GOSUB the running
+// interpreter is in starts at, outermost first, then the line it is on;
+// returns how many lines that is, 0 on a thread with no program. It only
+// reads memory, so a SIGPROF handler can call it whatever the interpreter
+// is doing; one taken in the middle of a GOSUB or RETURN may show either side.
+int ubasic_call_stack(int *lines, int max);
+// end of sampler addition
+
 #endif /* __UBASIC_H__ */